@@ -13,6 +13,7 @@
 #include "ha_tsdb_engine.h"
 #include "probes_mysql.h"
 #include "sql_plugin.h"
+#include "log.h"
 
 
 //internal use
@@ -23,6 +24,25 @@
 //gobal variables:
 const char* ha_tsdb_engine_system_database= NULL;
 
+//blocks read ahead by table scans, 0 disables read-ahead
+static ulong srv_prefetch_depth= 2;
+//defaults of the storage options, see tsdb_storage_options
+static ulong srv_chunk_records= 0;
+static ulong srv_chunk_cache_size= 1024 * 1024;
+static ulong srv_meta_cache_size= 0;
+static uint srv_deflate_level= 0;
+//seconds between two passes of the retention task
+static ulong srv_retention_interval= 60;
+static ulong srv_flush_log_at_insert= TSDB_WAL_FLUSH_INSERT;
+//largest metadata cache accepted by H5Pset_mdc_config()
+#define TSDB_META_CACHE_MAX (128 * 1024 * 1024)
+
+//serializes the creation of .tsdb files
+static mysql_mutex_t tsdb_create_mutex;
+
+//size in bytes of the per handler append buffer used by bulk inserts
+#define TSDB_APPEND_BUFFER_SIZE (4*1024*1024)
+
 //file extensions
 static const char *ha_tsdb_engine_exts[] = {
   ".tsdb"
@@ -57,401 +77,2230 @@ static bool tsdb_engine_is_supported_system_table(const char *db,
    
 //tsdb_engine_share impl 
 
+/*
+  thr_lock callback: a TL_WRITE_CONCURRENT_INSERT lock is only granted next to
+  readers when the table has a check_status, and it returns FALSE to allow it.
+  Records are never updated in place, readers stop at their watermark.
+*/
+static my_bool tsdb_check_status(void* param)
+{
+  return FALSE;
+}
+
 //ctor
 tsdb_engine_share::tsdb_engine_share()
 {
   thr_lock_init(&lock);
+  lock.check_status = tsdb_check_status;
+  mysql_mutex_init(tsdb_key_mutex_share, &mutex, MY_MUTEX_INIT_FAST);
   use_count=0;
+  file_id = -1;
+  psi_file = NULL;
+  series = NULL;
+  records_id = -1;
+  records_type = -1;
+  record_size = 0;
+  format = TSDB_FORMAT_PACKED;
+  codec_built = false;
+  origin = 0;
+  retention = 0;
+  scans = 0;
+  client_time = false;
+  records = 0;
+  first_ts = last_ts = 0;
+  update_time = 0;
+  view = NULL;
 }
 
-
-
-//init func 
-static int tsdb_engine_init_func(void *p)
+//dtor: the share outlives every handler of the table, release the series here
+tsdb_engine_share::~tsdb_engine_share()
 {
-  DBUG_ENTER("tsdb_engine_init_func");
-
-  tsdb_engine_hton= (handlerton *)p;
-  tsdb_engine_hton->state=                     SHOW_OPTION_YES;
-  tsdb_engine_hton->create=                    tsdb_engine_create_handler;
-  tsdb_engine_hton->flags=                     HTON_CAN_RECREATE;
-  tsdb_engine_hton->system_database=   tsdb_engine_system_database;
-  tsdb_engine_hton->is_supported_system_table= tsdb_engine_is_supported_system_table;
-
-  DBUG_RETURN(0);
+  tsdb_retention_task.remove(this);
+  //the log is only removed once its records are in the closed file
+  bool flushed = NULL != series && flush_reorder() == 0;
+  if ( NULL != series && !flushed )
+    sql_print_error("tsdb_engine: could not append the records of the reorder buffer");
+  if ( records_type >= 0 )
+    H5Tclose(records_type);
+  if ( records_id >= 0 )
+    H5Dclose(records_id);
+  if ( NULL != series )
+  {
+    rollup.close(records);
+    tags.close(records);
+    series_set.close();
+    save_stats();
+  }
+  heap.close();
+  partitions.close();
+  if ( NULL != view )
+    delete view;
+  if ( NULL != series )
+    delete series;
+  if ( file_id >= 0 )
+  {
+    tsdb_file_wait wait(PSI_FILE_CLOSE, psi_file, 0, __FILE__, __LINE__);
+    H5Fclose(file_id);
+    wait.closed();
+  }
+  wal.close(flushed);
+  mysql_mutex_destroy(&mutex);
+  thr_lock_delete(&lock);
 }
 
-
-//ha_tsdb_engine impl
-tsdb_engine_share *ha_tsdb_engine::get_share()
+/*
+    @function tsdb_file_access
+    @brief file access properties with the caches of a table
+    @details datasets opened with H5P_DEFAULT, the library's included, take
+             the file caches
+    @return a property list the caller closes
+*/
+hid_t tsdb_file_access(const tsdb_storage_options& options)
 {
-  tsdb_engine_share *tmp_share;
-
-  DBUG_ENTER("ha_tsdb_engine::get_share()");
-
-  lock_shared_ha_data();
-  if (!(tmp_share= static_cast<tsdb_engine_share*>(get_ha_share_ptr())))
+  hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+  size_t slots = options.chunk_cache / 1024;
+  H5Pset_cache(fapl, 0, (slots < 521 ? 521 : slots) | 1, options.chunk_cache, 0.75);
+  if ( options.meta_cache > 0 )
   {
-    tmp_share= new tsdb_engine_share;
-    if (!tmp_share)
-      goto err;
-
-    set_ha_share_ptr(static_cast<Handler_share*>(tmp_share));
+    H5AC_cache_config_t config;
+    config.version = H5AC__CURR_CACHE_CONFIG_VERSION;
+    if ( H5Pget_mdc_config(fapl, &config) >= 0 )
+    {
+      config.set_initial_size = true;
+      config.initial_size = options.meta_cache;
+      if ( config.max_size < config.initial_size )
+        config.max_size = config.initial_size;
+      if ( config.min_size > config.initial_size )
+        config.min_size = config.initial_size;
+      H5Pset_mdc_config(fapl, &config);
+    }
   }
-err:
-  unlock_shared_ha_data();
-  DBUG_RETURN(tmp_share);
+  return fapl;
 }
 
-//static function tsdb_engine_create_handler
 /*
- @brief this function creates a handler of ha_tsdb_engine handler
- TODO: ?? explain more this machin
+    @function tsdb_engine_share::open_series
+    @brief open the HDF5 file and the Timeseries once for all handlers
+    @params filename full path of the .tsdb file
+    @return mysql error code
+    @note caller must hold mutex; the records of a partitioned table are in
+          the files of its partitions, the main file keeps the structure,
+          the rollups and the partition catalog. The log is replayed by
+          recover() once the codec and what it feeds are open.
 */
-static handler* tsdb_engine_create_handler(handlerton *hton,
-                                       TABLE_SHARE *table, 
-                                       MEM_ROOT *mem_root)
+int tsdb_engine_share::open_series(const char* filename, const tsdb_storage_options& options)
 {
-  return new (mem_root) ha_tsdb_engine(hton, table);
+  if ( NULL != series )
+    return 0;
+
+  hid_t fapl = tsdb_file_access(options);
+  tsdb_file_wait wait(PSI_FILE_OPEN, filename, __FILE__, __LINE__);
+  file_id = H5Fopen(filename, H5F_ACC_RDWR, fapl);
+  psi_file = wait.opened(file_id >= 0);
+  H5Pclose(fapl);
+  if ( file_id < 0 )
+  {
+    sql_print_error("tsdb_engine: cannot open the file '%s'", filename);
+    return HA_ERR_NO_SUCH_TABLE;
+  }
+  try{
+    series = new tsdb::Timeseries(file_id,"tsdb");
+  }catch(...)
+  {
+    tsdb_file_wait close_wait(PSI_FILE_CLOSE, psi_file, 0, __FILE__, __LINE__);
+    H5Fclose(file_id);
+    close_wait.closed();
+    file_id = -1;
+    psi_file = NULL;
+    series = NULL;
+    return HA_ERR_CRASHED_ON_USAGE;
+  }
+  record_size = series->structure()->getSizeOf();
+  if ( H5Aexists_by_name(file_id, "/", TSDB_FORMAT_ATTR, H5P_DEFAULT) > 0 )
+    H5LTget_attribute_int(file_id, "/", TSDB_FORMAT_ATTR, &format);
+  locate_records();
+  retention = options.retention;
+  client_time = options.time_key;
+  reorder.init(record_size, options.reorder_window);
+  MY_STAT stat_info;
+  if ( my_stat(filename, &stat_info, MYF(0)) != NULL )
+    update_time = (ulong)stat_info.st_mtime;
+  int rc = partitions.open(this, filename, options);
+  if ( rc == 0 )
+    load_stats();
+  return rc;
 }
 
-
-//ctor
-//call super ctor
-ha_tsdb_engine::ha_tsdb_engine(handlerton *hton, TABLE_SHARE *table_arg)
-  :handler(hton, table_arg)
+//stable order of logged records on _TSDB_timestamp, see recover()
+struct tsdb_logged_order
 {
-  fTMSeries = NULL;
-}
-
+  const uchar* records;
+  size_t record_size;
 
+  bool operator()(uint64 a, uint64 b) const
+  {
+    longlong ta, tb;
+    memcpy(&ta, records + a * record_size, 8);
+    memcpy(&tb, records + b * record_size, 8);
+    return ta < tb;
+  }
+};
 
-//ha_tsdb_engine::bas_ext() return our extension
-const char **ha_tsdb_engine::bas_ext() const
+/*
+    @function tsdb_engine_share::recover
+    @brief open the log of the series and replay the records the file
+           lost in a crash
+    @details since the checkpoint the series got the logged records in
+             insert order, or with a reorder window in time order, and the
+             buffer kept the rest: the records past the checkpoint count
+             that the file has are the first ones of that order and are
+             skipped, the others go through the reorder buffer again. A
+             checkpoint then makes the file and the log agree. Replayed
+             records go through append() like new ones: to their series,
+             tag index and rollups.
+    @return mysql error code
+    @note caller must hold mutex
+*/
+int tsdb_engine_share::recover(const char* filename)
 {
-  return ha_tsdb_engine_exts;
+  std::string name = std::string(filename) + TSDB_WAL_EXT;
+  std::vector<uchar> logged;
+  uint64 since;
+  int rc = wal.open(name.c_str(), record_size, records, &since, &logged);
+  if ( rc )
+  {
+    sql_print_error("tsdb_engine: cannot open the log '%s'", name.c_str());
+    return rc;
+  }
+  uint64 n = logged.size() / record_size;
+  uint64 skip = records > since ? records - since : 0;
+  if ( skip >= n )
+    return n > 0 ? checkpoint() : 0;
+
+  std::vector<uchar> replay;
+  const uchar* recs = &logged[0];
+  if ( reorder.active() )
+  {
+    tsdb_logged_order order = { &logged[0], record_size };
+    std::vector<uint64> index(n);
+    for ( uint64 i = 0; i < n; i++ )
+      index[i] = i;
+    std::stable_sort(index.begin(), index.end(), order);
+    replay.resize(logged.size());
+    for ( uint64 i = 0; i < n; i++ )
+      memcpy(&replay[i * record_size], &logged[index[i] * record_size], record_size);
+    recs = &replay[0];
+  }
+  sql_print_information("tsdb_engine: replaying %llu records of the log '%s'",
+                        (ulonglong)(n - skip), name.c_str());
+  rc = place(recs + skip * record_size, n - skip);
+  if ( rc == 0 )
+    rc = checkpoint();
+  return rc;
 }
 
-const char* tsdb_engine_system_database()
+/*
+    @function tsdb_engine_share::rebuild_records
+    @brief rewrite the records dataset with a new layout, see tsdb_rebuild_records()
+    @details the library and locate_records() hold the old dataset open, both
+             are reopened on the new one; handlers reach the series through
+             the share so none of them keeps the old object
+    @return mysql error code
+    @note caller must hold mutex
+*/
+int tsdb_engine_share::rebuild_records(const tsdb_records_layout& layout)
 {
-  return ha_tsdb_engine_system_database;
+  if ( NULL == series )
+    return HA_ERR_WRONG_COMMAND;
+  if ( partitions.active() )
+    return partitions.rebuild(layout);
+  if ( records_type >= 0 )
+    H5Tclose(records_type);
+  if ( records_id >= 0 )
+    H5Dclose(records_id);
+  records_type = records_id = -1;
+  delete series;
+  series = NULL;
+
+  int rc = tsdb_rebuild_records(file_id, record_size, layout);
+  try{
+    series = new tsdb::Timeseries(file_id,"tsdb");
+  }catch(...)
+  {
+    series = NULL;
+    return HA_ERR_CRASHED_ON_USAGE;
+  }
+  locate_records();
+  return rc;
 }
 
-//list of all systems tables specific to our engine
-//we do not need to implemnt this because it's generic
-//until we do not have system table we just put NULL
-//TODO: remove this stuff
-static st_system_tablename ha_tsdb_engine_system_tables[]= {
-  {(const char*)NULL, (const char*)NULL}
-};
-
-
-/**
-  @brief Check if the given db.tablename is a system table for this SE.
-  @param db                         Database name to check.
-  @param table_name                 table name to check.
-  @param is_sql_layer_system_table  if the supplied db.table_name is a SQL
-                                    layer system table.
-  @return
-    @retval TRUE   Given db.table_name is supported system table.
-    @retval FALSE  Given db.table_name is not a supported system table.
+/*
+    @function tsdb_engine_share::open_view
+    @brief open the rollup level read by a companion table
+    @params name table path, option value "<source table>:<level>"
+    @return mysql error code
+    @note caller must hold mutex
 */
-static bool tsdb_engine_is_supported_system_table(const char *db,
-                                              const char *table_name,
-                                              bool is_sql_layer_system_table)
+int tsdb_engine_share::open_view(const char* name, const std::string& option)
 {
-  st_system_tablename *systab;
-
-  // Does this SE support "ALL" SQL layer system tables ?
-  if (is_sql_layer_system_table)
-    return false;
+  if ( NULL != view )
+    return 0;
 
-  // Check if this is SE layer system tables
-  systab= ha_tsdb_engine_system_tables;
-  while (systab && systab->db)
+  size_t sep = option.find(':');
+  if ( sep == std::string::npos )
   {
-    if (systab->db == db &&
-        strcmp(systab->tablename, table_name) == 0)
-      return true;
-    systab++;
+    sql_print_error("tsdb_engine: " TSDB_OPT_ROLLUP " of '%s' must be <table>:<level>", name);
+    return HA_ERR_UNSUPPORTED;
   }
+  //the source table lives in the same database directory
+  std::string filename(name);
+  size_t dir = filename.rfind('/');
+  filename = (dir == std::string::npos ? std::string() : filename.substr(0, dir + 1)) +
+             option.substr(0, sep) + ".tsdb";
 
-  return false;
+  view = new tsdb_rollup_reader;
+  int rc = view->open(filename.c_str(), option.substr(sep + 1).c_str());
+  if ( rc )
+  {
+    delete view;
+    view = NULL;
+  }
+  return rc;
 }
 
 /*
-    @function ha_tsdb_engine:open()
-    @brief open a table
-    @params
-        name table file name
-        mode O_RDONLY  or O_RDWR
-        test_if_locked self-segnificant :)
-    @return mysql error code 
-    
+    @function tsdb_engine_share::lower_bound
+    @brief index of the first live record whose _TSDB_timestamp >= ts
+    @note caller must hold mutex
 */
-
-int ha_tsdb_engine::open(const char *name, int mode, uint test_if_locked)
+uint64 tsdb_engine_share::lower_bound(longlong ts)
 {
-    //need to be changed to open our table
-  DBUG_ENTER("ha_tsdb_engine::open");
-  
-
-  if (!(share = get_share()))
-    DBUG_RETURN(1);
-  thr_lock_data_init(&share->lock,&lock,NULL);
-  
-  std::string filename(name);
-  filename+=bas_ext()[0]; //add ".tsdb"
-  
-  hid_t ofh = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
-  if(ofh < 0) 
+  uint64 low = origin, high = records;
+  tsdb_block block;
+  bracket(ts, &low, &high);
+  while ( low < high )
   {
-			std::cerr << "Error opening TSDB file: '" << filename << "'." << std::endl;
-			return 0;
-	}
-	try{
-	fTMSeries = new tsdb::Timeseries(ofh,"tsdb");
-	}catch(...)
-	{
-	  return -1;
-	}
-  H5Fclose(ofh);
-  
-  DBUG_RETURN(0);
+    uint64 mid = low + (high - low) / 2;
+    longlong value;
+    if ( fetch_records(mid, mid + 1, &block) || block.count == 0 )
+      break;
+    memcpy(&value, block.record(0), 8);
+    if ( value < ts )
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
 }
 
+/*
+    @function tsdb_engine_share::bracket
+    @brief narrow the range [low, high) searched for the first record whose
+           _TSDB_timestamp >= ts to one partition, without reading records
+    @note caller must hold mutex
+*/
+void tsdb_engine_share::bracket(longlong ts, uint64* low, uint64* high)
+{
+  if ( !partitions.active() )
+    return;
+  //the records of the reorder buffer follow the last partition
+  uint64 end = *high;
+  if ( *high > records )
+    *high = records;
+  if ( *low < *high )
+    partitions.bracket(ts, low, high);
+  if ( *low == *high )
+    *high = end;
+}
 
 /*
-    @function ha_tsdb_engine::close
-    @brief close table
-    @params void
-    @return mysql error code
+    @function tsdb_engine_share::load_stats
+    @brief initialize the series metadata kept for info() and index_first/last
+    @details the metadata saved by save_stats() is used when it matches the
+             record count of the series, otherwise the first and last records
+             are read back
+    @note caller must hold mutex
 */
-int ha_tsdb_engine::close(void)
+void tsdb_engine_share::load_stats()
 {
-  DBUG_ENTER("ha_tsdb_engine::close");
-  
-  H5close();
-  if (NULL != fTMSeries )
-    delete fTMSeries;
-  
-  DBUG_RETURN(0);
+  tsdb_block block;
+  long long saved = -1;
+  records = partitions.active() ? partitions.records() : series->getNRecords();
+  origin = 0;
+  first_ts = last_ts = 0;
+  first_record.assign(record_size, 0);
+  last_record.assign(record_size, 0);
+  if ( H5Aexists_by_name(file_id, "/", TSDB_META_ORIGIN, H5P_DEFAULT) > 0 &&
+       H5LTget_attribute_long_long(file_id, "/", TSDB_META_ORIGIN, &saved) >= 0 )
+    origin = (uint64)saved < records ? saved : records;
+  saved = -1;
+  if ( records == origin )
+    return;
+
+  if ( H5Aexists_by_name(file_id, "/", TSDB_META_RECORDS, H5P_DEFAULT) > 0 &&
+       H5LTget_attribute_long_long(file_id, "/", TSDB_META_RECORDS, &saved) >= 0 &&
+       saved == (long long)records &&
+       H5LTget_attribute_uchar(file_id, "/", TSDB_META_FIRST, &first_record[0]) >= 0 &&
+       H5LTget_attribute_uchar(file_id, "/", TSDB_META_LAST, &last_record[0]) >= 0 )
+  {
+    memcpy(&first_ts, &first_record[0], 8);
+    memcpy(&last_ts, &last_record[0], 8);
+    return;
+  }
+
+  if ( fetch_records(origin, origin + 1, &block) == 0 && block.count > 0 )
+    memcpy(&first_record[0], block.record(0), record_size);
+  if ( fetch_records(records - 1, records, &block) == 0 && block.count > 0 )
+    memcpy(&last_record[0], block.record(0), record_size);
+  memcpy(&first_ts, &first_record[0], 8);
+  memcpy(&last_ts, &last_record[0], 8);
 }
 
+/*
+    @function tsdb_engine_share::save_stats
+    @brief persist the series metadata in root attributes of the file
+    @note called when the share is released; a crash leaves a count that
+          does not match and load_stats() reads the records again
+*/
+void tsdb_engine_share::save_stats()
+{
+  long long count = records;
+  if ( records == 0 )
+    return;
+  H5LTset_attribute_long_long(file_id, "/", TSDB_META_RECORDS, &count, 1);
+  H5LTset_attribute_uchar(file_id, "/", TSDB_META_FIRST, &first_record[0], record_size);
+  H5LTset_attribute_uchar(file_id, "/", TSDB_META_LAST, &last_record[0], record_size);
+}
 
 /*
-    @function ha_tsdb_engine::write_row
-    @brief insert row
-    @params buf is an uchar* that we could cast to any struct
+    @function tsdb_engine_share::append
+    @brief append n packed records to the series, to their partitions or
+           to the series of their keys
     @return mysql error code
+    @note caller must hold mutex
 */
-
-int ha_tsdb_engine::write_row(uchar *buf)
+int tsdb_engine_share::append(const uchar* recs, uint64 n)
 {
-  DBUG_ENTER("ha_tsdb_engine::write_row");
- 
- 
- size_t recordsize = fTMSeries->structure()->getSizeOf();
- uchar* recordPtr = (uchar*)thd_alloc(ha_thd(),recordsize + 8 + 1); //8bytes for time stamps, 1 dummy byte
- 
- struct timeval  tms;
- if (gettimeofday(&tms,NULL)) 
- {
-        return -1;
- }
-  int64_t micros = tms.tv_sec * 1000ull;
-  /* Add full microseconds */
-  micros += tms.tv_usec/1000;
- 
-  
-  //std::cerr << "[NOTE]: micros = " << micros << std::endl;
-  
-  memcpy(recordPtr,&micros,8);
-  uchar* urecord = recordPtr;
-  recordPtr+=8;
-  memcpy(recordPtr, buf, table->s->null_bytes);
-  recordPtr += table->s->null_bytes;
-   for (Field **field = table->field ; *field ; field++)
-   {
-     
-     if ( !((*field)->is_null()) )
-     {
-       //(*field)>pack()
-       //uchar* to = (uchar*)sql_alloc((*field)->data_length());
-       if ( !((*field)->is_null()))
-          recordPtr=  (*field)->pack(recordPtr,buf+(*field)->offset(table->record[0]));
-  	//   std::cerr << "[NOTE] data length "<< (*field)->data_length() <<std::endl;
-       //std::cerr << "[NOTE] field offset:" << (*field)->offset(table->record[0]) << " " << buf + (*field)->offset(table->record[0])<< std::endl;
-      
-     }
-   }
-
- //must remove exception to enhance performance for win32 bit
-  try{
-  fTMSeries->appendRecords(1,urecord,true);
-  
+  int rc = 0;
+  uint64 done = 0;
+  if ( series_set.active() )
+  {
+    rc = series_set.append(recs, n);
+    done = rc ? 0 : n;
   }
-  catch (tsdb::TimeseriesException& e)
+  else if ( partitions.active() )
+    rc = partitions.append(recs, n, &done);
+  else
   {
-    std::cerr << "COULD NOT SAVE ROW " << e.what() << std::endl;
+    tsdb_file_wait wait(PSI_FILE_WRITE, psi_file, n * record_size, __FILE__, __LINE__);
+    try{
+      series->appendRecords(n,(void*)recs,true);
+      done = n;
+    }
+    catch (tsdb::TimeseriesException& e)
+    {
+      sql_print_error("tsdb_engine: could not save %llu rows: %s", (ulonglong)n, e.what());
+      rc = HA_ERR_GENERIC;
+    }
+    wait.end(done * record_size);
   }
-
-  
-  DBUG_RETURN(0);
+  appended(recs, done);
+  //a series table may have got part of a failed batch
+  if ( rc && series_set.active() )
+    records = series_set.records();
+  return rc;
 }
 
+/*
+    @function tsdb_engine_share::insert
+    @brief log n records of an INSERT and append them, through the reorder
+           buffer
+    @details records carrying their own time must not go back before the
+             last appended one, the last one of their series in a series
+             table. With a reorder window they wait in the buffer and are
+             appended in time order once newer records push the window
+             past them.
+    @params values heap values of the records, their references are moved
+            to where the heap puts them
+            lsn set to the log position to sync, see tsdb_wal::sync()
+    @return mysql error code, HA_ERR_TSDB_LATE_RECORD when a record comes
+            too late; the batch is then refused as a whole and a warning
+            gives the time of the record
+    @note caller must hold mutex
+*/
+int tsdb_engine_share::insert(uchar* recs, uint64 n, const tsdb_heap_buffer& values, uint64* lsn)
+{
+  int rc = 0;
+  longlong low = records > 0 ? last_ts : LLONG_MIN;
+  //records of a series table are in order within their own series
+  uint64 late = client_time && series_set.active() ? series_set.late(recs, n, !reorder.active()) : n;
+  if ( late < n )
+  {
+    memcpy(&low, recs + late * record_size, 8);
+    push_warning_printf(current_thd, Sql_condition::SL_WARNING, ER_UNKNOWN_ERROR,
+                        "Record at %lld ms is older than the last one of its series", low);
+    return HA_ERR_TSDB_LATE_RECORD;
+  }
+  for ( uint64 i = 0; client_time && !series_set.active() && i < n; i++ )
+  {
+    longlong ts;
+    memcpy(&ts, recs + i * record_size, 8);
+    if ( ts < low )
+    {
+      push_warning_printf(current_thd, Sql_condition::SL_WARNING, ER_UNKNOWN_ERROR,
+                          "Record at %lld ms is older than the series, last at %lld ms", ts, low);
+      return HA_ERR_TSDB_LATE_RECORD;
+    }
+    if ( !reorder.active() )
+      low = ts;
+  }
 
+  //values coded by pack_row() reach the file before the records using them
+  if ( tags.active() && (rc = tags.save()) )
+    return rc;
+  if ( !values.empty() )
+  {
+    uint64 base;
+    if ( !heap.is_open() )
+      return HA_ERR_INTERNAL_ERROR;
+    if ( (rc = heap.append(&values[0], values.size(), &base)) )
+      return rc;
+    codec.rebase(recs, n, base);
+    if ( wal.is_open() && H5Fflush(file_id, H5F_SCOPE_LOCAL) < 0 )
+      return HA_ERR_INTERNAL_ERROR;
+  }
+  *lsn = 0;
+  if ( wal.is_open() && (rc = wal.write(recs, n, lsn)) )
+    return rc;
+  update_time = (ulong)my_time(0);
+  rc = place(recs, n);
+  //a failed append leaves the file behind the log: bring them together
+  if ( rc || wal.size() > TSDB_WAL_CHECKPOINT_SIZE )
+  {
+    int err = checkpoint();
+    rc = rc ? rc : err;
+  }
+  return rc;
+}
 
 /*
-    @function ha_tsdb_engine::update_row
-    @brief update row
-    @params old_data and new_data are unsigned char ptrs
+    @function tsdb_engine_share::place
+    @brief append logged records, or buffer them until the reorder window
+           passes them
     @return mysql error code
+    @note caller must hold mutex
 */
-
-int ha_tsdb_engine::update_row(const uchar *old_data, uchar *new_data)
+int tsdb_engine_share::place(const uchar* recs, uint64 n)
 {
+  if ( !reorder.active() )
+    return append(recs, n);
+
+  uint64 count;
+  reorder.add(recs, n);
+  const uchar* batch = reorder.sealed(&count);
+  if ( count == 0 )
+    return 0;
+  int rc = append(batch, count);
+  reorder.consume(count);
+  return rc;
+}
 
-  DBUG_ENTER("ha_tsdb_engine::update_row");
-  //prealably must not update time series
-  DBUG_RETURN(1);
+/*
+    @function tsdb_engine_share::flush_reorder
+    @brief append every record of the reorder buffer, when the share is released
+    @return mysql error code
+    @note caller must hold mutex
+*/
+int tsdb_engine_share::flush_reorder()
+{
+  uint64 count;
+  const uchar* batch = reorder.all(&count);
+  if ( count == 0 )
+    return 0;
+  int rc = append(batch, count);
+  reorder.consume(count);
+  return rc;
 }
 
+/*
+    @function tsdb_engine_share::checkpoint
+    @brief flush the HDF5 files and start the log again with the records
+           still buffered
+    @return mysql error code
+    @note caller must hold mutex
+*/
+int tsdb_engine_share::checkpoint()
+{
+  if ( !wal.is_open() )
+    return 0;
+  if ( H5Fflush(file_id, H5F_SCOPE_LOCAL) < 0 || partitions.flush() )
+    return HA_ERR_INTERNAL_ERROR;
+  uint64 count;
+  const uchar* buffered = reorder.all(&count);
+  return wal.checkpoint(records, buffered, count);
+}
 
 /*
-    @function ha_tsdb_engine::delete_row
-    @brief update row
-    @params buf is const uchar ptr
+    @function tsdb_engine_share::expire
+    @brief make the records before index invisible, for retention, DELETE
+           of the oldest rows and TRUNCATE
+    @details only the origin is moved and saved, the records stay where
+             they are; partitions entirely before it are removed once no
+             scan runs, see end_scan(). A series table only drops all its
+             records, its series are removed.
     @return mysql error code
+    @note caller must hold mutex
 */
+int tsdb_engine_share::expire(uint64 index)
+{
+  if ( index > records )
+    index = records;
+  if ( index <= origin )
+    return 0;
+  //a series table has no single order to expire a prefix of
+  if ( series_set.active() )
+    return index < records ? HA_ERR_WRONG_COMMAND : series_set.clear();
+
+  long long saved = index;
+  if ( H5LTset_attribute_long_long(file_id, "/", TSDB_META_ORIGIN, &saved, 1) < 0 )
+    return HA_ERR_INTERNAL_ERROR;
+  origin = index;
+
+  //index_first() and MIN() read the first live record from the share
+  tsdb_block block;
+  if ( origin < records && fetch_records(origin, origin + 1, &block) == 0 && block.count > 0 )
+  {
+    memcpy(&first_record[0], block.record(0), record_size);
+    memcpy(&first_ts, &first_record[0], 8);
+  }
+  if ( scans == 0 && partitions.active() )
+    partitions.drop(origin);
+  return 0;
+}
 
-int ha_tsdb_engine::delete_row(const uchar *buf)
+/*
+    @function tsdb_engine_share::begin_scan
+    @brief a handler starts reading records, partitions are kept until it ends
+    @note caller must hold mutex
+*/
+void tsdb_engine_share::begin_scan()
 {
-  DBUG_ENTER("ha_tsdb_engine::delete_row");
-  DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+  scans++;
 }
 
+/*
+    @function tsdb_engine_share::end_scan
+    @brief last scan done: remove the partitions expired meanwhile
+    @note caller must hold mutex
+*/
+void tsdb_engine_share::end_scan()
+{
+  if ( --scans == 0 && partitions.active() )
+    partitions.drop(origin);
+}
 
 /*
- @function ha_tsdb_engine::index_read_map
+    @function tsdb_engine_share::appended
+    @brief account for n records just appended to the series
+    @note caller must hold mutex
 */
-int ha_tsdb_engine::index_read_map(uchar *buf, const uchar *key,
-                               key_part_map keypart_map __attribute__((unused)),
-                               enum ha_rkey_function find_flag
-                               __attribute__((unused)))
+void tsdb_engine_share::appended(const uchar* recs, uint64 n)
 {
-  int rc;
-  DBUG_ENTER("ha_tsdb_engine::index_read");
-  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
-  rc= HA_ERR_WRONG_COMMAND;
-  MYSQL_INDEX_READ_ROW_DONE(rc);
+  if ( n == 0 )
+    return;
+  if ( records == origin )
+  {
+    memcpy(&first_record[0], recs, record_size);
+    memcpy(&first_ts, recs, 8);
+  }
+  memcpy(&last_record[0], recs + (n - 1) * record_size, record_size);
+  memcpy(&last_ts, recs + (n - 1) * record_size, 8);
+  tags.add(recs, records, n);
+  records += n;
+  rollup.add(recs, n);
+}
+
+//records dataset searched by tsdb_locate_records()
+struct tsdb_records_search
+{
+  size_t record_size;
+  hid_t dset;
+  hid_t type;
+};
+
+//H5Literate callback: remember the 1-D dataset whose records match the structure
+static herr_t find_records_dataset(hid_t group, const char *name,
+                                   const H5L_info_t *info, void *data)
+{
+  tsdb_records_search* search = static_cast<tsdb_records_search*>(data);
+  H5O_info_t oinfo;
+  if ( H5Oget_info_by_name(group, name, &oinfo, H5P_DEFAULT) < 0 ||
+       oinfo.type != H5O_TYPE_DATASET )
+    return 0;
+
+  hid_t dset = H5Dopen2(group, name, H5P_DEFAULT);
+  if ( dset < 0 )
+    return 0;
+  hid_t type = H5Dget_type(dset);
+  hid_t space = H5Dget_space(dset);
+  bool match = H5Sget_simple_extent_ndims(space) == 1 &&
+               H5Tget_size(type) == search->record_size;
+  H5Sclose(space);
+  if ( !match )
+  {
+    H5Tclose(type);
+    H5Dclose(dset);
+    return 0;
+  }
+  search->dset = dset;
+  search->type = type;
+  return 1;     //stop iterating
+}
+
+/*
+    @function tsdb_locate_records
+    @brief find the dataset holding the records of the "tsdb" series of a file
+    @params dset, type set to the open dataset and its type when found
+    @return false if there is none
+*/
+bool tsdb_locate_records(hid_t file, size_t record_size, hid_t* dset, hid_t* type)
+{
+  tsdb_records_search search = { record_size, -1, -1 };
+  hid_t group = H5Gopen2(file, "tsdb", H5P_DEFAULT);
+  if ( group < 0 )
+    return false;
+  hsize_t idx = 0;
+  H5Literate(group, H5_INDEX_NAME, H5_ITER_NATIVE, &idx, find_records_dataset, &search);
+  H5Gclose(group);
+  *dset = search.dset;
+  *type = search.type;
+  return search.dset >= 0;
+}
+
+/*
+    @function tsdb_engine_share::locate_records
+    @brief find the dataset holding the records of the series
+    @details with it blocks are read by one H5Dread into a contiguous buffer
+             instead of a tsdb::RecordSet of per record memory blocks
+*/
+void tsdb_engine_share::locate_records()
+{
+  if ( !tsdb_locate_records(file_id, record_size, &records_id, &records_type) )
+    sql_print_information("tsdb_engine: records dataset not found, using record sets");
+}
+
+/*
+    @function tsdb_engine_share::read_block
+    @brief read the records [from, to) of the series into block
+    @return mysql error code
+*/
+int tsdb_engine_share::read_block(uint64 from, uint64 to, tsdb_block* block)
+{
+  mysql_mutex_lock(&mutex);
+  int rc = fetch_records(from, to, block);
+  mysql_mutex_unlock(&mutex);
+  return rc;
+}
+
+/*
+    @function tsdb_engine_share::read_series
+    @brief read the records [from, to) of series id of a series table into block
+    @return mysql error code
+*/
+int tsdb_engine_share::read_series(uint id, uint64 from, uint64 to, tsdb_block* block)
+{
+  uint64 start_time = _getTimeepoch();
+  int rc = 0;
+  mysql_mutex_lock(&mutex);
+  if ( id == TSDB_SERIES_BUFFERED )
+  {
+    block->record_size = record_size;
+    block->direct = true;
+    block->raw.clear();
+    block->count = 0;
+    fetch_buffered(from, to, block);
+  }
+  else
+    rc = series_set.fetch(id, from, to, block);
+  mysql_mutex_unlock(&mutex);
+  if ( rc == 0 )
+    tsdb_stats_fetch(_getTimeepoch() - start_time, block->count * record_size);
+  return rc;
+}
+
+/*
+    @function tsdb_engine_share::fetch_records
+    @brief read_block() for callers already holding mutex
+*/
+int tsdb_engine_share::fetch_records(uint64 from, uint64 to, tsdb_block* block)
+{
+  int rc = 0;
+  uint64 start_time = _getTimeepoch();
+  //partitions report the reads of their own files
+  tsdb_file_wait wait(PSI_FILE_READ, partitions.active() ? NULL : psi_file,
+                      (to - from) * record_size, __FILE__, __LINE__);
+  block->record_size = record_size;
+  if ( partitions.active() )
+  {
+    uint64 total = partitions.records();
+    uint64 count = (to < total ? to : total) - (from < total ? from : total);
+    block->direct = true;
+    block->raw.resize(count * record_size);
+    rc = count > 0 ? partitions.fetch(from, from + count, &block->raw[0], &count) : 0;
+    block->count = rc ? 0 : count;
+  }
+  else if ( records_id >= 0 )
+  {
+    hid_t space = H5Dget_space(records_id);
+    hsize_t extent;
+    H5Sget_simple_extent_dims(space, &extent, NULL);
+    hsize_t start = from;
+    hsize_t count = (to < extent ? to : extent) - (from < extent ? from : extent);
+    block->direct = true;
+    block->count = count;
+    block->raw.resize(count * record_size);
+    if ( count > 0 )
+    {
+      hid_t mspace = H5Screate_simple(1, &count, NULL);
+      if ( H5Sselect_hyperslab(space, H5S_SELECT_SET, &start, NULL, &count, NULL) < 0 ||
+           H5Dread(records_id, records_type, mspace, space, H5P_DEFAULT, &block->raw[0]) < 0 )
+      {
+        block->count = 0;
+        rc = HA_ERR_INTERNAL_ERROR;
+      }
+      H5Sclose(mspace);
+    }
+    H5Sclose(space);
+  }
+  else
+  {
+    block->direct = false;
+    try
+    {
+      block->records = series->recordSet(from, to);
+      block->count = block->records.size();
+    }
+    catch(...)
+    {
+      block->records.clear();
+      block->count = 0;
+      rc = HA_ERR_INTERNAL_ERROR;
+    }
+  }
+  wait.end(block->count * record_size);
+  if ( rc == 0 )
+    tsdb_stats_fetch(_getTimeepoch() - start_time, block->count * record_size);
+  //the records of the reorder buffer follow the appended ones
+  if ( rc == 0 && block->direct && to > records )
+    fetch_buffered(from > records ? from - records : 0, to - records, block);
+  return rc;
+}
+
+/*
+    @function tsdb_engine_share::fetch_buffered
+    @brief add the records [from, to) of the reorder buffer to block
+    @details the records an INSERT was told are stored while the window
+             has not passed them; a scan reads them at the indexes after
+             the appended ones, in a series table as the last series,
+             TSDB_SERIES_BUFFERED. A concurrent insert may place a record
+             among them and shift the next ones.
+    @note caller must hold mutex
+*/
+void tsdb_engine_share::fetch_buffered(uint64 from, uint64 to, tsdb_block* block)
+{
+  uint64 count;
+  const uchar* buffered = reorder.all(&count);
+  if ( to > count )
+    to = count;
+  if ( from >= to )
+    return;
+  block->raw.insert(block->raw.end(), buffered + from * record_size, buffered + to * record_size);
+  block->count += to - from;
+}
+
+
+
+//numeric table option with an optional K/M/G suffix
+static bool size_option(TABLE_SHARE* share, const char* key, ulonglong max, ulonglong* value)
+{
+  std::string text;
+  if ( !tsdb_table_option(share, key, &text) )
+    return true;
+  char* end;
+  ulonglong v = strtoull(text.c_str(), &end, 10);
+  switch (*end)
+  {
+    case 'g': case 'G': v <<= 10; /* fall through */
+    case 'm': case 'M': v <<= 10; /* fall through */
+    case 'k': case 'K': v <<= 10; end++; break;
+    default: break;
+  }
+  if ( end == text.c_str() || *end != '\0' || v > max )
+    return false;
+  *value = v;
+  return true;
+}
+
+//duration table option: a number followed by s, m, h, d or w, in milliseconds
+static bool duration_option(TABLE_SHARE* share, const char* key, ulonglong* ms)
+{
+  std::string text;
+  if ( !tsdb_table_option(share, key, &text) )
+    return true;
+  char* end;
+  ulonglong v = strtoull(text.c_str(), &end, 10);
+  ulonglong unit;
+  switch (*end)
+  {
+    case 's': unit = 1000ULL; break;
+    case 'm': unit = 60 * 1000ULL; break;
+    case 'h': unit = 3600 * 1000ULL; break;
+    case 'd': unit = 86400 * 1000ULL; break;
+    case 'w': unit = 7 * 86400 * 1000ULL; break;
+    default: return false;
+  }
+  if ( end == text.c_str() || end[1] != '\0' || v == 0 || v > (1ULL << 40) )
+    return false;
+  *ms = v * unit;
+  return true;
+}
+
+/*
+    @function storage_options
+    @brief storage settings of a table, the sysvars overridden by its options
+    @return false if an option is not valid
+*/
+static bool storage_options(TABLE_SHARE* share, tsdb_storage_options* options)
+{
+  std::string compression, partition, time_column;
+  ulonglong deflate = srv_deflate_level;
+  options->chunk_records = srv_chunk_records;
+  options->chunk_cache = srv_chunk_cache_size;
+  options->meta_cache = srv_meta_cache_size;
+  options->compress = false;
+  options->partition = TSDB_PARTITION_NONE;
+  options->retention = 0;
+  options->reorder_window = 0;
+  options->time_key = tsdb_table_option(share, TSDB_OPT_TIME_KEY, &time_column);
+  bool valid = duration_option(share, TSDB_OPT_RETENTION, &options->retention) &&
+               size_option(share, TSDB_OPT_CHUNK_RECORDS, 1 << 24, &options->chunk_records) &&
+               size_option(share, TSDB_OPT_CHUNK_CACHE, 1ULL << 40, &options->chunk_cache) &&
+               size_option(share, TSDB_OPT_META_CACHE, TSDB_META_CACHE_MAX, &options->meta_cache) &&
+               size_option(share, TSDB_OPT_DEFLATE, 9, &deflate) &&
+               duration_option(share, TSDB_OPT_REORDER_WINDOW, &options->reorder_window);
+  //without a time key records are stamped in order, there is nothing to reorder
+  if ( !options->time_key )
+    options->reorder_window = 0;
+  options->deflate = (uint)deflate;
+  if ( tsdb_table_option(share, TSDB_OPT_COMPRESSION, &compression) )
+  {
+    options->compress = strcasecmp(compression.c_str(), "gorilla") == 0;
+    valid = valid && (options->compress || strcasecmp(compression.c_str(), "none") == 0);
+  }
+  if ( tsdb_table_option(share, TSDB_OPT_PARTITION, &partition) )
+    valid = valid && tsdb_partition_parse(partition.c_str(), &options->partition);
+  return valid;
+}
+
+//init func 
+static int tsdb_engine_init_func(void *p)
+{
+  DBUG_ENTER("tsdb_engine_init_func");
+
+  tsdb_init_psi_keys();
+  mysql_mutex_init(tsdb_key_mutex_create, &tsdb_create_mutex, MY_MUTEX_INIT_FAST);
+
+  tsdb_engine_hton= (handlerton *)p;
+  tsdb_engine_hton->state=                     SHOW_OPTION_YES;
+  tsdb_engine_hton->create=                    tsdb_engine_create_handler;
+  //TRUNCATE goes through truncate(), which only moves the origin
+  tsdb_engine_hton->flags=                     0;
+  tsdb_engine_hton->system_database=   tsdb_engine_system_database;
+  tsdb_engine_hton->is_supported_system_table= tsdb_engine_is_supported_system_table;
+
+  //the filter must be known before any compressed file is opened
+  if ( !tsdb_register_compression() )
+    sql_print_error("tsdb_engine: cannot register the records filter");
+
+  if ( tsdb_retention_task.start(&srv_retention_interval) )
+    sql_print_error("tsdb_engine: cannot start the retention task");
+
+  DBUG_RETURN(0);
+}
+
+//deinit func: HDF5 library is shared by all tables, close it only on unload
+static int tsdb_engine_done_func(void *p)
+{
+  DBUG_ENTER("tsdb_engine_done_func");
+
+  tsdb_retention_task.stop();
+  H5close();
+  mysql_mutex_destroy(&tsdb_create_mutex);
+
+  DBUG_RETURN(0);
+}
+
+
+//tsdb_block_cache impl
+
+//ctor
+tsdb_block_cache::tsdb_block_cache()
+{
+  clear();
+}
+
+void tsdb_block_cache::clear()
+{
+  tick = 0;
+  for ( uint i = 0; i < TSDB_POS_CACHE_BLOCKS; i++ )
+  {
+    starts[i] = 0;
+    last_used[i] = 0;       //0: slot is empty
+    blocks[i].count = 0;
+    std::vector<uchar, Malloc_allocator<uchar> >(
+      Malloc_allocator<uchar>(tsdb_key_memory_scan_block)).swap(blocks[i].raw);
+    blocks[i].records.clear();
+  }
+}
+
+/*
+    @function tsdb_block_cache::record
+    @brief the record of a row reference, reading its aligned block if not
+           cached
+    @params rc set to the mysql error code
+    @return pointer into the cached block, NULL on error
+*/
+const uchar* tsdb_block_cache::record(tsdb_engine_share* share, uint64 ref, int* rc)
+{
+  bool in_series = share->series_set.active();
+  uint64 index = in_series ? ref & TSDB_SERIES_POS_MASK : ref;
+  uint64 start = ref - index % TSDB_BLOCK_RECORDS;
+  uint victim = 0;
+  *rc = 0;
+  tick++;
+
+  for ( uint i = 0; i < TSDB_POS_CACHE_BLOCKS; i++ )
+  {
+    //a block read at the tail of the series may have grown since
+    if ( last_used[i] && starts[i] == start && ref < start + blocks[i].count )
+    {
+      last_used[i] = tick;
+      tsdb_stats_add(&tsdb_stats.block_cache_hits, 1);
+      return blocks[i].record(ref - start);
+    }
+    if ( last_used[i] < last_used[victim] )
+      victim = i;
+  }
+
+  last_used[victim] = 0;
+  tsdb_stats_add(&tsdb_stats.block_cache_misses, 1);
+  uint64 from = index - index % TSDB_BLOCK_RECORDS;
+  if ( in_series )
+    *rc = share->read_series((uint)(ref >> TSDB_SERIES_POS_SHIFT), from,
+                             from + TSDB_BLOCK_RECORDS, &blocks[victim]);
+  else
+    *rc = share->read_block(from, from + TSDB_BLOCK_RECORDS, &blocks[victim]);
+  if ( *rc )
+    return NULL;
+  if ( ref >= start + blocks[victim].count )
+  {
+    *rc = HA_ERR_RECORD_DELETED;
+    return NULL;
+  }
+  starts[victim] = start;
+  last_used[victim] = tick;
+  return blocks[victim].record(ref - start);
+}
+
+
+//ha_tsdb_engine impl
+tsdb_engine_share *ha_tsdb_engine::get_share()
+{
+  tsdb_engine_share *tmp_share;
+
+  DBUG_ENTER("ha_tsdb_engine::get_share()");
+
+  lock_shared_ha_data();
+  if (!(tmp_share= static_cast<tsdb_engine_share*>(get_ha_share_ptr())))
+  {
+    tmp_share= new tsdb_engine_share;
+    if (!tmp_share)
+      goto err;
+
+    set_ha_share_ptr(static_cast<Handler_share*>(tmp_share));
+  }
+err:
+  unlock_shared_ha_data();
+  DBUG_RETURN(tmp_share);
+}
+
+//static function tsdb_engine_create_handler
+/*
+ @brief this function creates a handler of ha_tsdb_engine handler
+ TODO: ?? explain more this machin
+*/
+static handler* tsdb_engine_create_handler(handlerton *hton,
+                                       TABLE_SHARE *table, 
+                                       MEM_ROOT *mem_root)
+{
+  return new (mem_root) ha_tsdb_engine(hton, table);
+}
+
+
+//ctor
+//call super ctor
+ha_tsdb_engine::ha_tsdb_engine(handlerton *hton, TABLE_SHARE *table_arg)
+  :handler(hton, table_arg), fHeapBuf(Malloc_allocator<uchar>(tsdb_key_memory_heap))
+{
+  share = NULL;
+  fShareUsed = false;
+  fRowsRead = 0;
+  fRowBuf = NULL;
+  fRecordOrigin = 0;
+  fAppendedNbr = 0;
+  fScanning = false;
+  fTimeKey = NULL;
+  fBulkDelete = false;
+  fDeleteCount = 0;
+  fPushedLow = LLONG_MIN;
+  fPushedHigh = LLONG_MAX;
+  fTagField = NULL;
+  fTagFilter = false;
+  fTagBlockEnd = 0;
+  fSeriesScan = false;
+  fSeriesPos = 0;
+  fSeries = 0;
+  fCurrentPos = 0;
+  fAppendBuf = NULL;
+  fAppendCount = 0;
+  fAppendCapacity = 0;
+  fRecordSize = 0;
+}
+
+
+
+//ha_tsdb_engine::bas_ext() return our extension
+const char **ha_tsdb_engine::bas_ext() const
+{
+  return ha_tsdb_engine_exts;
+}
+
+/*
+    @function ha_tsdb_engine::get_error_message
+    @brief message of an engine error, reported by handler::print_error()
+    @return false, the errors are not temporary
+*/
+bool ha_tsdb_engine::get_error_message(int error, String *buf)
+{
+  if ( error == HA_ERR_TSDB_LATE_RECORD )
+    buf->append(STRING_WITH_LEN("record older than the last one of its series"));
+  return false;
+}
+
+const char* tsdb_engine_system_database()
+{
+  return ha_tsdb_engine_system_database;
+}
+
+//list of all systems tables specific to our engine
+//we do not need to implemnt this because it's generic
+//until we do not have system table we just put NULL
+//TODO: remove this stuff
+static st_system_tablename ha_tsdb_engine_system_tables[]= {
+  {(const char*)NULL, (const char*)NULL}
+};
+
+
+/**
+  @brief Check if the given db.tablename is a system table for this SE.
+  @param db                         Database name to check.
+  @param table_name                 table name to check.
+  @param is_sql_layer_system_table  if the supplied db.table_name is a SQL
+                                    layer system table.
+  @return
+    @retval TRUE   Given db.table_name is supported system table.
+    @retval FALSE  Given db.table_name is not a supported system table.
+*/
+static bool tsdb_engine_is_supported_system_table(const char *db,
+                                              const char *table_name,
+                                              bool is_sql_layer_system_table)
+{
+  st_system_tablename *systab;
+
+  // Does this SE support "ALL" SQL layer system tables ?
+  if (is_sql_layer_system_table)
+    return false;
+
+  // Check if this is SE layer system tables
+  systab= ha_tsdb_engine_system_tables;
+  while (systab && systab->db)
+  {
+    if (systab->db == db &&
+        strcmp(systab->tablename, table_name) == 0)
+      return true;
+    systab++;
+  }
+
+  return false;
+}
+
+/*
+    @function ha_tsdb_engine:open()
+    @brief open a table
+    @params
+        name table file name
+        mode O_RDONLY  or O_RDWR
+        test_if_locked self-segnificant :)
+    @return mysql error code 
+    
+*/
+
+int ha_tsdb_engine::open(const char *name, int mode, uint test_if_locked)
+{
+  int rc;
+  DBUG_ENTER("ha_tsdb_engine::open");
+  
+
+  if (!(share = get_share()))
+    DBUG_RETURN(1);
+  thr_lock_data_init(&share->lock,&lock,NULL);
+  
+  std::string filename(name);
+  std::string rollup;
+  tsdb_storage_options options;
+  filename+=bas_ext()[0]; //add ".tsdb"
+  if ( !storage_options(table->s, &options) )
+    sql_print_warning("tsdb_engine: invalid storage option of '%s', using the defaults",
+                      filename.c_str());
+  fTimeKey = time_key(table);
+  if ( options.time_key && fTimeKey == NULL )
+    sql_print_warning("tsdb_engine: no time key column in '%s', rows are stamped on insert",
+                      filename.c_str());
+  
+  //first handler of the table opens the file, the others reuse it
+  PSI_stage_info old_stage;
+  ha_thd()->enter_stage(&stage_tsdb_opening_series, &old_stage, __func__, __FILE__, __LINE__);
+  mysql_mutex_lock(&share->mutex);
+  if ( tsdb_table_option(table->s, TSDB_OPT_ROLLUP, &rollup) )
+  {
+    rc = share->open_view(name, rollup);
+    fViewCount = 0;
+  }
+  else
+    rc = share->open_series(filename.c_str(), options);
+  if ( rc == 0 && !share->codec_built && share->view == NULL )
+  {
+    if ( share->format >= TSDB_FORMAT_CODEC &&
+         !share->codec.build(table, share->record_size, share->format) )
+      sql_print_information("tsdb_engine: row layout does not match '%s', using Field::pack",
+                            filename.c_str());
+    share->codec_built = true;
+    rc = share->tags.open(share);
+    if ( rc == 0 && share->codec.valid && share->codec.heap_columns() )
+      rc = share->heap.open(share->file_id);
+    if ( rc == 0 )
+      rc = share->series_set.open(share, table);
+    if ( rc == 0 )
+      rc = share->rollup.open(share);
+    //the log is replayed through all of the above
+    if ( rc == 0 )
+      rc = share->recover(filename.c_str());
+  }
+  if ( rc == 0 )
+  {
+    share->use_count++;
+    fShareUsed = true;
+    ref_length = sizeof(uint64);
+  }
+  //a series table only expires all its records, see tsdb_engine_share::expire()
+  bool expiring = rc == 0 && share->retention > 0 && !share->series_set.active();
+  mysql_mutex_unlock(&share->mutex);
+  ha_thd()->enter_stage(&old_stage, NULL, __func__, __FILE__, __LINE__);
+
+  //the retention task takes its own mutex before the share mutex
+  if ( expiring )
+    tsdb_retention_task.add(share);
+  
+  DBUG_RETURN(rc);
+}
+
+
+/*
+    @function ha_tsdb_engine::close
+    @brief close table
+    @params void
+    @return mysql error code
+    @note the Timeseries and the HDF5 file belong to the share; they stay open
+          until the table share is released
+*/
+int ha_tsdb_engine::close(void)
+{
+  DBUG_ENTER("ha_tsdb_engine::close");
+  
+  fPrefetcher.stop();
+  fPosCache.clear();
+  flush_rows_read();
+  end_scan();
+  if ( fAppendBuf != NULL )
+  {
+    my_free(fAppendBuf);
+    fAppendBuf = NULL;
+  }
+  my_free(fRowBuf);
+  fRowBuf = NULL;
+  fHeapBuf.clear();
+  fHeapWindow.clear();
+  if ( NULL != share && fShareUsed )
+  {
+    mysql_mutex_lock(&share->mutex);
+    share->use_count--;
+    mysql_mutex_unlock(&share->mutex);
+  }
+  fShareUsed = false;
+  
+  DBUG_RETURN(0);
+}
+
+
+/*
+    @function ha_tsdb_engine::pack_row
+    @brief stamp and pack a mysql row into the tsdb record layout
+    @params buf mysql row (record[0] format), to destination record
+    @return mysql error code
+    @details the _TSDB_timestamp is the value of the tsdb_time_key= column,
+             or the time of the insert when the table has none or the
+             column is NULL; the column then shows the time of the insert
+*/
+
+int ha_tsdb_engine::pack_row(uchar *buf, uchar *to)
+{
+  my_ptrdiff_t offset = buf - table->record[0];
+  int64_t micros;
+  bool stamped = false;
+  if ( fTimeKey != NULL )
+  {
+    fTimeKey->move_field_offset(offset);
+    stamped = !fTimeKey->is_null();
+    if ( stamped )
+      micros = field_timestamp(fTimeKey);
+    fTimeKey->move_field_offset(-offset);
+  }
+  if ( !stamped )
+  {
+    struct timeval  tms;
+    if (gettimeofday(&tms,NULL)) 
+    {
+      return -1;
+    }
+    micros = tms.tv_sec * 1000ull;
+    /* Add full microseconds */
+    micros += tms.tv_usec/1000;
+  }
+  
+  if ( fTimeKey != NULL && !stamped )
+  {
+    //the time key is a view of _TSDB_timestamp, keep both equal
+    fTimeKey->move_field_offset(offset);
+    fTimeKey->set_notnull();
+    store_timestamp(fTimeKey, micros);
+    fTimeKey->move_field_offset(-offset);
+  }
+  
+  if ( share->codec.valid )
+  {
+    share->codec.encode(table, buf, to, &fHeapBuf);
+    memcpy(to,&micros,8);
+    return 0;
+  }
+
+  //tables created before the row codec keep the packed layout
+  memcpy(to,&micros,8);
+  to+=8;
+  memcpy(to, buf, table->s->null_bytes);
+  to += table->s->null_bytes;
+   for (Field **field = table->field ; *field ; field++)
+   {
+     if ( !((*field)->is_null()) )
+        to=  (*field)->pack(to,buf+(*field)->offset(table->record[0]));
+   }
+  return 0;
+}
+
+
+/*
+    @function ha_tsdb_engine::append_records
+    @brief append n packed records to the series and update the share stats
+    @details the records are logged under the share mutex and the log is
+             synced after it is released, so that concurrent inserts share
+             one fsync
+    @return mysql error code
+*/
+
+int ha_tsdb_engine::append_records(uchar *records, uint64 n)
+{
+  int rc = 0;
+  uint64 lsn;
+  uint64 start = _getTimeepoch();
+  PSI_stage_info old_stage;
+  ha_thd()->enter_stage(&stage_tsdb_appending_batch, &old_stage, __func__, __FILE__, __LINE__);
+  mysql_mutex_lock(&share->mutex);
+  rc = share->insert(records, n, fHeapBuf, &lsn);
+  mysql_mutex_unlock(&share->mutex);
+  fHeapBuf.clear();
+  if ( rc == 0 && lsn > 0 )
+  {
+    ha_thd()->enter_stage(&stage_tsdb_syncing_log, NULL, __func__, __FILE__, __LINE__);
+    rc = share->wal.sync(lsn, srv_flush_log_at_insert);
+  }
+  ha_thd()->enter_stage(&old_stage, NULL, __func__, __FILE__, __LINE__);
+  if ( rc == 0 )
+    tsdb_stats_append(_getTimeepoch() - start, n, n * share->record_size);
+  return rc;
+}
+
+
+/*
+    @function ha_tsdb_engine::flush_append_buffer
+    @brief write the buffered rows with a single appendRecords call
+    @return mysql error code
+*/
+
+int ha_tsdb_engine::flush_append_buffer()
+{
+  int rc = 0;
+  DBUG_ENTER("ha_tsdb_engine::flush_append_buffer");
+
+  if ( fAppendCount == 0 )
+    DBUG_RETURN(0);
+
+  rc = append_records(fAppendBuf, fAppendCount);
+  fAppendCount = 0;
+
+  DBUG_RETURN(rc);
+}
+
+
+/*
+    @function ha_tsdb_engine::write_row
+    @brief insert row
+    @params buf is an uchar* that we could cast to any struct
+    @return mysql error code
+    @note between start_bulk_insert and end_bulk_insert rows are packed into
+          fAppendBuf and written one batch at a time
+*/
+
+int ha_tsdb_engine::write_row(uchar *buf)
+{
+  DBUG_ENTER("ha_tsdb_engine::write_row");
+ 
+  if ( share->view != NULL )
+    DBUG_RETURN(HA_ERR_TABLE_READONLY);
+
+  if ( fAppendBuf != NULL )
+  {
+    if ( pack_row(buf, fAppendBuf + fAppendCount * fRecordSize) )
+      DBUG_RETURN(-1);
+    if ( ++fAppendCount == fAppendCapacity )
+      DBUG_RETURN(flush_append_buffer());
+    DBUG_RETURN(0);
+  }
+ 
+ //a packed row may overrun the record by the null bytes, see start_bulk_insert()
+ if ( fRowBuf == NULL &&
+      !(fRowBuf = (uchar*)my_malloc(tsdb_key_memory_append,
+                                    share->record_size + table->s->reclength, MYF(MY_WME))) )
+   DBUG_RETURN(HA_ERR_OUT_OF_MEM);
+ 
+ if ( pack_row(buf, fRowBuf) )
+   DBUG_RETURN(-1);
+
+ //a row older than the series is refused, see tsdb_engine_share::insert()
+ DBUG_RETURN(append_records(fRowBuf, 1));
+}
+
+
+
+/*
+    @function ha_tsdb_engine::update_row
+    @brief update row
+    @params old_data and new_data are unsigned char ptrs
+    @return mysql error code
+*/
+
+int ha_tsdb_engine::update_row(const uchar *old_data, uchar *new_data)
+{
+
+  DBUG_ENTER("ha_tsdb_engine::update_row");
+  //prealably must not update time series
+  DBUG_RETURN(1);
+}
+
+
+/*
+    @function ha_tsdb_engine::delete_row
+    @brief delete the row last read
+    @params buf is const uchar ptr
+    @return mysql error code
+    @details only the oldest rows can go, as in DELETE ... WHERE ts < X:
+             the rows must follow the origin of the series in order. They
+             are expired by moving the origin, nothing is rewritten.
+*/
+
+int ha_tsdb_engine::delete_row(const uchar *buf)
+{
+  int rc = 0;
+  DBUG_ENTER("ha_tsdb_engine::delete_row");
+
+  if ( share->view != NULL )
+    DBUG_RETURN(HA_ERR_TABLE_READONLY);
+  //the rows of a series table only go all at once, see delete_all_rows()
+  if ( share->series_set.active() )
+    DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+  //records of the reorder buffer are not appended yet, see fetch_buffered()
+  if ( fCurrentPos >= fAppendedNbr )
+    DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+
+  if ( fBulkDelete )
+  {
+    if ( fCurrentPos != fRecordOrigin + fDeleteCount )
+    {
+      fDeleteCount = 0;       //not a prefix: the statement deletes nothing
+      DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+    }
+    fDeleteCount++;
+    DBUG_RETURN(0);
+  }
+
+  mysql_mutex_lock(&share->mutex);
+  if ( fCurrentPos == share->origin )
+    rc = share->expire(fCurrentPos + 1);
+  else
+    rc = HA_ERR_WRONG_COMMAND;
+  mysql_mutex_unlock(&share->mutex);
+  DBUG_RETURN(rc);
+}
+
+/*
+    @function ha_tsdb_engine::start_bulk_delete
+    @brief rows of a DELETE are counted by delete_row() and expired at once
+    @return false: deletes are batched
+*/
+bool ha_tsdb_engine::start_bulk_delete()
+{
+  fBulkDelete = true;
+  fDeleteCount = 0;
+  return false;
+}
+
+/*
+    @function ha_tsdb_engine::end_bulk_delete
+    @brief move the origin past the rows deleted by the statement
+    @return mysql error code
+*/
+int ha_tsdb_engine::end_bulk_delete()
+{
+  int rc = 0;
+  DBUG_ENTER("ha_tsdb_engine::end_bulk_delete");
+  if ( fDeleteCount > 0 )
+  {
+    mysql_mutex_lock(&share->mutex);
+    rc = share->expire(fRecordOrigin + fDeleteCount);
+    mysql_mutex_unlock(&share->mutex);
+  }
+  fBulkDelete = false;
+  fDeleteCount = 0;
+  DBUG_RETURN(rc);
+}
+
+
+/**
+  @brief
+  Prepare an index scan on the _TSDB_timestamp key.
+  @details
+  Records are appended in timestamp order, so the record index is the key
+  order and no separate index structure is needed.
+*/
+int ha_tsdb_engine::index_init(uint idx, bool sorted)
+{
+  DBUG_ENTER("ha_tsdb_engine::index_init");
+  active_index = idx;
+  build_read_ops();
+  fCacheLen = 0;
+  fFirstEteration = true;
+  start_scan();
+  fIndexPos = fRecordOrigin;
+  DBUG_RETURN(0);
+}
+
+int ha_tsdb_engine::index_end()
+{
+  DBUG_ENTER("ha_tsdb_engine::index_end");
+  active_index = MAX_KEY;
+  flush_rows_read();
+  end_scan();
+  DBUG_RETURN(0);
+}
+
+
+/*
+ @function ha_tsdb_engine::index_read_map
+ @brief position the cursor on the key with a binary search over the series
+*/
+int ha_tsdb_engine::index_read_map(uchar *buf, const uchar *key,
+                               key_part_map keypart_map __attribute__((unused)),
+                               enum ha_rkey_function find_flag)
+{
+  int rc;
+  longlong ts;
+  uint64 pos;
+  DBUG_ENTER("ha_tsdb_engine::index_read");
+  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
+
+  ts = key_to_timestamp(key);
+  switch (find_flag)
+  {
+    case HA_READ_AFTER_KEY:
+      rc = search_timestamp(ts + time_resolution(time_field(table)), fRecordOrigin, fRecordNbr, &pos);
+      break;
+    case HA_READ_BEFORE_KEY:
+      rc = search_timestamp(ts, fRecordOrigin, fRecordNbr, &pos);
+      pos--;                                  //wraps when nothing is before
+      break;
+    case HA_READ_KEY_OR_PREV:
+    case HA_READ_PREFIX_LAST:
+    case HA_READ_PREFIX_LAST_OR_PREV:
+      rc = search_timestamp(ts + time_resolution(time_field(table)), fRecordOrigin, fRecordNbr, &pos);
+      pos--;
+      break;
+    default:                                  //HA_READ_KEY_EXACT, HA_READ_KEY_OR_NEXT
+      rc = search_timestamp(ts, fRecordOrigin, fRecordNbr, &pos);
+      break;
+  }
+
+  if ( rc == 0 && (pos < fRecordOrigin || pos >= fRecordNbr) )
+    rc = HA_ERR_KEY_NOT_FOUND;
+
+  if ( rc == 0 && (find_flag == HA_READ_KEY_EXACT || find_flag == HA_READ_PREFIX_LAST))
+  {
+    longlong found;
+    rc = read_timestamp(pos, &found);
+    if ( rc == 0 && (found < ts || found >= ts + time_resolution(time_field(table))) )
+      rc = HA_ERR_KEY_NOT_FOUND;
+  }
+
+  if ( rc == 0 )
+  {
+    fIndexPos = pos;
+    rc = read_row(fIndexPos, buf);
+  }
+  table->status = rc ? STATUS_NOT_FOUND : 0;
+  MYSQL_INDEX_READ_ROW_DONE(rc);
+  DBUG_RETURN(rc);
+}
+
+/**
+ * @function ha_tsdb_engine::index_next
+  @brief
+  Used to read forward through the index.
+*/
+
+int ha_tsdb_engine::index_next(uchar *buf)
+{
+  int rc;
+  DBUG_ENTER("ha_tsdb_engine::index_next");
+  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
+  if ( fIndexPos + 1 < fRecordNbr )
+    rc = read_row(++fIndexPos, buf);
+  else
+    rc = HA_ERR_END_OF_FILE;
+  table->status = rc ? STATUS_NOT_FOUND : 0;
+  MYSQL_INDEX_READ_ROW_DONE(rc);
+  DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  Used to read backwards through the index.
+*/
+
+int ha_tsdb_engine::index_prev(uchar *buf)
+{
+  int rc;
+  DBUG_ENTER("ha_tsdb_engine::index_prev");
+  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
+  if ( fIndexPos > fRecordOrigin && fIndexPos <= fRecordNbr )
+    rc = read_row(--fIndexPos, buf);
+  else
+    rc = HA_ERR_END_OF_FILE;
+  table->status = rc ? STATUS_NOT_FOUND : 0;
+  MYSQL_INDEX_READ_ROW_DONE(rc);
+  DBUG_RETURN(rc);
+}
+
+/*
+@function ha_tsdb_engine::index_first
+*/
+int ha_tsdb_engine::index_first(uchar *buf)
+{
+  int rc;
+  DBUG_ENTER("ha_tsdb_engine::index_first");
+  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
+  fIndexPos = fRecordOrigin;
+  if ( fRecordNbr > fRecordOrigin )
+    rc = read_meta_row(fIndexPos, buf);
+  else
+    rc = HA_ERR_END_OF_FILE;
+  table->status = rc ? STATUS_NOT_FOUND : 0;
+  MYSQL_INDEX_READ_ROW_DONE(rc);
+  DBUG_RETURN(rc);
+}
+
+
+
+/**
+  @brief
+  index_last() asks for the last key in the index.
+  @details
+  Called from opt_range.cc, opt_sum.cc, sql_handler.cc, and sql_select.cc.
+  @see
+  opt_range.cc, opt_sum.cc, sql_handler.cc and sql_select.cc
+*/
+int ha_tsdb_engine::index_last(uchar *buf)
+{
+  int rc;
+  DBUG_ENTER("ha_tsdb_engine::index_last");
+  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
+  if ( fRecordNbr > fRecordOrigin )
+  {
+    fIndexPos = fRecordNbr - 1;
+    rc = read_meta_row(fIndexPos, buf);
+  }
+  else
+    rc = HA_ERR_END_OF_FILE;
+  table->status = rc ? STATUS_NOT_FOUND : 0;
+  MYSQL_INDEX_READ_ROW_DONE(rc);
   DBUG_RETURN(rc);
 }
 
-/**
- * @function ha_tsdb_engine::index_next
-  @brief
-  Used to read forward through the index.
+
+/**
+  @brief
+  rnd_init() is called when the system wants the storage engine to do a table
+  scan. See the tsdb_engine in the introduction at the top of this file to see when
+  rnd_init() is called.
+  @details
+  Called from filesort.cc, records.cc, sql_handler.cc, sql_select.cc, sql_table.cc,
+  and sql_update.cc.
+  @see
+  filesort.cc, records.cc, sql_handler.cc, sql_select.cc, sql_table.cc and sql_update.cc
+*/
+int ha_tsdb_engine::rnd_init(bool scan)
+{
+  DBUG_ENTER("ha_tsdb_engine::rnd_init");
+  //initialize random access
+
+  
+  fRecordIndx=0;
+  if ( share->view != NULL )
+  {
+    //companion table: rows are the buckets of the rollup level
+    mysql_mutex_lock(&share->mutex);
+    fRecordNbr = share->view->rows();
+    fViewCount = 0;
+    mysql_mutex_unlock(&share->mutex);
+    DBUG_RETURN(0);
+  }
+  start_scan();
+  fRecordIndx = fRecordOrigin;
+  fCacheRecInd = 0;
+  fCacheLen = 0;
+  fFirstEteration = true;
+  build_read_ops();
+
+  //a series table is read one series after the other, see next_series()
+  fSeriesScan = share->series_set.active();
+  if ( fSeriesScan )
+  {
+    int rc = 0;
+    fPrefetcher.stop();
+    fSeriesList.clear();
+    fSeriesPos = 0;
+    fRecordIndx = fRecordNbr = 0;
+    if ( scan )
+      rc = start_series_scan();
+    DBUG_RETURN(rc);
+  }
+
+  //restrict the scan to the records of the pushed time window
+  if ( scan && (fPushedLow != LLONG_MIN || fPushedHigh != LLONG_MAX) )
+  {
+    uint64 first = fRecordOrigin, last = fRecordNbr;
+    if ( fPushedHigh < fPushedLow )
+      last = 0;
+    else
+    {
+      if ( fPushedHigh != LLONG_MAX &&
+           search_timestamp(fPushedHigh + 1, fRecordOrigin, fRecordNbr, &last) )
+        last = fRecordNbr;
+      if ( fPushedLow != LLONG_MIN &&
+           search_timestamp(fPushedLow, fRecordOrigin, fRecordNbr, &first) )
+        first = fRecordOrigin;
+    }
+    fRecordIndx = first;
+    fRecordNbr = last;
+  }
+
+  //the pushed tag value becomes the codes whose blocks are read
+  fTagFilter = false;
+  fTagBlockEnd = 0;
+  if ( scan && fTagField != NULL )
+  {
+    mysql_mutex_lock(&share->mutex);
+    fTagFilter = share->tags.lookup(fTagField->field_index, fTagValue, &fTagCodes);
+    mysql_mutex_unlock(&share->mutex);
+  }
+
+  //a scan longer than one block reads the following ones ahead; a tag
+  //filtered scan jumps between blocks and reads them on demand
+  if ( scan && !fTagFilter && srv_prefetch_depth > 0 &&
+       fRecordNbr > fRecordIndx + TSDB_BLOCK_RECORDS )
+  {
+    if ( fPrefetcher.start(share, fRecordIndx, fRecordNbr, srv_prefetch_depth) )
+      sql_print_warning("tsdb_engine: could not start read-ahead");
+  }
+  else
+    fPrefetcher.stop();
+
+  DBUG_RETURN(0);
+}
+
+int ha_tsdb_engine::rnd_end()
+{
+  DBUG_ENTER("ha_tsdb_engine::rnd_end");
+  fPrefetcher.stop();
+  fPosCache.clear();
+  flush_rows_read();
+  end_scan();
+  DBUG_RETURN(0);
+}
+
+
+/*
+    @function ha_tsdb_engine::fetch_block
+    @brief load TSDB_BLOCK_RECORDS records starting at index into the cache
+    @return mysql error code
+*/
+int ha_tsdb_engine::fetch_block(uint64 index)
+{
+  PSI_stage_info old_stage;
+  ha_thd()->enter_stage(&stage_tsdb_fetching_block, &old_stage, __func__, __FILE__, __LINE__);
+  int rc = fSeriesScan ? share->read_series(fSeries, index, index+TSDB_BLOCK_RECORDS, &fCacheRecords)
+                       : share->read_block(index, index+TSDB_BLOCK_RECORDS, &fCacheRecords);
+  ha_thd()->enter_stage(&old_stage, NULL, __func__, __FILE__, __LINE__);
+  if ( rc )
+    sql_print_error("tsdb_engine: cannot read the records from %llu of '%s'",
+                    (ulonglong)index, table_share->table_name.str);
+  fCacheRecInd = index;
+  fCacheLen= fCacheRecords.count;
+  fFirstEteration = false;
+  return rc;
+}
+
+/*
+    @function ha_tsdb_engine::start_series_scan
+    @brief list the series a scan of a series table reads
+    @details with predicates pushed on the key columns, the key of each
+             series is decoded into record[0] and the predicates evaluated
+             on it: only the series matching them are read. The record
+             count of each one is its watermark.
+    @return mysql error code
+*/
+int ha_tsdb_engine::start_series_scan()
+{
+  mysql_mutex_lock(&share->mutex);
+  uint count = share->series_set.count();
+  for ( uint id = 0; id < count; id++ )
+    fSeriesList.push_back(std::make_pair(id, share->series_set.records(id)));
+  //the server evaluates the pushed predicates on the buffered records
+  uint64 buffered = share->reorder.count();
+  mysql_mutex_unlock(&share->mutex);
+  if ( buffered > 0 )
+    fSeriesList.push_back(std::make_pair(TSDB_SERIES_BUFFERED, buffered));
+  if ( fSeriesConds.empty() )
+    return 0;
+
+  std::vector<uchar> sample(share->record_size);
+  size_t kept = 0;
+  for ( size_t i = 0; i < fSeriesList.size(); i++ )
+  {
+    if ( fSeriesList[i].first == TSDB_SERIES_BUFFERED )
+    {
+      fSeriesList[kept++] = fSeriesList[i];
+      continue;
+    }
+    mysql_mutex_lock(&share->mutex);
+    share->series_set.sample(fSeriesList[i].first, &sample[0]);
+    mysql_mutex_unlock(&share->mutex);
+    share->codec.decode(table, &sample[0], table->record[0], NULL);
+    bool match = true;
+    for ( size_t c = 0; match && c < fSeriesConds.size(); c++ )
+      match = fSeriesConds[c]->val_int() != 0;
+    if ( match )
+      fSeriesList[kept++] = fSeriesList[i];
+  }
+  fSeriesList.resize(kept);
+  return 0;
+}
+
+/*
+    @function ha_tsdb_engine::next_series
+    @brief move the scan to the records of the next listed series within
+           the pushed time window
+    @return false when no series is left
+*/
+bool ha_tsdb_engine::next_series()
+{
+  while ( fSeriesPos < fSeriesList.size() )
+  {
+    uint64 first = 0, last = fSeriesList[fSeriesPos].second;
+    fSeries = fSeriesList[fSeriesPos++].first;
+    if ( fPushedHigh < fPushedLow )
+      continue;
+    mysql_mutex_lock(&share->mutex);
+    //the window is searched in the series datasets, buffered records are all read
+    bool stored = fSeries != TSDB_SERIES_BUFFERED;
+    if ( stored && fPushedHigh != LLONG_MAX )
+      last = share->series_set.lower_bound(fSeries, fPushedHigh + 1, last);
+    if ( stored && fPushedLow != LLONG_MIN )
+      first = share->series_set.lower_bound(fSeries, fPushedLow, last);
+    mysql_mutex_unlock(&share->mutex);
+    fRecordIndx = first;
+    fRecordNbr = last;
+    fCacheLen = 0;
+    fFirstEteration = true;
+    if ( first < last )
+      return true;
+  }
+  return false;
+}
+
+/*
+    @function ha_tsdb_engine::flush_rows_read
+    @brief add the rows read by the statement to the engine counters
+*/
+void ha_tsdb_engine::flush_rows_read()
+{
+  if ( fRowsRead )
+    tsdb_stats_add(&tsdb_stats.rows_read, fRowsRead);
+  fRowsRead = 0;
+}
+
+/*
+    @function ha_tsdb_engine::start_scan
+    @brief take the live range of the series for a scan or an index read
+    @details the watermark, records appended by a concurrent insert after
+             it are not seen; the origin, records expired after it are still
+             read since the files of their partitions are kept until the scan ends
+*/
+void ha_tsdb_engine::start_scan()
+{
+  mysql_mutex_lock(&share->mutex);
+  if ( !fScanning )
+    share->begin_scan();
+  fScanning = true;
+  fRecordOrigin = share->origin;
+  fAppendedNbr = share->records;
+  fRecordNbr = share->records;
+  if ( !share->series_set.active() )
+    fRecordNbr += share->reorder.count();
+  mysql_mutex_unlock(&share->mutex);
+}
+
+void ha_tsdb_engine::end_scan()
+{
+  if ( !fScanning )
+    return;
+  mysql_mutex_lock(&share->mutex);
+  share->end_scan();
+  mysql_mutex_unlock(&share->mutex);
+  fScanning = false;
+}
+
+/*
+    @function ha_tsdb_engine::build_read_ops
+    @brief plan the decoding of a record for the columns in table->read_set
+    @details columns after the last one read are not even walked; unread
+             fixed width and VARCHAR columns are stepped over without unpack
+*/
+void ha_tsdb_engine::build_read_ops()
+{
+  Field** last = table->field;
+  fReadOps.clear();
+
+  for ( Field** field = table->field; *field; ++field)
+  {
+    if ( bitmap_is_set(table->read_set, (*field)->field_index) )
+      last = field + 1;
+  }
+
+  for ( Field** field = table->field; field < last; ++field)
+  {
+    tsdb_read_op op;
+    op.field = *field;
+    op.action = TSDB_READ_UNPACK;
+    op.length = 0;
+    if ( !bitmap_is_set(table->read_set, (*field)->field_index) )
+    {
+      switch ((*field)->real_type())
+      {
+        case MYSQL_TYPE_VARCHAR:
+          op.action = TSDB_READ_SKIP_VARSTRING;
+          op.length = static_cast<Field_varstring*>(*field)->length_bytes;
+          break;
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_LONGLONG:
+        case MYSQL_TYPE_FLOAT:
+        case MYSQL_TYPE_DOUBLE:
+        case MYSQL_TYPE_NEWDECIMAL:
+        case MYSQL_TYPE_YEAR:
+        case MYSQL_TYPE_NEWDATE:
+        case MYSQL_TYPE_TIME2:
+        case MYSQL_TYPE_DATETIME2:
+        case MYSQL_TYPE_TIMESTAMP2:
+        case MYSQL_TYPE_ENUM:
+        case MYSQL_TYPE_SET:
+          op.action = TSDB_READ_SKIP_FIXED;
+          op.length = (*field)->pack_length();
+          break;
+        default:            //packed format depends on the value, unpack it
+          break;
+      }
+    }
+    fReadOps.push_back(op);
+  }
+}
+
+/*
+    @function ha_tsdb_engine::unpack_row
+    @brief decode a stored record into a mysql row
+    @params record raw tsdb record, buf destination row (record[0] format)
+*/
+void ha_tsdb_engine::unpack_row(const uchar *record, uchar *buf)
+{
+  my_ptrdiff_t offset = buf - table->record[0];
+  const uchar* val = record + 8;  //skip timestamp
+  memcpy(buf,val,table->s->null_bytes);
+  val+= table->s->null_bytes;
+ 
+  for ( std::vector<tsdb_read_op>::const_iterator op = fReadOps.begin();
+        op != fReadOps.end(); ++op)
+  {
+	  if (op->field->is_null(offset))
+	    continue;
+	  switch (op->action)
+	  {
+	    case TSDB_READ_UNPACK:
+	      val = op->field->unpack(buf + op->field->offset(table->record[0]),val);
+	      break;
+	    case TSDB_READ_SKIP_FIXED:
+	      val += op->length;
+	      break;
+	    case TSDB_READ_SKIP_VARSTRING:
+	      val += op->length + (op->length == 1 ? *val : uint2korr(val));
+	      break;
+	  }
+  }
+}
+
+/*
+    @function ha_tsdb_engine::read_row
+    @brief read the record at index into buf, going through the block cache
+    @return mysql error code
 */
-
-int ha_tsdb_engine::index_next(uchar *buf)
+int ha_tsdb_engine::read_row(uint64 index, uchar *buf)
 {
   int rc;
-  DBUG_ENTER("ha_tsdb_engine::index_next");
-  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
-  rc= HA_ERR_WRONG_COMMAND;
-  MYSQL_INDEX_READ_ROW_DONE(rc);
-  DBUG_RETURN(rc);
+  if ( share->view != NULL )
+    return read_view_row(index, buf);
+  if ( fFirstEteration || index < fCacheRecInd || index >= fCacheRecInd + fCacheLen )
+  {
+    if ( fPrefetcher.running() && index == fPrefetcher.next_index() )
+    {
+      //sequential scan: the block is (being) loaded by the read-ahead thread
+      PSI_stage_info old_stage;
+      ha_thd()->enter_stage(&stage_tsdb_waiting_readahead, &old_stage, __func__, __FILE__, __LINE__);
+      rc = fPrefetcher.take(&fCacheRecords);
+      ha_thd()->enter_stage(&old_stage, NULL, __func__, __FILE__, __LINE__);
+      if ( rc )
+        return rc;
+      fCacheRecInd = index;
+      fCacheLen = fCacheRecords.count;
+      fFirstEteration = false;
+    }
+    else if ( (rc = fetch_block(index)) )
+      return rc;
+  }
+  if ( index >= fCacheRecInd + fCacheLen )
+    return HA_ERR_END_OF_FILE;
+  fCurrentPos = fSeriesScan ? ((uint64)fSeries << TSDB_SERIES_POS_SHIFT) | index : index;
+  fRowsRead++;
+  return decode_record(fCacheRecords.record(index - fCacheRecInd), buf);
 }
 
-/**
-  @brief
-  Used to read backwards through the index.
+/*
+    @function ha_tsdb_engine::read_meta_row
+    @brief read the first or last record from the share metadata
+    @details MIN/MAX on the time key and "latest row" queries end up in
+             index_first()/index_last(); they are answered without reading
+             a block unless the series grew since the index scan started
 */
-
-int ha_tsdb_engine::index_prev(uchar *buf)
+int ha_tsdb_engine::read_meta_row(uint64 index, uchar *buf)
 {
-  int rc;
-  DBUG_ENTER("ha_tsdb_engine::index_prev");
-  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
-  rc= HA_ERR_WRONG_COMMAND;
-  MYSQL_INDEX_READ_ROW_DONE(rc);
-  DBUG_RETURN(rc);
+  bool done = false;
+  mysql_mutex_lock(&share->mutex);
+  if ( index == share->origin && share->records > share->origin )
+  {
+    fMetaRecord = share->first_record;
+    done = true;
+  }
+  else if ( index + 1 == share->records )
+  {
+    fMetaRecord = share->last_record;
+    done = true;
+  }
+  mysql_mutex_unlock(&share->mutex);
+  if ( !done )
+    return read_row(index, buf);
+  fCurrentPos = index;
+  //heap values are read under the share mutex, decode after releasing it
+  return decode_record(&fMetaRecord[0], buf);
 }
 
 /*
-@function ha_tsdb_engine::index_first
+    @function ha_tsdb_engine::read_view_row
+    @brief fill a row of a rollup companion table
+    @details the first column receives the bucket start, the next ones the
+             count/min/max/sum of the numeric columns of the source in order
 */
-int ha_tsdb_engine::index_first(uchar *buf)
+int ha_tsdb_engine::read_view_row(uint64 index, uchar *buf)
 {
-  int rc;
-  DBUG_ENTER("ha_tsdb_engine::index_first");
-  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
-  rc= HA_ERR_WRONG_COMMAND;
-  MYSQL_INDEX_READ_ROW_DONE(rc);
-  DBUG_RETURN(rc);
-}
-
+  uint width = share->view->width();
+  if ( fViewCount == 0 || index < fViewStart || index >= fViewStart + fViewCount )
+  {
+    uint64 end = index + TSDB_BLOCK_RECORDS;
+    if ( end > fRecordNbr )
+      end = fRecordNbr;
+    if ( index >= end )
+      return HA_ERR_END_OF_FILE;
+    mysql_mutex_lock(&share->mutex);
+    int rc = share->view->read(index, end, &fViewRows);
+    mysql_mutex_unlock(&share->mutex);
+    if ( rc )
+      return rc;
+    fViewStart = index;
+    fViewCount = end - index;
+  }
 
+  const double* row = &fViewRows[(index - fViewStart) * width];
+  my_ptrdiff_t offset = buf - table->record[0];
+  my_bitmap_map *old_map = dbug_tmp_use_all_columns(table, table->write_set);
+  uint col = 0;
+  for ( Field** field = table->field; *field; ++field, ++col)
+  {
+    (*field)->move_field_offset(offset);
+    if ( col >= width )
+      (*field)->set_null();
+    else
+    {
+      (*field)->set_notnull();
+      if ( col == 0 )
+        store_timestamp(*field, (longlong)row[0]);
+      else
+        (*field)->store(row[col]);
+    }
+    (*field)->move_field_offset(-offset);
+  }
+  dbug_tmp_restore_column_map(table->write_set, old_map);
+  fCurrentPos = index;
+  return 0;
+}
 
-/**
-  @brief
-  index_last() asks for the last key in the index.
-  @details
-  Called from opt_range.cc, opt_sum.cc, sql_handler.cc, and sql_select.cc.
-  @see
-  opt_range.cc, opt_sum.cc, sql_handler.cc and sql_select.cc
+/*
+    @function ha_tsdb_engine::decode_record
+    @brief decode a record with the codec of the share, or Field::unpack
+    @details heap values are only read for the columns in read_set
+    @return mysql error code
 */
-int ha_tsdb_engine::index_last(uchar *buf)
+int ha_tsdb_engine::decode_record(const uchar *record, uchar *buf)
 {
-  int rc;
-  DBUG_ENTER("ha_tsdb_engine::index_last");
-  MYSQL_INDEX_READ_ROW_START(table_share->db.str, table_share->table_name.str);
-  rc= HA_ERR_WRONG_COMMAND;
-  MYSQL_INDEX_READ_ROW_DONE(rc);
-  DBUG_RETURN(rc);
+  if ( !share->codec.valid )
+  {
+    unpack_row(record, buf);
+    return 0;
+  }
+  uint64 from, to;
+  if ( share->codec.heap_range(table, record, &from, &to) )
+  {
+    int rc = fHeapWindow.cover(share, from, to);
+    if ( rc )
+      return rc;
+  }
+  share->codec.decode(table, record, buf, &fHeapWindow);
+  return 0;
 }
 
 
 /**
   @brief
-  rnd_init() is called when the system wants the storage engine to do a table
-  scan. See the tsdb_engine in the introduction at the top of this file to see when
-  rnd_init() is called.
+  Condition pushdown: record the time window implied by cond.
   @details
-  Called from filesort.cc, records.cc, sql_handler.cc, sql_select.cc, sql_table.cc,
-  and sql_update.cc.
-  @see
-  filesort.cc, records.cc, sql_handler.cc, sql_select.cc, sql_table.cc and sql_update.cc
+  Records are stored by increasing timestamp, so the window maps to a range
+  of record indexes that rnd_init() seeks to. An equality on a tag column
+  limits the scan to the blocks holding the value; predicates on the key of
+  a series table to the series matching them. The whole condition is
+  still returned and evaluated by the server.
 */
-int ha_tsdb_engine::rnd_init(bool scan)
+const Item *ha_tsdb_engine::cond_push(const Item *cond)
 {
-  DBUG_ENTER("ha_tsdb_engine::rnd_init");
-  //initialize random access
-
-  
-  fRecordIndx=0;
-  fRecordNbr = fTMSeries->getNRecords();
-  fCacheRecInd = 0;
-  fCacheLen = 0;
-  fFirstEteration = true;
-  fTimeEcl =0;
-  fRownbr =0;
-
-  std::cerr << "[NOTE]: scan value " << scan << std::endl;
-  std::cerr << "[NOTE]: record Nbr " << fRecordNbr << std::endl;
-
-  DBUG_RETURN(0);
+  DBUG_ENTER("ha_tsdb_engine::cond_push");
+  fPushedLow = LLONG_MIN;
+  fPushedHigh = LLONG_MAX;
+  fTagField = NULL;
+  fSeriesConds.clear();
+  push_time_predicate(cond);
+  if ( share->tags.active() )
+    push_tag_predicate(cond);
+  if ( share->series_set.active() )
+    push_series_predicate(cond);
+  DBUG_RETURN(cond);
 }
 
-int ha_tsdb_engine::rnd_end()
+void ha_tsdb_engine::cond_pop()
 {
-  DBUG_ENTER("ha_tsdb_engine::rnd_end");
+  DBUG_ENTER("ha_tsdb_engine::cond_pop");
+  fPushedLow = LLONG_MIN;
+  fPushedHigh = LLONG_MAX;
+  fTagField = NULL;
+  fSeriesConds.clear();
+  DBUG_VOID_RETURN;
+}
 
-  std::cerr << "[NOTE] :  random access end " << std::endl; 
-  std::cerr << "[PROFILING]: fetching row took " << fTimeEcl << " for " << fRownbr << " : " <<  std::endl;
-  if ( fRownbr )
-	  std::cerr << "Time/row " << fTimeEcl/fRownbr << std::endl;
+/**
+  @brief
+  End of statement: forget the pushed condition and an unfinished bulk delete.
+*/
+int ha_tsdb_engine::reset()
+{
+  DBUG_ENTER("ha_tsdb_engine::reset");
+  fPushedLow = LLONG_MIN;
+  fPushedHigh = LLONG_MAX;
+  fTagField = NULL;
+  fSeriesConds.clear();
+  fBulkDelete = false;
+  fDeleteCount = 0;
   DBUG_RETURN(0);
 }
 
@@ -473,59 +2322,31 @@ int ha_tsdb_engine::rnd_next(uchar *buf)
   int rc=0;
   DBUG_ENTER("ha_tsdb_engine::rnd_next");
   MYSQL_READ_ROW_START(table_share->db.str, table_share->table_name.str,TRUE);
-  
-  if( fRecordIndx < fRecordNbr )
+
+  //past the block being read: go to the next one holding the tag value
+  if ( fTagFilter && fRecordIndx >= fTagBlockEnd && fRecordIndx < fRecordNbr )
   {
-    
-    if ( fRecordIndx > fCacheRecInd + fCacheLen || (fFirstEteration == true))
+    mysql_mutex_lock(&share->mutex);
+    uint64 next = share->tags.next(fTagField->field_index, fTagCodes, fRecordIndx, &fTagBlockEnd);
+    mysql_mutex_unlock(&share->mutex);
+    //buffered records have no block index yet, they are all read
+    if ( next < fAppendedNbr )
+      fRecordIndx = next;
+    else
     {
-      try
-      {
-         uint64 start = _getTimeepoch();
-	       fCacheRecords = fTMSeries->recordSet(fRecordIndx,fRecordIndx+10000);
-	       fTimeEcl+= _getTimeepoch() - start;
-	       fRownbr++;
-        
-      }
-      catch(...)
-      {
-        std::cerr << "[NOTE] could not get recordSet" << std::endl; 
-      }
-      fCacheRecInd = fRecordIndx;
-      fCacheLen= fCacheRecords.size();
-      fFirstEteration = false;
+      fRecordIndx = MY_MAX(fRecordIndx, fAppendedNbr);
+      fTagBlockEnd = ULLONG_MAX;
     }
-    
-	 
-	  if (fCacheLen > 0)
-	  {
-		  //my_bitmap_map *old_map = dbug_tmp_use_all_columns(table,table->write_set );
-		  tsdb::MemoryBlockPtr memptr =  fCacheRecords[fRecordIndx - fCacheRecInd].memoryBlockPtr();
-		  size_t mmlen = memptr.size();
-		  const uchar* val = (const uchar*)memptr.raw();
-		  val+=8;  //skip timestamp
-		  memcpy(buf,val,table->s->null_bytes);
-		  val+= table->s->null_bytes;
-		 
-		  for ( Field** field = table->field; *field; ++field)
-		  {
-			  if (!((*field)->is_null()))
-			  {
-				
-			    	val =(*field)->unpack(buf +(*field)->offset(table->record[0]),val);
-				
-			  }
-			 
-		  }
+  }
 
-	  }
-	  else 
-	  {
-		  std::cerr << "[NOTE]: empty record"  << std::endl;
-	  }
-	  rc = 0;
+  //end of a series: go on with the next one
+  while ( fSeriesScan && fRecordIndx >= fRecordNbr && next_series() ) {}
+  
+  if( fRecordIndx < fRecordNbr )
+  {
+	  rc = read_row(fRecordIndx, buf);
 	  fRecordIndx++;
-	  table->status = 0;
+	  table->status = rc ? STATUS_NOT_FOUND : 0;
   } 
   else
   {
@@ -558,7 +2379,8 @@ int ha_tsdb_engine::rnd_next(uchar *buf)
 void ha_tsdb_engine::position(const uchar *record)
 {
   DBUG_ENTER("ha_tsdb_engine::position");
-  std::cerr << "[NOTE] : position" << std::endl;
+  //the record index is the row reference, with its series id in a series table
+  my_store_ptr(ref, ref_length, fCurrentPos);
   DBUG_VOID_RETURN;
 }
 
@@ -581,9 +2403,19 @@ int ha_tsdb_engine::rnd_pos(uchar *buf, uchar *pos)
   MYSQL_READ_ROW_START(table_share->db.str, table_share->table_name.str,
                        TRUE);
 
-  std::cerr << "[NOTE]: ha_tsdb_engine::rnd_pos"  << std::endl;
-
-  rc= HA_ERR_WRONG_COMMAND;
+  uint64 index = my_get_ptr(pos, ref_length);
+  const uchar* record = NULL;
+  if ( share->view != NULL )
+    rc = read_view_row(index, buf);
+  else
+    record = fPosCache.record(share, index, &rc);
+  if ( record != NULL )
+  {
+    fCurrentPos = index;
+    fRowsRead++;
+    rc = decode_record(record, buf);
+  }
+  table->status = rc ? STATUS_NOT_FOUND : 0;
   MYSQL_READ_ROW_DONE(rc);
   DBUG_RETURN(rc);
 }
@@ -626,6 +2458,37 @@ int ha_tsdb_engine::rnd_pos(uchar *buf, uchar *pos)
 int ha_tsdb_engine::info(uint flag)
 {
   DBUG_ENTER("ha_tsdb_engine::info");
+
+  //maintained by the share on every append, the file is never read here
+  mysql_mutex_lock(&share->mutex);
+  if ( share->view != NULL )
+  {
+    stats.records = share->view->rows();
+    mysql_mutex_unlock(&share->mutex);
+    DBUG_RETURN(0);
+  }
+  if ( flag & HA_STATUS_VARIABLE )
+  {
+    //records of the reorder buffer are stored and read by scans
+    stats.records = share->records - share->origin + share->reorder.count();
+    stats.deleted = 0;
+    stats.mean_rec_length = share->record_size;
+    stats.data_file_length = stats.records * share->record_size;
+    stats.index_file_length = 0;
+    stats.delete_length = 0;
+  }
+  if ( flag & HA_STATUS_TIME )
+  {
+    //rows may carry their own time, the last INSERT is tracked apart
+    stats.update_time = share->update_time;
+  }
+  mysql_mutex_unlock(&share->mutex);
+
+  if ( flag & HA_STATUS_CONST )
+  {
+    stats.max_data_file_length = HA_POS_ERROR;
+    stats.block_size = TSDB_BLOCK_RECORDS * share->record_size;
+  }
   DBUG_RETURN(0);
 }
 
@@ -664,8 +2527,19 @@ int ha_tsdb_engine::extra(enum ha_extra_function operation)
 */
 int ha_tsdb_engine::delete_all_rows()
 {
+  int rc;
   DBUG_ENTER("ha_tsdb_engine::delete_all_rows");
-  DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+  if ( share->view != NULL )
+    DBUG_RETURN(HA_ERR_TABLE_READONLY);
+  //every record is expired, see tsdb_engine_share::expire()
+  mysql_mutex_lock(&share->mutex);
+  share->reorder.clear();
+  rc = share->expire(share->records);
+  //the log must not bring the buffered records back
+  if ( rc == 0 )
+    rc = share->checkpoint();
+  mysql_mutex_unlock(&share->mutex);
+  DBUG_RETURN(rc);
 }
 
 
@@ -686,7 +2560,7 @@ int ha_tsdb_engine::delete_all_rows()
 int ha_tsdb_engine::truncate()
 {
   DBUG_ENTER("ha_tsdb_engine::truncate");
-  DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+  DBUG_RETURN(delete_all_rows());
 }
 
 
@@ -712,6 +2586,15 @@ int ha_tsdb_engine::external_lock(THD *thd, int lock_type)
 }
 
 
+//statements that only add records at the end of the series
+static bool is_append(int sql_command)
+{
+  return sql_command == SQLCOM_INSERT ||
+         sql_command == SQLCOM_INSERT_SELECT ||
+         sql_command == SQLCOM_LOAD;
+}
+
+
 /**
   @brief
   The idea with handler::store_lock() is: The statement decides which locks
@@ -741,13 +2624,23 @@ int ha_tsdb_engine::external_lock(THD *thd, int lock_type)
   from mysql_lock_abort_for_thread() function)
   @see
   get_lock_data() in lock.cc
+
+  tsdb only appends: INSERT and LOAD DATA take TL_WRITE_CONCURRENT_INSERT so
+  they run next to SELECTs, which read up to the record count they saw in
+  rnd_init()/index_init(). Writers still exclude each other, and every other
+  write (ALTER, OPTIMIZE, LOCK TABLES ... WRITE) keeps the lock it asked for.
 */
 THR_LOCK_DATA **ha_tsdb_engine::store_lock(THD *thd,
                                        THR_LOCK_DATA **to,
                                        enum thr_lock_type lock_type)
 {
   if (lock_type != TL_IGNORE && lock.type == TL_UNLOCK)
+  {
+    if ( lock_type >= TL_WRITE_CONCURRENT_INSERT && lock_type <= TL_WRITE &&
+         !thd_in_lock_tables(thd) && is_append(thd_sql_command(thd)) )
+      lock_type = TL_WRITE_CONCURRENT_INSERT;
     lock.type=lock_type;
+  }
   *to++= &lock;
   return to;
 }
@@ -772,8 +2665,18 @@ THR_LOCK_DATA **ha_tsdb_engine::store_lock(THD *thd,
 int ha_tsdb_engine::delete_table(const char *name)
 {
   DBUG_ENTER("ha_tsdb_engine::delete_table");
-  /* This is not implemented but we want someone to be able that it works. */
-  DBUG_RETURN(0);
+  std::string filename = std::string(name) + bas_ext()[0];
+  std::string log = filename + TSDB_WAL_EXT;
+
+  //partition files first: a failure leaves the main file to drop again;
+  //a rollup companion table has no file of its own. The log goes last, a
+  //table of the same name must not replay it
+  int rc = tsdb_partition_remove(filename.c_str());
+  if ( rc == 0 && my_delete(filename.c_str(), MYF(0)) && my_errno() != ENOENT )
+    rc = my_errno();
+  if ( rc == 0 && my_delete(log.c_str(), MYF(0)) && my_errno() != ENOENT )
+    rc = my_errno();
+  DBUG_RETURN(rc);
 }
 
 
@@ -808,8 +2711,38 @@ int ha_tsdb_engine::rename_table(const char * from, const char * to)
 ha_rows ha_tsdb_engine::records_in_range(uint inx, key_range *min_key,
                                      key_range *max_key)
 {
+  uint64 origin, records, start, end;
   DBUG_ENTER("ha_tsdb_engine::records_in_range");
-  DBUG_RETURN(10);                         // low number to force index usage
+
+  //a scan may be open on this handler: leave its bounds alone
+  mysql_mutex_lock(&share->mutex);
+  origin = share->origin;
+  records = share->records + share->reorder.count();
+  mysql_mutex_unlock(&share->mutex);
+  start = origin;
+  end = records;
+
+  if ( min_key != NULL )
+  {
+    longlong ts = key_to_timestamp(min_key->key);
+    if ( min_key->flag == HA_READ_AFTER_KEY )
+      ts += time_resolution(time_field(table));
+    if ( search_timestamp(ts, origin, records, &start) )
+      DBUG_RETURN(records - origin);
+  }
+  if ( max_key != NULL )
+  {
+    longlong ts = key_to_timestamp(max_key->key);
+    if ( max_key->flag == HA_READ_AFTER_KEY )
+      ts += time_resolution(time_field(table));
+    if ( search_timestamp(ts, origin, records, &end) )
+      DBUG_RETURN(records - origin);
+  }
+
+  //the optimizer takes 0 as a proof that the range is empty
+  if ( end <= start )
+    DBUG_RETURN(1);
+  DBUG_RETURN(end - start);
 }
 
 
@@ -832,15 +2765,38 @@ ha_rows ha_tsdb_engine::records_in_range(uint inx, key_range *min_key,
 int ha_tsdb_engine::create(const char *name, TABLE *table_arg,
                        HA_CREATE_INFO *create_info)
 {
-
   DBUG_ENTER("ha_tsdb_engine::create");
-mysql_mutex_lock(&fMutex);
+  mysql_mutex_lock(&tsdb_create_mutex);
+  int rc = create_file(name, table_arg);
+  mysql_mutex_unlock(&tsdb_create_mutex);
+  DBUG_RETURN(rc);
+}
+
+//close a file opened by create_file()
+static void close_created(hid_t file, PSI_file* psi_file)
+{
+  tsdb_file_wait wait(PSI_FILE_CLOSE, psi_file, 0, __FILE__, __LINE__);
+  H5Fclose(file);
+  wait.closed();
+}
+
+/*
+    @function ha_tsdb_engine::create_file
+    @brief create() body, called under tsdb_create_mutex
+*/
+int ha_tsdb_engine::create_file(const char *name, TABLE *table_arg)
+{
+  DBUG_ENTER("ha_tsdb_engine::create_file");
  if ( share == NULL )share = get_share();
-/* if (share->count == 0 )
- {
-	thr_lock_init(&share->lock)
- }*/
-//  thr_lock_data_init(&share->lock,&lock,NULL);
+
+  //a rollup companion table reads the file of its source table
+  std::string rollup;
+  if ( tsdb_table_option(table_arg->s, TSDB_OPT_ROLLUP, &rollup) )
+  {
+    if ( table_arg->s->keys > 0 )
+      DBUG_RETURN(HA_ERR_UNSUPPORTED);
+    DBUG_RETURN(0);
+  }
 
   /*
     retrieve table name
@@ -862,59 +2818,242 @@ mysql_mutex_lock(&fMutex);
 	int intstat;
 	intstat = stat(strFilePath.c_str(),&finfo);
 	hid_t ofh;
+	PSI_file* psi_file = NULL;
 	
 	if(intstat != 0) 
 	{
 	  // Try to create the file
+		tsdb_file_wait wait(PSI_FILE_CREATE, strTableName.c_str(), __FILE__, __LINE__);
 		ofh = H5Fcreate(strTableName.c_str(),H5F_ACC_EXCL,H5P_DEFAULT,H5P_DEFAULT);
+		psi_file = wait.opened(ofh >= 0);
 		if(ofh < 0) {
-		  std::cerr << "[INFO]: name:" << name << std::endl;
-			std::cerr << "Error creating TSDB file: '" << strFilePath << "'." << std::endl;
-			DBUG_RETURN(-1);
+			sql_print_error("tsdb_engine: cannot create the file '%s'", strTableName.c_str());
+			DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
 		}
 	}
 	else
 	{
-	  //exception
-	  std::cerr << "Error reading file" << strFilePath << std::endl;
-	  DBUG_RETURN(-5);
+	  sql_print_error("tsdb_engine: '%s' already exists", strTableName.c_str());
+	  DBUG_RETURN(HA_ERR_TABLE_EXIST);
 	}
 
+  //the only index we support is the time key, see time_field()
+  if ( table_arg->s->keys > 0 && time_field(table_arg) == NULL )
+  {
+    push_warning_printf(ha_thd(), Sql_condition::SL_WARNING, ER_ILLEGAL_HA_CREATE_OPTION,
+                        "tsdb_engine: an index must be on the single column named by " TSDB_OPT_TIME_KEY);
+    close_created(ofh, psi_file);
+    my_delete(strTableName.c_str(), MYF(0));
+    DBUG_RETURN(HA_ERR_UNSUPPORTED);
+  }
+  std::string time_column;
+  if ( tsdb_table_option(table_arg->s, TSDB_OPT_TIME_KEY, &time_column) && time_key(table_arg) == NULL )
+  {
+    push_warning_printf(ha_thd(), Sql_condition::SL_WARNING, ER_ILLEGAL_HA_CREATE_OPTION,
+                        "tsdb_engine: " TSDB_OPT_TIME_KEY " must name a TIMESTAMP, DATETIME or BIGINT column");
+    close_created(ofh, psi_file);
+    my_delete(strTableName.c_str(), MYF(0));
+    DBUG_RETURN(HA_ERR_UNSUPPORTED);
+  }
+  if ( !tsdb_tags_valid(table_arg) )
+  {
+    close_created(ofh, psi_file);
+    my_delete(strTableName.c_str(), MYF(0));
+    DBUG_RETURN(HA_ERR_UNSUPPORTED);
+  }
+  if ( !tsdb_series_valid(table_arg) )
+  {
+    close_created(ofh, psi_file);
+    my_delete(strTableName.c_str(), MYF(0));
+    DBUG_RETURN(HA_ERR_UNSUPPORTED);
+  }
+
   tsdb::Structure* intStructure=NULL;
-  int err = CreateTSDBStructure(table_arg->field,&intStructure);
+  int err = CreateTSDBStructure(table_arg->field,table_arg->s->null_bytes,&intStructure);
   if ( err != 0)
   {
-    std::cerr << "Error when creating internal structure " << err << std::endl;  ;
-    return -6;
+    sql_print_error("tsdb_engine: cannot build the structure of '%s': %d", strTableName.c_str(), err);
+    delete intStructure;
+    close_created(ofh, psi_file);
+    my_delete(strTableName.c_str(), MYF(0));
+    DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
   }
   try{
     tsdb::Timeseries ts =  tsdb::Timeseries(ofh,"tsdb","",boost::make_shared<tsdb::Structure>(*intStructure));
   }catch(...)
   {
-    std::cerr << "[ERROR]: exception" << std::endl;
-    return -7;
+    sql_print_error("tsdb_engine: cannot create the series of '%s'", strTableName.c_str());
+    delete intStructure;
+    close_created(ofh, psi_file);
+    my_delete(strTableName.c_str(), MYF(0));
+    DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
   }
+  //only the record size is needed from here on
+  size_t record_size = intStructure->getSizeOf();
+  delete intStructure;
   
-  //close hdf5 handle
-  H5Fclose(ofh);
-  
+  //chunking and filters of the records dataset are set once here
+  tsdb_storage_options options;
+  tsdb_row_codec codec;
+  bool valid = storage_options(table_arg->s, &options);
+  if ( valid && (options.compress || options.chunk_records > 0 || options.deflate > 0) )
+  {
+    tsdb_records_layout layout = { options.chunk_records, options.deflate, NULL };
+    if ( options.compress )
+    {
+      valid = codec.build(table_arg, record_size, TSDB_FORMAT_CURRENT);
+      layout.codec = &codec;
+    }
+    valid = valid && tsdb_rebuild_records(ofh, record_size, layout) == 0;
+  }
+  //series are told apart by the key slots of the codec layout
+  std::string keys;
+  if ( valid && !codec.valid && tsdb_table_option(table_arg->s, TSDB_OPT_SERIES, &keys) )
+    valid = codec.build(table_arg, record_size, TSDB_FORMAT_CURRENT);
+  if ( !valid )
+  {
+    push_warning_printf(ha_thd(), Sql_condition::SL_WARNING, ER_ILLEGAL_HA_CREATE_OPTION,
+                        "tsdb_engine: cannot apply the storage options of the table");
+    close_created(ofh, psi_file);
+    my_delete(strTableName.c_str(), MYF(0));
+    DBUG_RETURN(HA_ERR_UNSUPPORTED);
+  }
+
+  //records of this file are laid out by tsdb_row_codec
+  int format = TSDB_FORMAT_CURRENT;
+  H5LTset_attribute_int(ofh, "/", TSDB_FORMAT_ATTR, &format, 1);
+
+  //partition files are created as their first record arrives; files
+  //left in the directory would be taken for partitions of the new table
+  std::string partitions = strTableName + TSDB_PARTITION_DIR;
+  if ( options.partition != TSDB_PARTITION_NONE &&
+       tsdb_partition_files(strTableName.c_str()) > 0 )
+  {
+    push_warning_printf(ha_thd(), Sql_condition::SL_WARNING, ER_ILLEGAL_HA_CREATE_OPTION,
+                        "tsdb_engine: the partition directory '%s' is not empty", partitions.c_str());
+    close_created(ofh, psi_file);
+    my_delete(strTableName.c_str(), MYF(0));
+    DBUG_RETURN(HA_ERR_TABLE_EXIST);
+  }
+  if ( options.partition != TSDB_PARTITION_NONE &&
+       my_mkdir(partitions.c_str(), 0777, MYF(0)) && my_errno() != EEXIST )
+  {
+    sql_print_error("tsdb_engine: cannot create the partition directory '%s'", partitions.c_str());
+    close_created(ofh, psi_file);
+    my_delete(strTableName.c_str(), MYF(0));
+    DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+  }
   
-  fflush(stderr); 
-  mysql_mutex_unlock(&fMutex);
+  //close hdf5 handle
+  close_created(ofh, psi_file);
   DBUG_RETURN(0);
 }
 
 
+/*
+    @function ha_tsdb_engine::optimize
+    @brief OPTIMIZE TABLE rewrites the records with the current storage options
+    @details change them with ALTER TABLE ... COMMENT='tsdb_chunk_records=...'
+             first, see check_if_incompatible_data(). The old dataset is
+             unlinked, its space is only returned to the file system by h5repack.
+*/
+int ha_tsdb_engine::optimize(THD* thd, HA_CHECK_OPT* check_opt)
+{
+  DBUG_ENTER("ha_tsdb_engine::optimize");
+  tsdb_storage_options options;
+  if ( share->view != NULL || !storage_options(table->s, &options) )
+    DBUG_RETURN(HA_ADMIN_NOT_IMPLEMENTED);
+
+  int rc;
+  mysql_mutex_lock(&share->mutex);
+  if ( options.compress && !share->codec.valid )
+    rc = HA_ERR_UNSUPPORTED;      //packed files have no column layout
+  else
+  {
+    tsdb_records_layout layout = { options.chunk_records, options.deflate,
+                                   options.compress ? &share->codec : NULL };
+    rc = share->rebuild_records(layout);
+  }
+  if ( rc == 0 )
+    rc = share->checkpoint();
+  mysql_mutex_unlock(&share->mutex);
+  DBUG_RETURN(rc ? HA_ADMIN_FAILED : HA_ADMIN_OK);
+}
+
+/*
+    @function ha_tsdb_engine::check_if_incompatible_data
+    @brief storage options can change in place: the rows are not touched
+           until OPTIMIZE TABLE. A new partitioning, new tag columns or a
+           new series key copy the table.
+*/
+bool ha_tsdb_engine::check_if_incompatible_data(HA_CREATE_INFO *info, uint table_changes)
+{
+  std::string before, after;
+  std::string partition_before("none"), partition_after("none");
+  std::string tags_before, tags_after;
+  std::string series_before, series_after;
+  tsdb_table_option(table->s, TSDB_OPT_PARTITION, &partition_before);
+  tsdb_comment_option(info->comment, TSDB_OPT_PARTITION, &partition_after);
+  tsdb_table_option(table->s, TSDB_OPT_TAGS, &tags_before);
+  tsdb_comment_option(info->comment, TSDB_OPT_TAGS, &tags_after);
+  tsdb_table_option(table->s, TSDB_OPT_SERIES, &series_before);
+  tsdb_comment_option(info->comment, TSDB_OPT_SERIES, &series_after);
+  if ( table_changes != IS_EQUAL_YES || (info->used_fields & ~HA_CREATE_USED_COMMENT) ||
+       tsdb_table_option(table->s, TSDB_OPT_ROLLUP, &before) ||
+       tsdb_comment_option(info->comment, TSDB_OPT_ROLLUP, &after) ||
+       strcasecmp(partition_before.c_str(), partition_after.c_str()) != 0 ||
+       strcasecmp(tags_before.c_str(), tags_after.c_str()) != 0 ||
+       strcasecmp(series_before.c_str(), series_after.c_str()) != 0 )
+    return COMPATIBLE_DATA_NO;
+  return COMPATIBLE_DATA_YES;
+}
+
+/*
+    @function ha_tsdb_engine::start_bulk_insert
+    @brief allocate the append buffer for a multi-row insert
+    @params rows number of rows announced by the server, 0 if unknown
+*/
 void ha_tsdb_engine::start_bulk_insert(ha_rows rows)
 {
-  std::cerr << "ENTER ha_tsdb_engine::start_bulk_insert" << std::endl;
+  DBUG_ENTER("ha_tsdb_engine::start_bulk_insert");
+  if ( share->view != NULL )
+    DBUG_VOID_RETURN;
+
+  fRecordSize = share->record_size;
+  fAppendCapacity = TSDB_APPEND_BUFFER_SIZE / fRecordSize;
+  if ( rows > 0 && rows < fAppendCapacity )
+    fAppendCapacity = rows;
+  if ( fAppendCapacity < 2 )
+    DBUG_VOID_RETURN;       //single row, no need to buffer
+
+  //a packed row may overrun its slot by the null bytes, keep room for the last one
+  fAppendBuf = (uchar*)my_malloc(tsdb_key_memory_append,
+                                 fAppendCapacity * fRecordSize + table->s->reclength,
+                                 MYF(MY_WME));
+  fAppendCount = 0;
+
+  DBUG_VOID_RETURN;
 }
 
+/*
+    @function ha_tsdb_engine::end_bulk_insert
+    @brief flush the remaining buffered rows and release the buffer
+    @return mysql error code, also set as my_errno: the server reports the
+            failure of ha_end_bulk_insert() from it
+*/
 int ha_tsdb_engine::end_bulk_insert()
 {
   int err = 0;
-   //fTMSeries->flushAppendBuffer();
-   std::cerr << "ENTER ha_tsdb_engine::end_bulk_insert" << std::endl;
+  DBUG_ENTER("ha_tsdb_engine::end_bulk_insert");
+
+  if ( fAppendBuf != NULL )
+  {
+    err = flush_append_buffer();
+    my_free(fAppendBuf);
+    fAppendBuf = NULL;
+  }
+  if ( err )
+    set_my_errno(err);
   
   DBUG_RETURN(err);
 }
@@ -924,122 +3063,129 @@ int ha_tsdb_engine::end_bulk_insert()
 struct st_mysql_storage_engine tsdb_engine_storage_engine=
 { MYSQL_HANDLERTON_INTERFACE_VERSION };
 
-static ulong srv_enum_var= 0;
-static ulong srv_ulong_var= 0;
-static double srv_double_var= 0;
-
-const char *enum_var_names[]=
-{
-  "e1", "e2", NullS
-};
+static MYSQL_SYSVAR_ULONG(
+  prefetch_depth,
+  srv_prefetch_depth,
+  PLUGIN_VAR_RQCMDARG,
+  "Number of record blocks read ahead by table scans, 0 disables read-ahead",
+  NULL,
+  NULL,
+  2,
+  0,
+  16,
+  0);
 
-TYPELIB enum_var_typelib=
-{
-  array_elements(enum_var_names) - 1,
-  "enum_var_typelib",
-  enum_var_names,
-  NULL
-};
+static MYSQL_SYSVAR_ULONG(
+  chunk_records,
+  srv_chunk_records,
+  PLUGIN_VAR_RQCMDARG,
+  "Records per HDF5 chunk of new tables, 0 keeps the tsdb library layout",
+  NULL,
+  NULL,
+  0,
+  0,
+  1 << 24,
+  0);
 
-static MYSQL_SYSVAR_ENUM(
-  enum_var,                       // name
-  srv_enum_var,                   // varname
-  PLUGIN_VAR_RQCMDARG,            // opt
-  "Sample ENUM system variable.", // comment
-  NULL,                           // check
-  NULL,                           // update
-  0,                              // def
-  &enum_var_typelib);             // typelib
+static MYSQL_SYSVAR_ULONG(
+  chunk_cache_size,
+  srv_chunk_cache_size,
+  PLUGIN_VAR_RQCMDARG,
+  "Bytes of the HDF5 raw data chunk cache of each records dataset",
+  NULL,
+  NULL,
+  1024 * 1024,
+  0,
+  ULONG_MAX,
+  1024);
 
 static MYSQL_SYSVAR_ULONG(
-  ulong_var,
-  srv_ulong_var,
+  meta_cache_size,
+  srv_meta_cache_size,
   PLUGIN_VAR_RQCMDARG,
-  "0..1000",
+  "Initial bytes of the HDF5 metadata cache of each file, 0 keeps the HDF5 default",
   NULL,
   NULL,
-  8,
   0,
-  1000,
+  0,
+  TSDB_META_CACHE_MAX,
+  1024);
+
+static MYSQL_SYSVAR_ULONG(
+  retention_interval,
+  srv_retention_interval,
+  PLUGIN_VAR_RQCMDARG,
+  "Seconds between two expiries of the tables with a tsdb_retention option",
+  NULL,
+  NULL,
+  60,
+  1,
+  86400,
   0);
 
-static MYSQL_SYSVAR_DOUBLE(
-  double_var,
-  srv_double_var,
+static MYSQL_SYSVAR_ULONG(
+  flush_log_at_insert,
+  srv_flush_log_at_insert,
   PLUGIN_VAR_RQCMDARG,
-  "0.500000..1000.500000",
+  "When the log of inserted records is synced: 0 left to the OS, "
+  "1 before each insert returns, 2 at most once per second",
   NULL,
   NULL,
-  8.5,
-  0.5,
-  1000.5,
-  0);                             // reserved always 0
+  TSDB_WAL_FLUSH_INSERT,
+  TSDB_WAL_FLUSH_NONE,
+  TSDB_WAL_FLUSH_SECOND,
+  0);
 
-static MYSQL_THDVAR_DOUBLE(
-  double_thdvar,
+static MYSQL_SYSVAR_UINT(
+  deflate_level,
+  srv_deflate_level,
   PLUGIN_VAR_RQCMDARG,
-  "0.500000..1000.500000",
+  "gzip level of the records of new tables, 0 disables it",
   NULL,
   NULL,
-  8.5,
-  0.5,
-  1000.5,
+  0,
+  0,
+  9,
   0);
 
 static struct st_mysql_sys_var* tsdb_engine_system_variables[]= {
-  MYSQL_SYSVAR(enum_var),
-  MYSQL_SYSVAR(ulong_var),
-  MYSQL_SYSVAR(double_var),
-  MYSQL_SYSVAR(double_thdvar),
+  MYSQL_SYSVAR(prefetch_depth),
+  MYSQL_SYSVAR(chunk_records),
+  MYSQL_SYSVAR(chunk_cache_size),
+  MYSQL_SYSVAR(meta_cache_size),
+  MYSQL_SYSVAR(deflate_level),
+  MYSQL_SYSVAR(retention_interval),
+  MYSQL_SYSVAR(flush_log_at_insert),
   NULL
 };
 
-// this is an tsdb_engine of SHOW_FUNC and of my_snprintf() service
-static int show_func_tsdb_engine(MYSQL_THD thd, struct st_mysql_show_var *var,
-                             char *buf)
-{
-  var->type= SHOW_CHAR;
-  var->value= buf; // it's of SHOW_VAR_FUNC_BUFF_SIZE bytes
-  my_snprintf(buf, SHOW_VAR_FUNC_BUFF_SIZE,
-              "enum_var is %lu, ulong_var is %lu, "
-              "double_var is %f, %.6b", // %b is a MySQL extension
-              srv_enum_var, srv_ulong_var, srv_double_var, "really");
-  return 0;
-}
-
-struct tsdb_engine_vars_t
-{
-	ulong  var1;
-	double var2;
-	char   var3[64];
-  bool   var4;
-  bool   var5;
-  ulong  var6;
-};
-
-tsdb_engine_vars_t tsdb_engine_vars= {100, 20.01, "three hundred", true, 0, 8250};
-
-static st_mysql_show_var show_status_tsdb_engine[]=
+static st_mysql_show_var show_fetch_latency[]=
 {
-  {"var1", (char *)&tsdb_engine_vars.var1, SHOW_LONG, SHOW_SCOPE_GLOBAL},
-  {"var2", (char *)&tsdb_engine_vars.var2, SHOW_DOUBLE, SHOW_SCOPE_GLOBAL},
+  {"lt_10us", (char *)&tsdb_stats.fetch_latency[0], SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"lt_100us", (char *)&tsdb_stats.fetch_latency[1], SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"lt_1ms", (char *)&tsdb_stats.fetch_latency[2], SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"lt_10ms", (char *)&tsdb_stats.fetch_latency[3], SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"lt_100ms", (char *)&tsdb_stats.fetch_latency[4], SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"lt_1s", (char *)&tsdb_stats.fetch_latency[5], SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"ge_1s", (char *)&tsdb_stats.fetch_latency[6], SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
   {0,0,SHOW_UNDEF, SHOW_SCOPE_UNDEF} // null terminator required
 };
 
-static struct st_mysql_show_var show_array_tsdb_engine[]=
-{
-  {"array", (char *)show_status_tsdb_engine, SHOW_ARRAY, SHOW_SCOPE_GLOBAL},
-  {"var3", (char *)&tsdb_engine_vars.var3, SHOW_CHAR, SHOW_SCOPE_GLOBAL},
-  {"var4", (char *)&tsdb_engine_vars.var4, SHOW_BOOL, SHOW_SCOPE_GLOBAL},
-  {0,0,SHOW_UNDEF, SHOW_SCOPE_UNDEF}
-};
-
 static struct st_mysql_show_var func_status[]=
 {
-  {"tsdb_engine_func_tsdb_engine", (char *)show_func_tsdb_engine, SHOW_FUNC, SHOW_SCOPE_GLOBAL},
-  {"tsdb_engine_status_var5", (char *)&tsdb_engine_vars.var5, SHOW_BOOL, SHOW_SCOPE_GLOBAL},
-  {"tsdb_engine_status_var6", (char *)&tsdb_engine_vars.var6, SHOW_LONG, SHOW_SCOPE_GLOBAL},
-  {"tsdb_engine_status",  (char *)show_array_tsdb_engine, SHOW_ARRAY, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_rows_appended", (char *)&tsdb_stats.rows_appended, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_rows_read", (char *)&tsdb_stats.rows_read, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_blocks_fetched", (char *)&tsdb_stats.blocks_fetched, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_bytes_read", (char *)&tsdb_stats.bytes_read, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_bytes_written", (char *)&tsdb_stats.bytes_written, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_append_batches", (char *)&tsdb_stats.append_batches, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_block_cache_hits", (char *)&tsdb_stats.block_cache_hits, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_block_cache_misses", (char *)&tsdb_stats.block_cache_misses, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_readahead_hits", (char *)&tsdb_stats.readahead_hits, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_readahead_waits", (char *)&tsdb_stats.readahead_waits, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_fetch_time_us", (char *)&tsdb_stats.fetch_time_us, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_append_time_us", (char *)&tsdb_stats.append_time_us, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+  {"tsdb_engine_fetch_latency", (char *)show_fetch_latency, SHOW_ARRAY, SHOW_SCOPE_GLOBAL},
   {0,0,SHOW_UNDEF, SHOW_SCOPE_UNDEF}
 };
 
@@ -1052,7 +3198,7 @@ mysql_declare_plugin(tsdb_engine)
   "time series storage engine",
   PLUGIN_LICENSE_GPL,
   tsdb_engine_init_func,                            /* Plugin Init */
-  NULL,                                         /* Plugin Deinit */
+  tsdb_engine_done_func,                            /* Plugin Deinit */
   0x0001 /* 0.1 */,
   func_status,                                  /* status variables */
   tsdb_engine_system_variables,                     /* system variables */
@@ -10,6 +10,81 @@
 #include "handler.h"                     /* handler */
 #include "my_base.h"                     /* ha_rows */
 #include <table.h>
+#include "sql_string.h"
+#include "tsdb_block.h"
+#include "tsdb_prefetch.h"
+#include "tsdb_row_codec.h"
+#include "tsdb_rollup.h"
+#include "tsdb_partition.h"
+#include "tsdb_retention.h"
+#include "tsdb_reorder.h"
+#include "tsdb_wal.h"
+#include "tsdb_tags.h"
+#include "tsdb_heap.h"
+#include "tsdb_series.h"
+#include "tsdb_compress.h"
+#include "tsdb_stats.h"
+#include "tsdb_psi.h"
+#include "malloc_allocator.h"
+#include <string>
+#include <vector>
+
+//number of records fetched from the series at once
+#define TSDB_BLOCK_RECORDS 10000
+
+//root attribute holding the record layout of a .tsdb file, a TSDB_FORMAT_* of tsdb_row_codec.h
+#define TSDB_FORMAT_ATTR "tsdb_engine_format"
+
+//root attributes holding the series metadata, see tsdb_engine_share::save_stats()
+#define TSDB_META_RECORDS "tsdb_engine_records"
+#define TSDB_META_FIRST   "tsdb_engine_first_record"
+#define TSDB_META_LAST    "tsdb_engine_last_record"
+#define TSDB_META_ORIGIN  "tsdb_engine_origin"      ///< records before it are expired
+
+//engine error: an INSERT record is older than the last one of its series
+#define HA_ERR_TSDB_LATE_RECORD (HA_ERR_LAST + 1)
+
+/*
+  Table options are key=value pairs in the table COMMENT, e.g.
+  COMMENT='tsdb_rollup=cpu:1h'
+*/
+#define TSDB_OPT_ROLLUP "tsdb_rollup"   ///< read-only companion of a rollup level
+#define TSDB_OPT_COMPRESSION "tsdb_compression"  ///< "gorilla" or "none", see tsdb_compress.h
+#define TSDB_OPT_CHUNK_RECORDS "tsdb_chunk_records" ///< records per HDF5 chunk
+#define TSDB_OPT_CHUNK_CACHE "tsdb_chunk_cache"     ///< raw data chunk cache, bytes
+#define TSDB_OPT_META_CACHE "tsdb_meta_cache"       ///< metadata cache, bytes
+#define TSDB_OPT_DEFLATE "tsdb_deflate"             ///< gzip level 0..9
+#define TSDB_OPT_PARTITION "tsdb_partition"         ///< "hour", "day" or "week", see tsdb_partition.h
+#define TSDB_OPT_RETENTION "tsdb_retention"         ///< history kept, e.g. 30d, see tsdb_retention.h
+#define TSDB_OPT_TIME_KEY "tsdb_time_key"           ///< column giving the time of a row, see pack_row()
+#define TSDB_OPT_REORDER_WINDOW "tsdb_reorder_window" ///< late records absorbed, e.g. 5m, see tsdb_reorder.h
+#define TSDB_OPT_TAGS "tsdb_tags"                   ///< dictionary encoded columns, e.g. host:region, see tsdb_tags.h
+#define TSDB_OPT_SERIES "tsdb_series"               ///< series key columns, e.g. host:region, see tsdb_series.h
+
+bool tsdb_table_option(TABLE_SHARE* share, const char* key, std::string* value);
+bool tsdb_table_option_list(TABLE_SHARE* share, const char* key, std::vector<std::string>* items);
+bool tsdb_comment_option(const LEX_STRING& comment, const char* key, std::string* value);
+
+/*
+  HDF5 storage settings of a table: the engine_* sysvars, overridden by the
+  table options. Chunking and filters are fixed at CREATE TABLE and changed
+  by OPTIMIZE TABLE, the caches apply whenever the file is opened.
+*/
+struct tsdb_storage_options
+{
+  ulonglong chunk_records;      ///< 0 keeps the tsdb library layout
+  ulonglong chunk_cache;
+  ulonglong meta_cache;         ///< 0 keeps the HDF5 default
+  uint deflate;
+  bool compress;                ///< tsdb_compression=gorilla
+  uint partition;               ///< tsdb_partition_width, fixed at CREATE TABLE
+  ulonglong retention;          ///< milliseconds, 0 keeps every record
+  bool time_key;                ///< rows carry their time, tsdb_time_key= is set
+  ulonglong reorder_window;     ///< milliseconds, 0 when rows must come in order
+};
+
+hid_t tsdb_file_access(const tsdb_storage_options& options);
+bool tsdb_locate_records(hid_t file, size_t record_size, hid_t* dset, hid_t* type);
 
 //forward declaration
 namespace tsdb{
@@ -21,6 +96,49 @@ namespace tsdb{
   class RecordSet;
 }
 
+/*
+@brief how a scan decodes one column of a stored record; built from read_set
+*/
+enum tsdb_read_action
+{
+  TSDB_READ_UNPACK,           ///< column is read by the query
+  TSDB_READ_SKIP_FIXED,       ///< not read, skip length bytes
+  TSDB_READ_SKIP_VARSTRING    ///< not read, skip a length prefixed value
+};
+
+struct tsdb_read_op
+{
+  Field* field;
+  tsdb_read_action action;
+  uint length;                ///< fixed width, or size of the length prefix
+};
+
+//blocks kept by rnd_pos() for re-reads
+#define TSDB_POS_CACHE_BLOCKS 4
+
+class tsdb_engine_share;
+
+/*
+@brief the few last blocks touched by rnd_pos()
+
+Blocks are aligned on TSDB_BLOCK_RECORDS so that a sort reading back its
+rows in any order hits the same blocks; the least recently used is evicted.
+In a series table they are blocks of the series named by the row reference.
+*/
+class tsdb_block_cache
+{
+  public:
+  tsdb_block_cache();
+  const uchar* record(tsdb_engine_share* share, uint64 ref, int* rc);
+  void clear();
+
+  private:
+  tsdb_block blocks[TSDB_POS_CACHE_BLOCKS];
+  uint64 starts[TSDB_POS_CACHE_BLOCKS];    ///< row reference of the first record
+  ulonglong last_used[TSDB_POS_CACHE_BLOCKS];
+  ulonglong tick;
+};
+
 /*
 @brief tsdb_engine_share is a class that will be shared among all open handlers
 
@@ -30,13 +148,73 @@ class tsdb_engine_share : public Handler_share {
     
     public:
   THR_LOCK lock;
-  unsigned long use_count;
+  mysql_mutex_t mutex;            ///< serializes HDF5 calls on the shared series
+  unsigned long use_count;        ///< number of handlers using the series
+  hid_t file_id;                  ///< HDF5 file handle, open while the share lives
+  PSI_file* psi_file;             ///< file_id as seen by the performance schema
+  tsdb::Timeseries* series;       ///< Timeseries shared by all handlers of the table
+  hid_t records_id;               ///< records dataset of the series, -1 if not found
+  hid_t records_type;
+  size_t record_size;
+  int format;                     ///< TSDB_FORMAT_* of the file
+  tsdb_row_codec codec;           ///< valid when the file uses TSDB_FORMAT_CODEC
+  bool codec_built;
+
+  /*
+    Records [origin, records) are live. Expiring moves origin, the index of
+    a record never changes; see expire().
+  */
+  uint64 origin;
+  ulonglong retention;            ///< milliseconds, 0 when the table has no retention
+  uint scans;                     ///< handlers between rnd_init/index_init and their end
+  bool client_time;               ///< records carry the time of the row, not of the insert
+  tsdb_reorder_buffer reorder;    ///< records waiting for the tsdb_reorder_window= to pass
+  tsdb_wal wal;                   ///< records not yet flushed to the HDF5 files
+
+  //statistics maintained on append, reported by info()
+  ha_rows records;
+  longlong first_ts;              ///< _TSDB_timestamp of the first live record
+  longlong last_ts;               ///< _TSDB_timestamp of the last record
+  ulong update_time;              ///< wall-clock seconds of the last INSERT, file time at open
+  std::vector<uchar> first_record;
+  std::vector<uchar> last_record;
+
+  tsdb_rollup rollup;             ///< 1m/1h/1d buckets of the series
+  tsdb_rollup_reader* view;       ///< set for rollup companion tables
+  tsdb_partitions partitions;     ///< per window files, when tsdb_partition= is set
+  tsdb_tags tags;                 ///< dictionaries and block index of the tsdb_tags= columns
+  tsdb_heap heap;                 ///< long VARCHAR and BLOB values, open when the codec has some
+  tsdb_series_set series_set;     ///< one dataset per key of the tsdb_series= columns
+
   tsdb_engine_share();
-  
-  ~tsdb_engine_share()
-  {
-    thr_lock_delete(&lock);
-  }
+  ~tsdb_engine_share();
+
+  int open_series(const char* filename, const tsdb_storage_options& options);
+  int rebuild_records(const tsdb_records_layout& layout);
+  int open_view(const char* name, const std::string& option);
+  uint64 lower_bound(longlong ts);
+  void bracket(longlong ts, uint64* low, uint64* high);
+  int read_block(uint64 from, uint64 to, tsdb_block* block);
+  int read_series(uint id, uint64 from, uint64 to, tsdb_block* block);
+  void fetch_buffered(uint64 from, uint64 to, tsdb_block* block);
+  int append(const uchar* recs, uint64 n);
+  int insert(uchar* recs, uint64 n, const tsdb_heap_buffer& values, uint64* lsn);
+  int recover(const char* filename);
+  int flush_reorder();
+  int checkpoint();
+  int expire(uint64 index);
+  void begin_scan();
+  void end_scan();
+
+  private:
+  friend class tsdb_rollup;
+  friend class tsdb_tags;
+  void appended(const uchar* recs, uint64 n);
+  int place(const uchar* recs, uint64 n);
+  void locate_records();
+  void load_stats();
+  void save_stats();
+  int fetch_records(uint64 from, uint64 to, tsdb_block* block);
 };
 
 /** @brief
@@ -59,15 +237,20 @@ class ha_tsdb_engine: public handler
      
      /** @brief
     The name of the index type that will be used for display.
-    
+    The time key is ordered: records are stored by increasing timestamp.
     */
-  const char *index_type(uint inx) { return "HASH"; }
+  const char *index_type(uint inx) { return "BTREE"; }
   
     /** @brief
     The file extensions.
    */
   const char **bas_ext() const;
 
+  /** @brief
+    Text of the engine errors, HA_ERR_TSDB_LATE_RECORD.
+   */
+  bool get_error_message(int error, String *buf);
+
   /** @brief
     This is a list of flags that indicate what functionality the storage engine
     implements. The current table flags are documented in handler.h
@@ -78,8 +261,10 @@ class ha_tsdb_engine: public handler
       We are saying that this engine is just statement capable to have
       an engine that can only handle statement-based logging. This is
       used in testing.
+      The record count kept in the share is exact, COUNT(*) is read from
+      info().
     */
-    return HA_BINLOG_STMT_CAPABLE;
+    return HA_BINLOG_STMT_CAPABLE | HA_STATS_RECORDS_IS_EXACT;
   }
 
   /** @brief
@@ -93,7 +278,7 @@ class ha_tsdb_engine: public handler
   */
   ulong index_flags(uint inx, uint part, bool all_parts) const
   {
-    return 0;
+    return HA_READ_NEXT | HA_READ_PREV | HA_READ_ORDER | HA_READ_RANGE;
   }
 
   /** @brief
@@ -110,30 +295,27 @@ class ha_tsdb_engine: public handler
     the data it is about to send. Return *real* limits of your storage engine
     here; MySQL will do min(your_limits, MySQL_limits) automatically.
       @details
-    There is no need to implement ..._key_... methods if your engine doesn't
-    support indexes.
+    The only key is the time key over _TSDB_timestamp.
    */
-  uint max_supported_keys()          const { return 0; }
+  uint max_supported_keys()          const { return 1; }
 
   /** @brief
     unireg.cc will call this to make sure that the storage engine can handle
     the data it is about to send. Return *real* limits of your storage engine
     here; MySQL will do min(your_limits, MySQL_limits) automatically.
       @details
-    There is no need to implement ..._key_... methods if your engine doesn't
-    support indexes.
+    The time key is made of a single column.
    */
-  uint max_supported_key_parts()     const { return 0; }
+  uint max_supported_key_parts()     const { return 1; }
 
   /** @brief
     unireg.cc will call this to make sure that the storage engine can handle
     the data it is about to send. Return *real* limits of your storage engine
     here; MySQL will do min(your_limits, MySQL_limits) automatically.
       @details
-    There is no need to implement ..._key_... methods if your engine doesn't
-    support indexes.
+    A TIMESTAMP(6), a DATETIME(6) or a BIGINT key fits in 8 bytes.
    */
-  uint max_supported_key_length()    const { return 0; }
+  uint max_supported_key_length()    const { return 8; }
 
   /** @brief
     Called in test_quick_select to determine if indexes should be used.
@@ -179,6 +361,12 @@ class ha_tsdb_engine: public handler
   */
   int delete_row(const uchar *buf);
 
+  /** @brief
+    Position the index cursor; the time key has no index structure.
+  */
+  int index_init(uint idx, bool sorted);
+  int index_end();
+
   /** @brief
     We implement this in ha_example.cc. It's not an obligatory method;
     skip it and and MySQL will treat it as not implemented.
@@ -238,25 +426,124 @@ class ha_tsdb_engine: public handler
   THR_LOCK_DATA **store_lock(THD *thd, THR_LOCK_DATA **to,
                              enum thr_lock_type lock_type);     ///< required
   
+  const Item *cond_push(const Item *cond);
+  void cond_pop();
+  int reset();
+
+  int optimize(THD* thd, HA_CHECK_OPT* check_opt);
+  bool check_if_incompatible_data(HA_CREATE_INFO *info, uint table_changes);
+
   virtual void start_bulk_insert(ha_rows rows);
   virtual int end_bulk_insert();
+  virtual bool start_bulk_delete();
+  virtual int end_bulk_delete();
 
 private:
-mysql_mutex_t fMutex;
-tsdb::Timeseries* fTMSeries;
+bool fShareUsed;   ///< counted in share->use_count, the series itself is share->series
 
 uint64 fRecordNbr;
+uint64 fRecordOrigin;   ///< share->origin when the scan started
+uint64 fAppendedNbr;    ///< share->records when the scan started, buffered records follow
 uint64 fRecordIndx;
+bool   fScanning;       ///< counted in share->scans
+Field* fTimeKey;        ///< column of the tsdb_time_key= option, NULL if rows are stamped on insert
 uint64 fCacheRecInd;
 uint64 fCacheLen;
 bool   fFirstEteration;
-tsdb::RecordSet fCacheRecords;
+tsdb_block fCacheRecords;
+
+//columns decoded by unpack_row(), see build_read_ops()
+std::vector<tsdb_read_op> fReadOps;
+
+//read-ahead of the next blocks during rnd_next() scans
+tsdb_prefetcher fPrefetcher;
+
+//row reference: record index of the last row read, see position()
+//a series table puts the series id above TSDB_SERIES_POS_SHIFT
+uint64 fCurrentPos;
+tsdb_block_cache fPosCache;
+
+//rows of a rollup companion table
+std::vector<double> fViewRows;
+uint64 fViewStart;
+uint64 fViewCount;
+
+//index cursor on the time key
+uint64 fIndexPos;
+
+//time window pushed by cond_push(), milliseconds since epoch
+longlong fPushedLow;
+longlong fPushedHigh;
 
-//debug info
-uint64 fTimeEcl;
-uint64 fRownbr;
+//equality on a tag column pushed by cond_push(), see push_tag_predicate()
+Field* fTagField;
+String fTagValue;
+bool fTagFilter;                ///< rnd_next() only reads the blocks holding fTagCodes
+std::vector<int32> fTagCodes;
+uint64 fTagBlockEnd;            ///< end of the block being read
+
+//scan of a tsdb_series= table: fRecordIndx and fRecordNbr are within fSeries
+bool fSeriesScan;
+std::vector<std::pair<uint, uint64> > fSeriesList;   ///< series to read and their records
+size_t fSeriesPos;              ///< next one in fSeriesList, see next_series()
+uint fSeries;
+//predicates on the series key pushed by cond_push(), see push_series_predicate()
+std::vector<Item*> fSeriesConds;
+
+//bulk insert buffer
+uchar* fAppendBuf;
+uint64 fAppendCount;
+uint64 fAppendCapacity;
+size_t fRecordSize;
+
+//one packed record of a single row insert
+uchar* fRowBuf;
+
+//heap values of the rows packed and not yet appended, see tsdb_row_codec::encode()
+tsdb_heap_buffer fHeapBuf;
+//heap values of the rows being read
+tsdb_heap_window fHeapWindow;
+//first or last record of the share, decoded out of the share mutex
+std::vector<uchar> fMetaRecord;
+
+//rows returned since the last flush_rows_read()
+uint64 fRowsRead;
+
+//DELETE of the first rows of the series, applied by end_bulk_delete()
+bool fBulkDelete;
+uint64 fDeleteCount;
 
 //private function
 
- int CreateTSDBStructure(Field** inFields, tsdb::Structure* *outTSDBStruct);
+ int pack_row(uchar *buf, uchar *to);
+ int append_records(uchar *records, uint64 n);
+ int flush_append_buffer();
+ int fetch_block(uint64 index);
+ int start_series_scan();
+ bool next_series();
+ int read_row(uint64 index, uchar *buf);
+ void unpack_row(const uchar *record, uchar *buf);
+ int decode_record(const uchar *record, uchar *buf);
+ int read_meta_row(uint64 index, uchar *buf);
+ int read_view_row(uint64 index, uchar *buf);
+ void flush_rows_read();
+ void start_scan();
+ void end_scan();
+ int create_file(const char *name, TABLE *table_arg);
+ void build_read_ops();
+
+ //time key helpers
+ static Field* time_field(TABLE* tbl);
+ static Field* time_key(TABLE* tbl);
+ static longlong field_timestamp(Field* field);
+ static void store_timestamp(Field* field, longlong ms);
+ static longlong time_resolution(Field* field);
+ longlong key_to_timestamp(const uchar *key);
+ int read_timestamp(uint64 index, longlong *ts);
+ int search_timestamp(longlong ts, uint64 low, uint64 high, uint64 *pos);
+ void push_time_predicate(const Item* item);
+ void push_tag_predicate(const Item* item);
+ void push_series_predicate(const Item* item);
+
+ int CreateTSDBStructure(Field** inFields, uint inNullBytes, tsdb::Structure* *outTSDBStruct);
 };
@@ -6,14 +6,81 @@
 
 #include "PCHfile.h"
 #include "ha_tsdb_engine.h"
+#include "tsdb_row_codec.h"
 
 #include "probes_mysql.h"
 #include "sql_plugin.h"
+#include "item_cmpfunc.h"
+#include "tztime.h"
 
-int ha_tsdb_engine::CreateTSDBStructure(Field** inFields, tsdb::Structure* *outTSDBStruct)
+/*
+    @function tsdb_table_option
+    @brief value of a key=value option of the table COMMENT
+    @details options are separated by blanks, ',' or ';'; keys are case
+             insensitive
+    @return true if the option is present
+*/
+bool tsdb_table_option(TABLE_SHARE* share, const char* key, std::string* value)
+{
+    return tsdb_comment_option(share->comment, key, value);
+}
+
+/*
+    @function tsdb_table_option_list
+    @brief items of a ':' separated option of the table COMMENT, e.g.
+           tsdb_tags=host:region
+    @return true if the option is present
+*/
+bool tsdb_table_option_list(TABLE_SHARE* share, const char* key, std::vector<std::string>* items)
+{
+    std::string option;
+    items->clear();
+    if ( share == NULL || !tsdb_table_option(share, key, &option) )
+        return false;
+    size_t start = 0;
+    while ( start <= option.size() )
+    {
+        size_t end = option.find(':', start);
+        if ( end == std::string::npos )
+            end = option.size();
+        if ( end > start )
+            items->push_back(option.substr(start, end - start));
+        start = end + 1;
+    }
+    return true;
+}
+
+/*
+    @function tsdb_comment_option
+    @brief tsdb_table_option() on a COMMENT not yet in a table share
+*/
+bool tsdb_comment_option(const LEX_STRING& inComment, const char* key, std::string* value)
+{
+    static const char* separators = " \t,;";
+    std::string comment(inComment.str ? inComment.str : "", inComment.length);
+    size_t keylen = strlen(key);
+    size_t pos = 0;
+
+    while ( (pos = comment.find_first_not_of(separators, pos)) != std::string::npos )
+    {
+        size_t end = comment.find_first_of(separators, pos);
+        if ( end == std::string::npos )
+            end = comment.length();
+        if ( end - pos > keylen && comment[pos + keylen] == '=' &&
+             strncasecmp(comment.c_str() + pos, key, keylen) == 0 )
+        {
+            value->assign(comment, pos + keylen + 1, end - pos - keylen - 1);
+            return true;
+        }
+        pos = end;
+    }
+    return false;
+}
+
+
+int ha_tsdb_engine::CreateTSDBStructure(Field** inFields, uint inNullBytes, tsdb::Structure* *outTSDBStruct)
 {
     int error = 0;
-        std::cerr << " Enter CreateTSDBStructure " << std::endl; 
 	std::vector<tsdb::Field*> tsfields;
 
 	/* Add the timestamp field */
@@ -32,55 +99,57 @@ int ha_tsdb_engine::CreateTSDBStructure(Field** inFields, tsdb::Structure* *outT
 			return -1;
 		}
             tsdb::Field* dbField = NULL;
-	    std::cerr << "[DEBUG] " << myfield->field_name << std::endl;
-           switch(myfield->type())
+           //keep in sync with tsdb_column_width(), the row codec relies on it
+           switch(tsdb_column_kind(myfield, TSDB_FORMAT_CURRENT))
            {
-               case MYSQL_TYPE_DECIMAL:
-               case MYSQL_TYPE_FLOAT :
-               case MYSQL_TYPE_DOUBLE:
-               case MYSQL_TYPE_NEWDECIMAL:
+               case TSDB_KIND_DOUBLE:
                  dbField = new tsdb::DoubleField(myfield->field_name);
-                 tsfields.push_back(dbField);
                  break;
-               case MYSQL_TYPE_TINY :
-               case MYSQL_TYPE_SHORT:
-               case MYSQL_TYPE_YEAR :
-               case MYSQL_TYPE_LONG :
+               case TSDB_KIND_FLOAT:
+                 dbField = new tsdb::FloatField(myfield->field_name);
+                 break;
+               case TSDB_KIND_INT8:
+                 dbField = new tsdb::Int8Field(myfield->field_name);
+                 break;
+               case TSDB_KIND_INT16:
+                 dbField = new tsdb::Int16Field(myfield->field_name);
+                 break;
+               case TSDB_KIND_INT32:
+               case TSDB_KIND_TAG:
                  dbField = new tsdb::Int32Field(myfield->field_name);
-                 tsfields.push_back(dbField);
                  break;
-               case MYSQL_TYPE_BIT :
+               case TSDB_KIND_INT64:
+                 dbField = new tsdb::Int64Field(myfield->field_name);
+                 break;
+               case TSDB_KIND_CHAR:
                  dbField = new tsdb::CharField(myfield->field_name);
-                 tsfields.push_back(dbField);
                  break;
-               case MYSQL_TYPE_DATE :
-               case MYSQL_TYPE_TIME :
-               case MYSQL_TYPE_NEWDATE :
+               case TSDB_KIND_DATE:
                  dbField = new tsdb::DateField(myfield->field_name);
-                 tsfields.push_back(dbField);
                  break;
-               case MYSQL_TYPE_TIMESTAMP:
-               case MYSQL_TYPE_DATETIME:
+               case TSDB_KIND_TIMESTAMP:
                  dbField = new tsdb::TimestampField(myfield->field_name);
-                 tsfields.push_back(dbField);
                  break;
-               case MYSQL_TYPE_VARCHAR :
-               case MYSQL_TYPE_ENUM :
-               case MYSQL_TYPE_SET:
-               case MYSQL_TYPE_VAR_STRING:
-               case MYSQL_TYPE_STRING:
-                 dbField = new tsdb::StringField(myfield->field_name,255);
-                 tsfields.push_back(dbField);
+               case TSDB_KIND_STRING:
+                 dbField = new tsdb::StringField(myfield->field_name,TSDB_STRING_WIDTH);
+                 break;
+               case TSDB_KIND_HEAP:
+                 dbField = new tsdb::StringField(myfield->field_name,TSDB_HEAP_REF_WIDTH);
+                 break;
+               case TSDB_KIND_DECIMAL:
+                 dbField = new tsdb::StringField(myfield->field_name,myfield->pack_length());
                  break;
-               case MYSQL_TYPE_LONGLONG :
-                 dbField = new tsdb::RecordField(myfield->field_name);
-                 tsfields.push_back(dbField);
-       
                default:
                  break;
            }
+           if ( dbField != NULL )
+             tsfields.push_back(dbField);
         }
     }
+
+    /* null bytes of the row are stored after the columns */
+    if ( inNullBytes > 0 )
+      tsfields.push_back(new tsdb::StringField("_TSDB_nulls",inNullBytes));
     
     tsdb::Structure* TSDBStruct = new tsdb::Structure(tsfields,false);
     *outTSDBStruct = TSDBStruct;
@@ -88,3 +157,427 @@ int ha_tsdb_engine::CreateTSDBStructure(Field** inFields, tsdb::Structure* *outT
 }
 
 
+//columns that can hold a _TSDB_timestamp
+static bool is_time_column(Field* field)
+{
+    switch (field->type())
+    {
+        case MYSQL_TYPE_TIMESTAMP:
+        case MYSQL_TYPE_DATETIME:
+        case MYSQL_TYPE_LONGLONG:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+    @function ha_tsdb_engine::time_field
+    @brief the indexed column; records are in _TSDB_timestamp order, so
+           only the tsdb_time_key= column, which holds it, can be indexed
+    @return the field or NULL when the table has no index on its time key
+*/
+Field* ha_tsdb_engine::time_field(TABLE* tbl)
+{
+    if ( tbl->s->keys == 0 || tbl->key_info[0].user_defined_key_parts != 1 )
+        return NULL;
+    Field* field = tbl->key_info[0].key_part[0].field;
+    return field == time_key(tbl) ? field : NULL;
+}
+
+/*
+    @function ha_tsdb_engine::time_key
+    @brief the column named by the tsdb_time_key= option; its value is the
+           _TSDB_timestamp of the row instead of the time of the insert
+    @return the field or NULL without the option or when the column is not
+            a TIMESTAMP, DATETIME or BIGINT (milliseconds since epoch)
+*/
+Field* ha_tsdb_engine::time_key(TABLE* tbl)
+{
+    std::string name;
+    if ( !tsdb_table_option(tbl->s, TSDB_OPT_TIME_KEY, &name) )
+        return NULL;
+    for ( Field** field = tbl->field; *field; field++ )
+    {
+        if ( my_strcasecmp(system_charset_info, (*field)->field_name, name.c_str()) == 0 )
+            return is_time_column(*field) ? *field : NULL;
+    }
+    return NULL;
+}
+
+/*
+    @function ha_tsdb_engine::field_timestamp
+    @brief value of a time column in milliseconds since epoch
+    @details DATETIME values are taken as UTC, like the partition windows;
+             the sub-millisecond digits of a (6) column are kept in the
+             column only
+*/
+longlong ha_tsdb_engine::field_timestamp(Field* field)
+{
+    switch (field->type())
+    {
+        case MYSQL_TYPE_TIMESTAMP:
+        {
+            struct timeval tv;
+            int warnings = 0;
+            if ( field->get_timestamp(&tv, &warnings) )
+                return 0;
+            return (longlong)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        }
+        case MYSQL_TYPE_DATETIME:
+        {
+            MYSQL_TIME ltime;
+            my_bool in_gap;
+            if ( field->get_date(&ltime, TIME_FUZZY_DATE) )
+                return 0;
+            return (longlong)my_tz_OFFSET0->TIME_to_gmt_sec(&ltime, &in_gap) * 1000 +
+                   ltime.second_part / 1000;
+        }
+        default:
+            return field->val_int();
+    }
+}
+
+/*
+    @function ha_tsdb_engine::store_timestamp
+    @brief store a _TSDB_timestamp (milliseconds since epoch) in a time column
+*/
+void ha_tsdb_engine::store_timestamp(Field* field, longlong ms)
+{
+    if ( field->type() == MYSQL_TYPE_TIMESTAMP )
+    {
+        struct timeval tv;
+        tv.tv_sec = ms / 1000;
+        tv.tv_usec = (ms % 1000) * 1000;
+        field->store_timestamp(&tv);
+    }
+    else if ( field->type() == MYSQL_TYPE_DATETIME )
+    {
+        MYSQL_TIME ltime;
+        my_tz_OFFSET0->gmt_sec_to_TIME(&ltime, (my_time_t)(ms / 1000));
+        ltime.second_part = (ms % 1000) * 1000;
+        field->store_time(&ltime);
+    }
+    else
+        field->store(ms, false);
+}
+
+/*
+    @function ha_tsdb_engine::time_resolution
+    @brief milliseconds covered by one value of a time column
+    @details a TIMESTAMP(0) or DATETIME(0) column truncates _TSDB_timestamp to the second, so
+             every record in [v, v + 1000) compares equal to v
+*/
+longlong ha_tsdb_engine::time_resolution(Field* field)
+{
+    static const longlong resolution[] = { 1000, 100, 10, 1 };
+    if ( field == NULL || field->type() == MYSQL_TYPE_LONGLONG || field->decimals() >= 3 )
+        return 1;
+    return resolution[field->decimals()];
+}
+
+/*
+    @function ha_tsdb_engine::key_to_timestamp
+    @brief decode a time key image into milliseconds since epoch
+*/
+longlong ha_tsdb_engine::key_to_timestamp(const uchar *key)
+{
+    KEY_PART_INFO* key_part = table->key_info[0].key_part;
+    Field* field = key_part->field;
+    longlong ms;
+
+    if ( key_part->null_bit )
+        key++;      //skip null indicator
+
+    //read the key image in place of the row value
+    uchar* saved_ptr = field->ptr;
+    field->ptr = const_cast<uchar*>(key);
+    ms = field_timestamp(field);
+    field->ptr = saved_ptr;
+    return ms;
+}
+
+/*
+    @function ha_tsdb_engine::read_timestamp
+    @brief _TSDB_timestamp of the record at index
+    @return mysql error code
+*/
+int ha_tsdb_engine::read_timestamp(uint64 index, longlong *ts)
+{
+    if ( !fFirstEteration && index >= fCacheRecInd && index < fCacheRecInd + fCacheLen )
+    {
+        memcpy(ts, fCacheRecords.record(index - fCacheRecInd), 8);
+        return 0;
+    }
+
+    tsdb_block one;
+    int rc = share->read_block(index, index + 1, &one);
+    if ( rc == 0 && one.count == 0 )
+        rc = HA_ERR_END_OF_FILE;
+    if ( rc == 0 )
+        memcpy(ts, one.record(0), 8);
+    return rc;
+}
+
+/*
+    @function ha_tsdb_engine::search_timestamp
+    @brief binary search of the first record whose _TSDB_timestamp >= ts
+    @params ts milliseconds since epoch, [low, high) records searched,
+            pos result in [low, high]
+    @return mysql error code
+    @details records are appended in time order; once the window fits in a
+             block, the block is loaded and the search continues in cache
+*/
+int ha_tsdb_engine::search_timestamp(longlong ts, uint64 low, uint64 high, uint64 *pos)
+{
+    int rc;
+
+    //only the partition holding the answer is opened and searched
+    mysql_mutex_lock(&share->mutex);
+    share->bracket(ts, &low, &high);
+    mysql_mutex_unlock(&share->mutex);
+
+    while ( low < high )
+    {
+        if ( high - low <= TSDB_BLOCK_RECORDS &&
+             (fFirstEteration || low < fCacheRecInd || high > fCacheRecInd + fCacheLen) )
+        {
+            if ( (rc = fetch_block(low)) )
+                return rc;
+        }
+
+        uint64 mid = low + (high - low) / 2;
+        longlong value;
+        if ( (rc = read_timestamp(mid, &value)) )
+            return rc;
+        if ( value < ts )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    *pos = low;
+    return 0;
+}
+
+/*
+    @function item_to_timestamp
+    @brief evaluate a constant item compared with the time column
+    @return false on success, true if the value can not be used
+*/
+static bool item_to_timestamp(Field* field, Item* item, longlong* ms)
+{
+    if ( !item->const_item() || item->is_expensive() )
+        return true;
+    if ( field->type() == MYSQL_TYPE_TIMESTAMP )
+    {
+        struct timeval tv;
+        int warnings = 0;
+        if ( item->get_timeval(&tv, &warnings) || item->null_value )
+            return true;
+        *ms = (longlong)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        return false;
+    }
+    if ( field->type() == MYSQL_TYPE_DATETIME )
+    {
+        //taken as UTC, like the column values, see field_timestamp()
+        MYSQL_TIME ltime;
+        my_bool in_gap;
+        if ( item->get_date(&ltime, TIME_FUZZY_DATE) || item->null_value )
+            return true;
+        *ms = (longlong)my_tz_OFFSET0->TIME_to_gmt_sec(&ltime, &in_gap) * 1000 +
+              ltime.second_part / 1000;
+        return false;
+    }
+    *ms = item->val_int();
+    return item->null_value;
+}
+
+/*
+    @function ha_tsdb_engine::push_time_predicate
+    @brief narrow [fPushedLow, fPushedHigh] with a predicate on the time column
+    @details the time column is the tsdb_time_key= one, it holds the
+             _TSDB_timestamp of the row. Only comparisons of the time
+             column with constants, BETWEEN and AND of those are
+             understood, anything else is left to the server. Bounds are
+             widened to the column resolution so the window never excludes
+             a matching record.
+*/
+void ha_tsdb_engine::push_time_predicate(const Item* item)
+{
+    Field* tfield = fTimeKey;
+    if ( tfield == NULL )
+        return;
+
+    if ( item->type() == Item::COND_ITEM )
+    {
+        Item_cond* cond = const_cast<Item_cond*>(static_cast<const Item_cond*>(item));
+        if ( cond->functype() != Item_func::COND_AND_FUNC )
+            return;
+        List_iterator<Item> li(*cond->argument_list());
+        Item* arg;
+        while ( (arg = li++) )
+            push_time_predicate(arg);
+        return;
+    }
+    if ( item->type() != Item::FUNC_ITEM )
+        return;
+
+    const Item_func* func = static_cast<const Item_func*>(item);
+    Item** args = func->arguments();
+    Item_func::Functype op = func->functype();
+    longlong low, high;
+    longlong resolution = time_resolution(tfield);
+
+    switch (op)
+    {
+        case Item_func::BETWEEN:
+            if ( static_cast<const Item_func_between*>(func)->negated ||
+                 args[0]->type() != Item::FIELD_ITEM ||
+                 static_cast<Item_field*>(args[0])->field != tfield ||
+                 item_to_timestamp(tfield, args[1], &low) ||
+                 item_to_timestamp(tfield, args[2], &high) )
+                return;
+            break;
+        case Item_func::EQ_FUNC:
+        case Item_func::LT_FUNC:
+        case Item_func::LE_FUNC:
+        case Item_func::GT_FUNC:
+        case Item_func::GE_FUNC:
+        {
+            Item* value;
+            if ( args[0]->type() == Item::FIELD_ITEM &&
+                 static_cast<Item_field*>(args[0])->field == tfield )
+                value = args[1];
+            else if ( args[1]->type() == Item::FIELD_ITEM &&
+                      static_cast<Item_field*>(args[1])->field == tfield )
+            {
+                //constant on the left: swap the comparison
+                value = args[0];
+                if ( op == Item_func::LT_FUNC ) op = Item_func::GT_FUNC;
+                else if ( op == Item_func::LE_FUNC ) op = Item_func::GE_FUNC;
+                else if ( op == Item_func::GT_FUNC ) op = Item_func::LT_FUNC;
+                else if ( op == Item_func::GE_FUNC ) op = Item_func::LE_FUNC;
+            }
+            else
+                return;
+            if ( item_to_timestamp(tfield, value, &low) )
+                return;
+            high = low;
+            if ( op == Item_func::LT_FUNC || op == Item_func::LE_FUNC )
+                low = LLONG_MIN;
+            else if ( op == Item_func::GT_FUNC || op == Item_func::GE_FUNC )
+                high = LLONG_MAX;
+            break;
+        }
+        default:
+            return;
+    }
+
+    if ( high != LLONG_MAX )
+        high += resolution - 1;
+    if ( low > fPushedLow )
+        fPushedLow = low;
+    if ( high < fPushedHigh )
+        fPushedHigh = high;
+}
+
+/*
+    @function ha_tsdb_engine::push_tag_predicate
+    @brief remember an equality of a tag column with a constant string
+    @details the first one found in the AND is used; rnd_init() turns the
+             value into the codes it matches in the collation of the column
+*/
+void ha_tsdb_engine::push_tag_predicate(const Item* item)
+{
+    if ( fTagField != NULL )
+        return;
+    if ( item->type() == Item::COND_ITEM )
+    {
+        Item_cond* cond = const_cast<Item_cond*>(static_cast<const Item_cond*>(item));
+        if ( cond->functype() != Item_func::COND_AND_FUNC )
+            return;
+        List_iterator<Item> li(*cond->argument_list());
+        Item* arg;
+        while ( (arg = li++) )
+            push_tag_predicate(arg);
+        return;
+    }
+    if ( item->type() != Item::FUNC_ITEM )
+        return;
+
+    const Item_func* func = static_cast<const Item_func*>(item);
+    if ( func->functype() != Item_func::EQ_FUNC )
+        return;
+    Item** args = func->arguments();
+    Item* column = args[0];
+    Item* value = args[1];
+    if ( column->type() != Item::FIELD_ITEM )
+        std::swap(column, value);
+    if ( column->type() != Item::FIELD_ITEM || !value->const_item() || value->is_expensive() )
+        return;
+
+    Field* field = static_cast<Item_field*>(column)->field;
+    if ( field->table != table || tsdb_column_kind(field, TSDB_FORMAT_CURRENT) != TSDB_KIND_TAG ||
+         const_cast<Item_func*>(func)->compare_collation() != field->charset() )
+        return;
+    char buff[TSDB_STRING_WIDTH];
+    String tmp(buff, sizeof(buff), field->charset());
+    String* str = value->val_str(&tmp);
+    if ( str == NULL || value->null_value || !my_charset_same(str->charset(), field->charset()) )
+        return;
+    fTagValue.copy(*str);
+    fTagField = field;
+}
+
+/*
+    @function ha_tsdb_engine::push_series_predicate
+    @brief remember the equalities and IN lists of a series key column with
+           constants found in the AND
+    @details start_series_scan() evaluates them on the key of each series;
+             they only read the key columns, so a series failing one of
+             them has no row the server would keep
+*/
+void ha_tsdb_engine::push_series_predicate(const Item* item)
+{
+    if ( item->type() == Item::COND_ITEM )
+    {
+        Item_cond* cond = const_cast<Item_cond*>(static_cast<const Item_cond*>(item));
+        if ( cond->functype() != Item_func::COND_AND_FUNC )
+            return;
+        List_iterator<Item> li(*cond->argument_list());
+        Item* arg;
+        while ( (arg = li++) )
+            push_series_predicate(arg);
+        return;
+    }
+    if ( item->type() != Item::FUNC_ITEM )
+        return;
+
+    Item_func* func = const_cast<Item_func*>(static_cast<const Item_func*>(item));
+    Item** args = func->arguments();
+    uint column = 0;
+    switch ( func->functype() )
+    {
+        case Item_func::EQ_FUNC:
+            if ( args[0]->type() != Item::FIELD_ITEM )
+                column = 1;
+            break;
+        case Item_func::IN_FUNC:
+            if ( static_cast<Item_func_opt_neg*>(func)->negated )
+                return;
+            break;
+        default:
+            return;
+    }
+    if ( args[column]->type() != Item::FIELD_ITEM )
+        return;
+    Field* field = static_cast<Item_field*>(args[column])->field;
+    if ( field->table != table || !share->series_set.key_column(field->field_index) )
+        return;
+    for ( uint i = 0; i < func->argument_count(); i++ )
+    {
+        if ( i != column && (!args[i]->const_item() || args[i]->is_expensive()) )
+            return;
+    }
+    fSeriesConds.push_back(func);
+}
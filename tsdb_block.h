@@ -0,0 +1,43 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_block.h
+    @brief a block of consecutive records read from the series
+*/
+#pragma once
+#include "my_global.h"
+#include "malloc_allocator.h"
+#include "tsdb_psi.h"
+#include <vector>
+
+/*
+@brief a block of consecutive records of the series
+
+When the records dataset could be located the block is one contiguous
+buffer read with a single H5Dread and records are addressed in place;
+otherwise it falls back to the tsdb::RecordSet of the library.
+*/
+struct tsdb_block
+{
+  uint64 count;                 ///< records in the block
+  size_t record_size;
+  bool direct;                  ///< records live in raw, not in records
+  std::vector<uchar, Malloc_allocator<uchar> > raw;  ///< reused across fetches, keeps its capacity
+  tsdb::RecordSet records;
+
+  tsdb_block() : count(0), record_size(0), direct(false),
+                 raw(Malloc_allocator<uchar>(tsdb_key_memory_scan_block)) {}
+
+  const uchar* record(uint64 i) const
+  {
+    return direct ? &raw[i * record_size]
+                  : (const uchar*)records[i].memoryBlockPtr().raw();
+  }
+  void swap(tsdb_block& other)
+  {
+    std::swap(count, other.count);
+    std::swap(record_size, other.record_size);
+    std::swap(direct, other.direct);
+    raw.swap(other.raw);
+    records.swap(other.records);
+  }
+};
@@ -0,0 +1,696 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_compress.cc
+    @brief records filter and layout implementation
+*/
+
+#include "PCHfile.h"
+#include "ha_tsdb_engine.h"
+#include "tsdb_compress.h"
+#include <algorithm>
+
+/*
+  Layout of a compressed chunk (integers little endian):
+    version (4), records (4)
+    per column: payload bytes (4), payload
+  Filter parameters: version, record size, columns, then
+  offset/width/encoding of every column sorted by offset.
+*/
+#define TSDB_CHUNK_HEADER 8
+#define TSDB_FILTER_PARAMS 3
+
+struct tsdb_column_layout
+{
+  uint offset;
+  uint width;
+  uint encoding;
+
+  bool operator<(const tsdb_column_layout& other) const { return offset < other.offset; }
+};
+
+//MSB first bit stream
+class bit_writer
+{
+  public:
+  bit_writer(std::vector<uchar>* inOut) : out(inOut), acc(0), nbits(0) {}
+
+  void put(uint64 v, uint n)
+  {
+    if ( n > 32 )
+    {
+      put(v >> 32, n - 32);
+      n = 32;
+    }
+    acc = (acc << n) | (v & ((1ULL << n) - 1));
+    nbits += n;
+    while ( nbits >= 8 )
+    {
+      nbits -= 8;
+      out->push_back((uchar)(acc >> nbits));
+    }
+    acc &= (1ULL << nbits) - 1;
+  }
+
+  void flush()
+  {
+    if ( nbits > 0 )
+      out->push_back((uchar)(acc << (8 - nbits)));
+    acc = 0;
+    nbits = 0;
+  }
+
+  private:
+  std::vector<uchar>* out;
+  uint64 acc;
+  uint nbits;
+};
+
+class bit_reader
+{
+  public:
+  bit_reader(const uchar* inFrom, const uchar* inEnd) : from(inFrom), end(inEnd), acc(0), nbits(0), overrun(false) {}
+
+  uint64 get(uint n)
+  {
+    uint64 high = 0;
+    if ( n > 32 )
+    {
+      high = get(n - 32) << 32;
+      n = 32;
+    }
+    while ( nbits < n )
+    {
+      if ( from < end )
+        acc = (acc << 8) | *from++;
+      else
+      {
+        acc <<= 8;
+        overrun = true;
+      }
+      nbits += 8;
+    }
+    nbits -= n;
+    uint64 v = (acc >> nbits) & ((1ULL << n) - 1);
+    acc &= (1ULL << nbits) - 1;
+    return high | v;
+  }
+
+  bool failed() const { return overrun; }
+
+  private:
+  const uchar* from;
+  const uchar* end;
+  uint64 acc;
+  uint nbits;
+  bool overrun;
+};
+
+static inline uint64 zigzag(longlong v)
+{
+  return ((uint64)v << 1) ^ (uint64)(v >> 63);
+}
+
+static inline longlong unzigzag(uint64 v)
+{
+  return (longlong)((v >> 1) ^ (0 - (v & 1)));
+}
+
+//delta-of-delta buckets: prefix, prefix bits, value bits
+static const uint dod_buckets[][3]=
+{
+  { 0x2, 2, 7 },
+  { 0x6, 3, 9 },
+  { 0xE, 4, 12 },
+  { 0xF, 4, 64 }
+};
+
+static void encode_dod(const uchar* chunk, uint n, uint rs, uint offset, std::vector<uchar>* out)
+{
+  bit_writer bits(out);
+  uint64 prev = uint8korr(chunk + offset);
+  uint64 delta = 0;
+  bits.put(prev, 64);
+  for ( uint i = 1; i < n; i++ )
+  {
+    uint64 v = uint8korr(chunk + (size_t)i * rs + offset);
+    uint64 d = v - prev;
+    if ( i == 1 )
+      bits.put(d, 64);
+    else
+    {
+      uint64 z = zigzag((longlong)(d - delta));
+      if ( z == 0 )
+        bits.put(0, 1);
+      else
+      {
+        uint b = 0;
+        while ( b < 3 && z >> dod_buckets[b][2] )
+          b++;
+        bits.put(dod_buckets[b][0], dod_buckets[b][1]);
+        bits.put(z, dod_buckets[b][2]);
+      }
+    }
+    delta = d;
+    prev = v;
+  }
+  bits.flush();
+}
+
+static bool decode_dod(bit_reader* bits, uchar* chunk, uint n, uint rs, uint offset)
+{
+  uint64 prev = bits->get(64);
+  uint64 delta = 0;
+  int8store(chunk + offset, prev);
+  for ( uint i = 1; i < n; i++ )
+  {
+    if ( i == 1 )
+      delta = bits->get(64);
+    else if ( bits->get(1) )
+    {
+      uint b = 0;
+      while ( b < 3 && bits->get(1) )
+        b++;
+      delta += (uint64)unzigzag(bits->get(dod_buckets[b][2]));
+    }
+    prev += delta;
+    int8store(chunk + (size_t)i * rs + offset, prev);
+  }
+  return !bits->failed();
+}
+
+static void encode_xor(const uchar* chunk, uint n, uint rs, uint offset, std::vector<uchar>* out)
+{
+  bit_writer bits(out);
+  uint64 prev = uint8korr(chunk + offset);
+  uint lead = 65, trail = 0;      //no window yet
+  bits.put(prev, 64);
+  for ( uint i = 1; i < n; i++ )
+  {
+    uint64 v = uint8korr(chunk + (size_t)i * rs + offset);
+    uint64 x = v ^ prev;
+    prev = v;
+    if ( x == 0 )
+    {
+      bits.put(0, 1);
+      continue;
+    }
+    uint l = __builtin_clzll(x);
+    uint t = __builtin_ctzll(x);
+    if ( l > 31 )
+      l = 31;
+    if ( lead <= 64 && l >= lead && t >= trail )
+    {
+      //meaningful bits fit in the previous window
+      bits.put(0x2, 2);
+      bits.put(x >> trail, 64 - lead - trail);
+    }
+    else
+    {
+      uint len = 64 - l - t;
+      bits.put(0x3, 2);
+      bits.put(l, 5);
+      bits.put(len - 1, 6);
+      bits.put(x >> t, len);
+      lead = l;
+      trail = t;
+    }
+  }
+  bits.flush();
+}
+
+static bool decode_xor(bit_reader* bits, uchar* chunk, uint n, uint rs, uint offset)
+{
+  uint64 prev = bits->get(64);
+  uint lead = 0, trail = 0;
+  int8store(chunk + offset, prev);
+  for ( uint i = 1; i < n; i++ )
+  {
+    if ( bits->get(1) )
+    {
+      if ( bits->get(1) )
+      {
+        lead = bits->get(5);
+        uint len = bits->get(6) + 1;
+        if ( lead + len > 64 )
+          return false;
+        trail = 64 - lead - len;
+      }
+      prev ^= bits->get(64 - lead - trail) << trail;
+    }
+    int8store(chunk + (size_t)i * rs + offset, prev);
+  }
+  return !bits->failed();
+}
+
+static void encode_for(const uchar* chunk, uint n, uint rs, uint offset, std::vector<uchar>* out)
+{
+  longlong low = sint4korr(chunk + offset), high = low;
+  for ( uint i = 1; i < n; i++ )
+  {
+    longlong v = sint4korr(chunk + (size_t)i * rs + offset);
+    low = std::min(low, v);
+    high = std::max(high, v);
+  }
+  uint64 range = (uint64)(high - low);
+  uint width = range ? 64 - __builtin_clzll(range) : 0;
+
+  bit_writer bits(out);
+  bits.put((uint32)low, 32);
+  bits.put(width, 6);
+  if ( width > 0 )
+  {
+    for ( uint i = 0; i < n; i++ )
+      bits.put((uint64)(sint4korr(chunk + (size_t)i * rs + offset) - low), width);
+  }
+  bits.flush();
+}
+
+static bool decode_for(bit_reader* bits, uchar* chunk, uint n, uint rs, uint offset)
+{
+  longlong low = (int32)bits->get(32);
+  uint width = bits->get(6);
+  if ( width > 32 )
+    return false;
+  for ( uint i = 0; i < n; i++ )
+  {
+    longlong v = low + (width ? (longlong)bits->get(width) : 0);
+    int4store(chunk + (size_t)i * rs + offset, (uint32)v);
+  }
+  return !bits->failed();
+}
+
+static void encode_trim(const uchar* chunk, uint n, uint rs, const tsdb_column_layout& col, std::vector<uchar>* out)
+{
+  for ( uint i = 0; i < n; i++ )
+  {
+    const uchar* from = chunk + (size_t)i * rs + col.offset;
+    uint len = col.width;
+    while ( len > 0 && from[len - 1] == 0 )
+      len--;
+    out->push_back((uchar)len);
+    if ( col.width > 255 )
+      out->push_back((uchar)(len >> 8));
+    out->insert(out->end(), from, from + len);
+  }
+}
+
+static bool decode_trim(const uchar* from, const uchar* end, uchar* chunk, uint n, uint rs, const tsdb_column_layout& col)
+{
+  for ( uint i = 0; i < n; i++ )
+  {
+    uchar* to = chunk + (size_t)i * rs + col.offset;
+    uint length_bytes = col.width > 255 ? 2 : 1;
+    if ( end - from < length_bytes )
+      return false;
+    uint len = length_bytes == 2 ? uint2korr(from) : *from;
+    from += length_bytes;
+    if ( len > col.width || (uint)(end - from) < len )
+      return false;
+    memcpy(to, from, len);
+    memset(to + len, 0, col.width - len);
+    from += len;
+  }
+  return true;
+}
+
+static void encode_raw(const uchar* chunk, uint n, uint rs, const tsdb_column_layout& col, std::vector<uchar>* out)
+{
+  for ( uint i = 0; i < n; i++ )
+  {
+    const uchar* from = chunk + (size_t)i * rs + col.offset;
+    out->insert(out->end(), from, from + col.width);
+  }
+}
+
+static bool decode_raw(const uchar* from, const uchar* end, uchar* chunk, uint n, uint rs, const tsdb_column_layout& col)
+{
+  if ( (size_t)(end - from) < (size_t)n * col.width )
+    return false;
+  for ( uint i = 0; i < n; i++, from += col.width )
+    memcpy(chunk + (size_t)i * rs + col.offset, from, col.width);
+  return true;
+}
+
+//column layout stored in the filter parameters, NULL if they are not ours
+static const tsdb_column_layout* filter_layout(size_t cd_nelmts, const unsigned int cd_values[], uint* columns)
+{
+  if ( cd_nelmts < TSDB_FILTER_PARAMS || cd_values[0] != TSDB_FILTER_VERSION ||
+       cd_values[1] == 0 || cd_nelmts != TSDB_FILTER_PARAMS + 3 * (size_t)cd_values[2] )
+    return NULL;
+  const tsdb_column_layout* layout = reinterpret_cast<const tsdb_column_layout*>(cd_values + TSDB_FILTER_PARAMS);
+  for ( uint c = 0; c < cd_values[2]; c++ )
+  {
+    if ( (uint64)layout[c].offset + layout[c].width > cd_values[1] )
+      return NULL;
+  }
+  *columns = cd_values[2];
+  return layout;
+}
+
+/*
+    @function tsdb_filter
+    @brief H5Z callback, encodes or decodes one chunk of the records dataset
+    @return size of the new buffer, 0 on failure
+*/
+static size_t tsdb_filter(unsigned int flags, size_t cd_nelmts, const unsigned int cd_values[],
+                          size_t nbytes, size_t *buf_size, void **buf)
+{
+  uint columns;
+  const tsdb_column_layout* layout = filter_layout(cd_nelmts, cd_values, &columns);
+  if ( layout == NULL )
+    return 0;
+  uint rs = cd_values[1];
+  const uchar* in = static_cast<const uchar*>(*buf);
+
+  if ( flags & H5Z_FLAG_REVERSE )
+  {
+    if ( nbytes < TSDB_CHUNK_HEADER || uint4korr(in) != TSDB_FILTER_VERSION )
+      return 0;
+    uint n = uint4korr(in + 4);
+    size_t size = (size_t)n * rs;
+    uchar* chunk = static_cast<uchar*>(H5allocate_memory(size, false));
+    if ( chunk == NULL )
+      return 0;
+
+    const uchar* from = in + TSDB_CHUNK_HEADER;
+    const uchar* end = in + nbytes;
+    bool ok = true;
+    for ( uint c = 0; c < columns && ok && n > 0; c++ )
+    {
+      const tsdb_column_layout& col = layout[c];
+      if ( end - from < 4 )
+      {
+        ok = false;
+        break;
+      }
+      size_t len = uint4korr(from);
+      from += 4;
+      if ( (size_t)(end - from) < len )
+      {
+        ok = false;
+        break;
+      }
+      bit_reader bits(from, from + len);
+      switch (col.encoding)
+      {
+        case TSDB_ENC_DOD:  ok = decode_dod(&bits, chunk, n, rs, col.offset); break;
+        case TSDB_ENC_XOR:  ok = decode_xor(&bits, chunk, n, rs, col.offset); break;
+        case TSDB_ENC_FOR:  ok = decode_for(&bits, chunk, n, rs, col.offset); break;
+        case TSDB_ENC_TRIM: ok = decode_trim(from, from + len, chunk, n, rs, col); break;
+        default:            ok = decode_raw(from, from + len, chunk, n, rs, col); break;
+      }
+      from += len;
+    }
+    if ( !ok )
+    {
+      H5free_memory(chunk);
+      return 0;
+    }
+    H5free_memory(*buf);
+    *buf = chunk;
+    *buf_size = size;
+    return size;
+  }
+
+  uint n = nbytes / rs;
+  if ( n == 0 || nbytes % rs )
+    return 0;
+  std::vector<uchar> out(TSDB_CHUNK_HEADER);
+  out.reserve(nbytes);
+  int4store(&out[0], TSDB_FILTER_VERSION);
+  int4store(&out[4], n);
+  for ( uint c = 0; c < columns; c++ )
+  {
+    const tsdb_column_layout& col = layout[c];
+    size_t start = out.size();
+    out.resize(start + 4);
+    switch (col.encoding)
+    {
+      case TSDB_ENC_DOD:  encode_dod(in, n, rs, col.offset, &out); break;
+      case TSDB_ENC_XOR:  encode_xor(in, n, rs, col.offset, &out); break;
+      case TSDB_ENC_FOR:  encode_for(in, n, rs, col.offset, &out); break;
+      case TSDB_ENC_TRIM: encode_trim(in, n, rs, col, &out); break;
+      default:            encode_raw(in, n, rs, col, &out); break;
+    }
+    int4store(&out[start], (uint32)(out.size() - start - 4));
+    //optional filter: HDF5 stores the chunk raw when we give up
+    if ( out.size() >= nbytes )
+      return 0;
+  }
+
+  void* chunk = H5allocate_memory(out.size(), false);
+  if ( chunk == NULL )
+    return 0;
+  memcpy(chunk, &out[0], out.size());
+  H5free_memory(*buf);
+  *buf = chunk;
+  *buf_size = out.size();
+  return out.size();
+}
+
+static const H5Z_class2_t tsdb_filter_class=
+{
+  H5Z_CLASS_T_VERS,
+  (H5Z_filter_t)TSDB_FILTER_ID,
+  1, 1,                           //encoder and decoder present
+  "tsdb_engine records",
+  NULL,                           //can_apply
+  NULL,                           //set_local
+  tsdb_filter
+};
+
+/*
+    @function tsdb_register_compression
+    @brief make the records filter known to HDF5, at plugin init
+*/
+bool tsdb_register_compression()
+{
+  return H5Zregister(&tsdb_filter_class) >= 0;
+}
+
+//encoding of a slot of the row codec
+static uint slot_encoding(const tsdb_codec_op& op)
+{
+  switch (op.kind)
+  {
+    case TSDB_KIND_INT64:
+    case TSDB_KIND_TIMESTAMP:
+    case TSDB_KIND_DATE:
+      return op.width == 8 ? TSDB_ENC_DOD : TSDB_ENC_RAW;
+    case TSDB_KIND_DOUBLE:
+      return op.width == 8 ? TSDB_ENC_XOR : TSDB_ENC_RAW;
+    case TSDB_KIND_INT32:
+    case TSDB_KIND_TAG:
+      return op.width == 4 ? TSDB_ENC_FOR : TSDB_ENC_RAW;
+    case TSDB_KIND_INT8:
+    case TSDB_KIND_INT16:
+    case TSDB_KIND_FLOAT:
+      return TSDB_ENC_RAW;
+    default:
+      return op.width <= 0xFFFF ? TSDB_ENC_TRIM : TSDB_ENC_RAW;
+  }
+}
+
+//H5Literate callback: name of the 1-D dataset whose type is a record
+struct records_lookup
+{
+  size_t record_size;
+  std::string name;
+};
+
+static herr_t find_records(hid_t group, const char *name, const H5L_info_t *info, void *data)
+{
+  records_lookup* lookup = static_cast<records_lookup*>(data);
+  H5O_info_t oinfo;
+  if ( H5Oget_info_by_name(group, name, &oinfo, H5P_DEFAULT) < 0 ||
+       oinfo.type != H5O_TYPE_DATASET )
+    return 0;
+  hid_t dset = H5Dopen2(group, name, H5P_DEFAULT);
+  if ( dset < 0 )
+    return 0;
+  hid_t type = H5Dget_type(dset);
+  hid_t space = H5Dget_space(dset);
+  bool match = H5Sget_simple_extent_ndims(space) == 1 &&
+               H5Tget_size(type) == lookup->record_size;
+  H5Sclose(space);
+  H5Tclose(type);
+  H5Dclose(dset);
+  if ( match )
+    lookup->name = name;
+  return match ? 1 : 0;
+}
+
+//H5Aiterate callback: copy an attribute of the old records dataset
+static herr_t copy_attribute(hid_t dset, const char *name, const H5A_info_t *info, void *data)
+{
+  hid_t target = *static_cast<hid_t*>(data);
+  hid_t attr = H5Aopen(dset, name, H5P_DEFAULT);
+  if ( attr < 0 )
+    return -1;
+  hid_t type = H5Aget_type(attr);
+  hid_t space = H5Aget_space(attr);
+  std::vector<uchar> value(info->data_size);
+  herr_t rc = -1;
+  if ( H5Aread(attr, type, value.empty() ? NULL : &value[0]) >= 0 )
+  {
+    hid_t copy = H5Acreate2(target, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+    if ( copy >= 0 )
+    {
+      rc = H5Awrite(copy, type, value.empty() ? NULL : &value[0]);
+      H5Aclose(copy);
+    }
+  }
+  H5Sclose(space);
+  H5Tclose(type);
+  H5Aclose(attr);
+  return rc < 0 ? -1 : 0;
+}
+
+//filter parameters of the records of codec
+static bool filter_params(const tsdb_row_codec& codec, size_t record_size, std::vector<unsigned int>* params)
+{
+  if ( !codec.valid )
+    return false;
+
+  //_TSDB_timestamp, the slots, then whatever is left (null bytes) raw
+  std::vector<tsdb_column_layout> layout;
+  tsdb_column_layout ts = { 0, 8, TSDB_ENC_DOD };
+  layout.push_back(ts);
+  for ( uint col = 0; col < codec.columns(); col++ )
+  {
+    const tsdb_codec_op& op = codec.op(col);
+    tsdb_column_layout slot = { op.dst, op.width, slot_encoding(op) };
+    layout.push_back(slot);
+  }
+  std::sort(layout.begin(), layout.end());
+  params->clear();
+  params->push_back(TSDB_FILTER_VERSION);
+  params->push_back((unsigned int)record_size);
+  params->push_back(0);
+  uint offset = 0;
+  for ( size_t i = 0; i <= layout.size(); i++ )
+  {
+    uint next = i < layout.size() ? layout[i].offset : (uint)record_size;
+    if ( next < offset )
+      return false;             //slots overlap
+    if ( next > offset )
+    {
+      unsigned int gap[] = { offset, next - offset, TSDB_ENC_RAW };
+      params->insert(params->end(), gap, gap + 3);
+    }
+    if ( i < layout.size() )
+    {
+      unsigned int col[] = { layout[i].offset, layout[i].width, layout[i].encoding };
+      params->insert(params->end(), col, col + 3);
+      offset = layout[i].offset + layout[i].width;
+    }
+  }
+  (*params)[2] = (params->size() - TSDB_FILTER_PARAMS) / 3;
+  return true;
+}
+
+//copy the records of from into the empty dataset to, one block at a time
+static bool copy_records(hid_t from, hid_t to, hid_t type, size_t record_size)
+{
+  hid_t space = H5Dget_space(from);
+  hsize_t extent;
+  H5Sget_simple_extent_dims(space, &extent, NULL);
+  H5Sclose(space);
+  if ( extent == 0 )
+    return true;
+  if ( H5Dset_extent(to, &extent) < 0 )
+    return false;
+
+  std::vector<uchar> buffer;
+  bool ok = true;
+  for ( hsize_t start = 0; start < extent && ok; start += TSDB_BLOCK_RECORDS )
+  {
+    hsize_t count = extent - start < TSDB_BLOCK_RECORDS ? extent - start : TSDB_BLOCK_RECORDS;
+    buffer.resize(count * record_size);
+    hid_t mspace = H5Screate_simple(1, &count, NULL);
+    hid_t fspace = H5Dget_space(from);
+    hid_t tspace = H5Dget_space(to);
+    ok = H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &start, NULL, &count, NULL) >= 0 &&
+         H5Sselect_hyperslab(tspace, H5S_SELECT_SET, &start, NULL, &count, NULL) >= 0 &&
+         H5Dread(from, type, mspace, fspace, H5P_DEFAULT, &buffer[0]) >= 0 &&
+         H5Dwrite(to, type, mspace, tspace, H5P_DEFAULT, &buffer[0]) >= 0;
+    H5Sclose(tspace);
+    H5Sclose(fspace);
+    H5Sclose(mspace);
+  }
+  return ok;
+}
+
+/*
+    @function tsdb_rebuild_records
+    @brief recreate the records dataset of file with a new chunk layout and filters
+    @details tsdb::Timeseries creates the dataset with its own layout and no
+             filter pipeline. A new dataset is built aside with the records,
+             attributes, type and extent of the old one, then takes its name,
+             so the library opens it as before. Used right after the creation
+             and by OPTIMIZE TABLE; the caller reopens the series afterwards.
+    @return mysql error code
+*/
+int tsdb_rebuild_records(hid_t file, size_t record_size, const tsdb_records_layout& layout)
+{
+  std::vector<unsigned int> params;
+  if ( layout.codec != NULL && !filter_params(*layout.codec, record_size, &params) )
+    return HA_ERR_UNSUPPORTED;
+
+  records_lookup lookup;
+  lookup.record_size = record_size;
+  hid_t group = H5Gopen2(file, "tsdb", H5P_DEFAULT);
+  if ( group < 0 )
+    return HA_ERR_INTERNAL_ERROR;
+  hsize_t idx = 0;
+  H5Literate(group, H5_INDEX_NAME, H5_ITER_NATIVE, &idx, find_records, &lookup);
+  if ( lookup.name.empty() )
+  {
+    H5Gclose(group);
+    return HA_ERR_INTERNAL_ERROR;
+  }
+
+  int rc = HA_ERR_INTERNAL_ERROR;
+  hid_t old = H5Dopen2(group, lookup.name.c_str(), H5P_DEFAULT);
+  hid_t type = H5Dget_type(old);
+  hid_t dcpl = H5Dget_create_plist(old);
+  hsize_t chunk = TSDB_BLOCK_RECORDS;
+  if ( H5Pget_layout(dcpl) == H5D_CHUNKED )
+    H5Pget_chunk(dcpl, 1, &chunk);
+  if ( layout.chunk_records > 0 )
+    chunk = layout.chunk_records;
+  //the pipeline is rebuilt from scratch: records filter, then deflate
+  H5Premove_filter(dcpl, H5Z_FILTER_ALL);
+  bool ok = H5Pset_chunk(dcpl, 1, &chunk) >= 0;
+  if ( ok && !params.empty() )
+    ok = H5Pset_filter(dcpl, TSDB_FILTER_ID, H5Z_FLAG_OPTIONAL, params.size(), &params[0]) >= 0;
+  if ( ok && layout.deflate > 0 )
+    ok = H5Pset_deflate(dcpl, layout.deflate) >= 0;
+  if ( ok )
+  {
+    hsize_t empty = 0, unlimited = H5S_UNLIMITED;
+    hid_t aside = H5Screate_simple(1, &empty, &unlimited);
+    hid_t dset = H5Dcreate_anon(group, type, aside, dcpl, H5P_DEFAULT);
+    H5Sclose(aside);
+    if ( dset >= 0 )
+    {
+      hsize_t aidx = 0;
+      if ( copy_records(old, dset, type, record_size) &&
+           H5Aiterate2(old, H5_INDEX_NAME, H5_ITER_NATIVE, &aidx, copy_attribute, &dset) >= 0 )
+      {
+        H5Dclose(old);
+        old = -1;
+        if ( H5Ldelete(group, lookup.name.c_str(), H5P_DEFAULT) >= 0 &&
+             H5Olink(dset, group, lookup.name.c_str(), H5P_DEFAULT, H5P_DEFAULT) >= 0 )
+          rc = 0;
+      }
+      H5Dclose(dset);
+    }
+  }
+  H5Pclose(dcpl);
+  H5Tclose(type);
+  if ( old >= 0 )
+    H5Dclose(old);
+  H5Gclose(group);
+  return rc;
+}
@@ -0,0 +1,49 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_compress.h
+    @brief column wise HDF5 filter and chunk layout of the records dataset
+*/
+#pragma once
+#include "my_global.h"
+
+class tsdb_row_codec;
+
+/*
+  Filter id of the records codec. 256-511 are left by the HDF5 group for
+  filters that are not distributed outside of an application.
+*/
+#define TSDB_FILTER_ID 310
+#define TSDB_FILTER_VERSION 1
+
+//encoding of one column of a chunk
+enum tsdb_column_encoding
+{
+  TSDB_ENC_RAW,               ///< values copied as is
+  TSDB_ENC_DOD,               ///< int64, delta-of-delta with variable bit buckets
+  TSDB_ENC_XOR,               ///< double, XOR with the previous value
+  TSDB_ENC_FOR,               ///< int32, frame of reference + bit packing
+  TSDB_ENC_TRIM               ///< zero padded bytes, trailing zeros dropped
+};
+
+/*
+@brief chunk codec of the records dataset
+
+A chunk of N records is transposed and every column is encoded on its own:
+_TSDB_timestamp and int64 by delta-of-delta, doubles by XOR of consecutive
+values (both after Gorilla), int32 by frame of reference and bit packing,
+chars and strings with their zero padding dropped. The column layout is
+taken from the row codec when the table is created and stored in the filter
+parameters of the dataset, so the files stay readable without the table.
+The filter is optional: a chunk that does not shrink is stored raw.
+*/
+bool tsdb_register_compression();
+
+//storage layout of the records dataset, see tsdb_rebuild_records()
+struct tsdb_records_layout
+{
+  ulonglong chunk_records;      ///< records per chunk, 0 keeps the current size
+  uint deflate;                 ///< gzip level after the records filter, 0 for none
+  const tsdb_row_codec* codec;  ///< columns of the records filter, NULL for none
+};
+
+int tsdb_rebuild_records(hid_t file, size_t record_size, const tsdb_records_layout& layout);
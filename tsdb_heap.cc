@@ -0,0 +1,189 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_heap.cc
+    @brief tsdb_heap and tsdb_heap_window implementation
+*/
+
+#include "PCHfile.h"
+#include "ha_tsdb_engine.h"
+#include "log.h"
+#include "tsdb_heap.h"
+
+
+//ctor
+tsdb_heap::tsdb_heap()
+{
+  dset = -1;
+  length = 0;
+}
+
+//dtor
+tsdb_heap::~tsdb_heap()
+{
+  close();
+}
+
+/*
+    @function tsdb_heap::open
+    @brief open or create the heap dataset of a .tsdb file
+    @return mysql error code
+*/
+int tsdb_heap::open(hid_t file)
+{
+  hsize_t dims[1] = { 0 };
+  if ( dset >= 0 )
+    return 0;
+  if ( H5Lexists(file, TSDB_HEAP_DATASET, H5P_DEFAULT) > 0 )
+  {
+    dset = H5Dopen2(file, TSDB_HEAP_DATASET, H5P_DEFAULT);
+    if ( dset < 0 )
+      return HA_ERR_INTERNAL_ERROR;
+    hid_t space = H5Dget_space(dset);
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    H5Sclose(space);
+  }
+  else
+  {
+    hsize_t maxdims[1] = { H5S_UNLIMITED };
+    hsize_t chunk[1] = { TSDB_HEAP_CHUNK };
+    hid_t space = H5Screate_simple(1, dims, maxdims);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl, 1, chunk);
+    dset = H5Dcreate2(file, TSDB_HEAP_DATASET, H5T_NATIVE_UCHAR, space,
+                      H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    H5Pclose(dcpl);
+    H5Sclose(space);
+    if ( dset < 0 )
+      return HA_ERR_INTERNAL_ERROR;
+  }
+  length = dims[0];
+  return 0;
+}
+
+/*
+    @function tsdb_heap::close
+    @brief release the dataset, before the file is closed
+*/
+void tsdb_heap::close()
+{
+  if ( dset >= 0 )
+    H5Dclose(dset);
+  dset = -1;
+  length = 0;
+}
+
+/*
+    @function tsdb_heap::append
+    @brief append n bytes to the heap
+    @params offset set to the heap offset of the first byte
+    @return mysql error code
+*/
+int tsdb_heap::append(const uchar* bytes, size_t n, uint64* offset)
+{
+  *offset = length;
+  if ( n == 0 )
+    return 0;
+  hsize_t dims[1] = { length + n };
+  hsize_t start[1] = { length };
+  hsize_t count[1] = { n };
+  herr_t err = H5Dset_extent(dset, dims);
+  hid_t space = H5Dget_space(dset);
+  hid_t mspace = H5Screate_simple(1, count, NULL);
+  if ( err >= 0 )
+    err = H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+  if ( err >= 0 )
+    err = H5Dwrite(dset, H5T_NATIVE_UCHAR, mspace, space, H5P_DEFAULT, bytes);
+  H5Sclose(mspace);
+  H5Sclose(space);
+  if ( err < 0 )
+  {
+    sql_print_error("tsdb_engine: cannot append %llu bytes to the heap", (ulonglong)n);
+    return HA_ERR_INTERNAL_ERROR;
+  }
+  length += n;
+  return 0;
+}
+
+/*
+    @function tsdb_heap::read
+    @brief read the heap bytes [offset, offset + n)
+    @return mysql error code
+*/
+int tsdb_heap::read(uint64 offset, size_t n, uchar* to)
+{
+  if ( n == 0 )
+    return 0;
+  if ( offset + n > length )
+    return HA_ERR_CRASHED_ON_USAGE;
+  hsize_t start[1] = { offset };
+  hsize_t count[1] = { n };
+  hid_t space = H5Dget_space(dset);
+  hid_t mspace = H5Screate_simple(1, count, NULL);
+  herr_t err = H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+  if ( err >= 0 )
+    err = H5Dread(dset, H5T_NATIVE_UCHAR, mspace, space, H5P_DEFAULT, to);
+  H5Sclose(mspace);
+  H5Sclose(space);
+  return err < 0 ? HA_ERR_INTERNAL_ERROR : 0;
+}
+
+
+//tsdb_heap_window impl
+
+//ctor
+tsdb_heap_window::tsdb_heap_window()
+  : bytes(Malloc_allocator<uchar>(tsdb_key_memory_heap))
+{
+  start = 0;
+}
+
+/*
+    @function tsdb_heap_window::cover
+    @brief make the heap bytes [from, to) readable with at()
+    @details the window is read from from, up to TSDB_HEAP_WINDOW bytes
+             or the end of the heap
+    @return mysql error code
+*/
+int tsdb_heap_window::cover(tsdb_engine_share* share, uint64 from, uint64 to)
+{
+  if ( from >= to || (from >= start && to <= start + bytes.size()) )
+    return 0;
+  mysql_mutex_lock(&share->mutex);
+  uint64 end = from + TSDB_HEAP_WINDOW;
+  if ( end > share->heap.size() )
+    end = share->heap.size();
+  if ( end < to )
+    end = to;
+  bytes.resize(end - from);
+  int rc = share->heap.read(from, end - from, &bytes[0]);
+  mysql_mutex_unlock(&share->mutex);
+  if ( rc )
+  {
+    sql_print_error("tsdb_engine: cannot read the heap at %llu", (ulonglong)from);
+    clear();
+    return rc;
+  }
+  start = from;
+  return 0;
+}
+
+/*
+    @function tsdb_heap_window::at
+    @brief the value at offset, NULL if the window does not hold it
+*/
+const uchar* tsdb_heap_window::at(uint64 offset, uint32 n) const
+{
+  if ( offset < start || offset + n > start + bytes.size() || bytes.empty() )
+    return NULL;
+  return &bytes[offset - start];
+}
+
+/*
+    @function tsdb_heap_window::clear
+    @brief forget the window, the table is closed or truncated
+*/
+void tsdb_heap_window::clear()
+{
+  bytes.clear();
+  start = 0;
+}
@@ -0,0 +1,71 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_heap.h
+    @brief variable length values kept out of the records
+*/
+#pragma once
+#include "my_global.h"
+#include "malloc_allocator.h"
+#include <vector>
+
+class tsdb_engine_share;
+
+//1-D dataset of bytes of the .tsdb file holding the values
+#define TSDB_HEAP_DATASET "/tsdb_heap"
+//bytes per chunk of the heap dataset
+#define TSDB_HEAP_CHUNK (64*1024)
+//bytes read at once by tsdb_heap_window, the values of the next rows come with them
+#define TSDB_HEAP_WINDOW (1024*1024)
+
+//values of the rows being packed, referenced from the start of the buffer
+typedef std::vector<uchar, Malloc_allocator<uchar> > tsdb_heap_buffer;
+
+/*
+@brief tsdb_heap appends the long values of a series to one dataset
+
+Records keep a TSDB_HEAP_REF_WIDTH reference, offset and length, so they
+stay fixed width. The values of an insert are appended before its records
+are logged, the references are then moved by the offset they got, see
+tsdb_row_codec::rebase(). The heap only grows: values of expired records
+stay until the table is rebuilt. All calls are made under the share mutex.
+*/
+class tsdb_heap
+{
+  public:
+  tsdb_heap();
+  ~tsdb_heap();
+
+  int  open(hid_t file);
+  void close();
+  bool is_open() const { return dset >= 0; }
+  uint64 size() const { return length; }
+
+  int  append(const uchar* bytes, size_t n, uint64* offset);
+  int  read(uint64 offset, size_t n, uchar* to);
+
+  private:
+  hid_t dset;
+  uint64 length;              ///< bytes in the dataset
+};
+
+/*
+@brief the bytes of the heap a handler reads its values from
+
+A row only needs the values of the columns in read_set; the window is
+moved to cover them, reading TSDB_HEAP_WINDOW bytes at least so that a
+scan reads the heap forward in large pieces. Decoded BLOB columns point
+into the window: they stay valid until the next row is read.
+*/
+class tsdb_heap_window
+{
+  public:
+  tsdb_heap_window();
+
+  int  cover(tsdb_engine_share* share, uint64 from, uint64 to);
+  const uchar* at(uint64 offset, uint32 length) const;
+  void clear();
+
+  private:
+  uint64 start;
+  tsdb_heap_buffer bytes;
+};
@@ -0,0 +1,725 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_partition.cc
+    @brief tsdb_partitions implementation
+*/
+
+#include "PCHfile.h"
+#include "ha_tsdb_engine.h"
+#include "tsdb_partition.h"
+#include "log.h"
+#include "my_dir.h"
+#include <algorithm>
+#include <time.h>
+
+
+#define TSDB_HOUR_MS (3600 * 1000LL)
+#define TSDB_DAY_MS  (24 * TSDB_HOUR_MS)
+#define TSDB_WEEK_MS (7 * TSDB_DAY_MS)
+//1970-01-01 was a thursday, weeks are counted from monday 1969-12-29
+#define TSDB_FIRST_MONDAY_MS (-3 * TSDB_DAY_MS)
+
+//values of a catalog row
+#define TSDB_CATALOG_COLUMNS 4
+
+/*
+    @function tsdb_partition_parse
+    @brief value of the tsdb_partition= table option
+    @return false if the text is not a known width
+*/
+bool tsdb_partition_parse(const char* text, uint* width)
+{
+  if ( strcasecmp(text, "hour") == 0 )
+    *width = TSDB_PARTITION_HOUR;
+  else if ( strcasecmp(text, "day") == 0 )
+    *width = TSDB_PARTITION_DAY;
+  else if ( strcasecmp(text, "week") == 0 )
+    *width = TSDB_PARTITION_WEEK;
+  else if ( strcasecmp(text, "none") == 0 )
+    *width = TSDB_PARTITION_NONE;
+  else
+    return false;
+  return true;
+}
+
+//length of a window in milliseconds
+static longlong window_length(uint width)
+{
+  switch (width)
+  {
+    case TSDB_PARTITION_HOUR: return TSDB_HOUR_MS;
+    case TSDB_PARTITION_DAY:  return TSDB_DAY_MS;
+    case TSDB_PARTITION_WEEK: return TSDB_WEEK_MS;
+    default:                  return LLONG_MAX;
+  }
+}
+
+/*
+    @function tsdb_partition_start
+    @brief start of the window holding ts, UTC
+*/
+longlong tsdb_partition_start(uint width, longlong ts)
+{
+  longlong length = window_length(width);
+  longlong origin = width == TSDB_PARTITION_WEEK ? TSDB_FIRST_MONDAY_MS : 0;
+  if ( length == LLONG_MAX )
+    return LLONG_MIN;
+  longlong n = (ts - origin) / length;
+  if ( (ts - origin) % length < 0 )
+    n--;
+  return origin + n * length;
+}
+
+//partition file name: window start as YYYYMMDDHH.tsdb, UTC
+static std::string partition_name(longlong start)
+{
+  char name[32];
+  time_t sec = (time_t)(start / 1000);
+  struct tm tm;
+  gmtime_r(&sec, &tm);
+  snprintf(name, sizeof(name), "%04d%02d%02d%02d.tsdb",
+           tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour);
+  return name;
+}
+
+//window start of a partition file name, false if it is not one
+static bool partition_start(const char* name, longlong* start)
+{
+  struct tm tm;
+  char tail[8];
+  memset(&tm, 0, sizeof(tm));
+  if ( strlen(name) != 15 ||
+       sscanf(name, "%4d%2d%2d%2d%7s", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+              &tm.tm_hour, tail) != 5 ||
+       strcmp(tail, ".tsdb") != 0 )
+    return false;
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  *start = (longlong)timegm(&tm) * 1000;
+  return true;
+}
+
+static bool by_start(const tsdb_partition& a, const tsdb_partition& b)
+{
+  return a.start < b.start;
+}
+
+
+//entry of a directory listing that is not a file of it
+static bool dot_entry(const char* name)
+{
+  return strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+}
+
+/*
+    @function tsdb_partition_files
+    @brief files in the partition directory of a .tsdb file
+    @return -1 if there is no such directory
+*/
+int tsdb_partition_files(const char* filename)
+{
+  std::string dir = std::string(filename) + TSDB_PARTITION_DIR;
+  MY_DIR* entries = my_dir(dir.c_str(), MYF(0));
+  if ( entries == NULL )
+    return -1;
+  int files = 0;
+  for ( uint i = 0; i < entries->number_off_files; i++ )
+  {
+    if ( !dot_entry(entries->dir_entry[i].name) )
+      files++;
+  }
+  my_dirend(entries);
+  return files;
+}
+
+/*
+    @function tsdb_partition_remove
+    @brief remove the partition directory of a .tsdb file with its files,
+           when the table is dropped
+    @return 0, or the errno of the first file or directory left behind
+*/
+int tsdb_partition_remove(const char* filename)
+{
+  int rc = 0;
+  std::string dir = std::string(filename) + TSDB_PARTITION_DIR;
+  MY_DIR* entries = my_dir(dir.c_str(), MYF(0));
+  if ( entries == NULL )
+    return 0;
+  for ( uint i = 0; i < entries->number_off_files; i++ )
+  {
+    const char* name = entries->dir_entry[i].name;
+    if ( dot_entry(name) )
+      continue;
+    std::string file = dir + "/" + name;
+    if ( my_delete(file.c_str(), MYF(0)) && rc == 0 )
+      rc = my_errno();
+  }
+  my_dirend(entries);
+  if ( rc == 0 && rmdir(dir.c_str()) )
+    rc = errno;
+  return rc;
+}
+
+
+//tsdb_partition impl
+
+//ctor
+tsdb_partition::tsdb_partition(longlong window)
+{
+  start = window;
+  base = 0;
+  records = 0;
+  first_ts = last_ts = 0;
+  file_id = -1;
+  psi_file = NULL;
+  series = NULL;
+  records_id = -1;
+  records_type = -1;
+}
+
+
+//tsdb_partitions impl
+
+//ctor
+tsdb_partitions::tsdb_partitions()
+{
+  share = NULL;
+  width = TSDB_PARTITION_NONE;
+  fapl = -1;
+  dropped = 0;
+  head = LLONG_MIN;
+  chunk_records = 0;
+  deflate = 0;
+  compress = false;
+}
+
+//dtor
+tsdb_partitions::~tsdb_partitions()
+{
+  close();
+}
+
+/*
+    @function tsdb_partitions::open
+    @brief find the partitions of the series, open the last one for appends
+    @details partitions are the files of the directory; sealed ones listed
+             in the catalog of the main file are left closed, the others
+             are opened once to read their count and time range. Files left
+             by a drop() that did not complete are removed.
+    @params filename the main .tsdb file, already opened by the share
+    @return mysql error code
+*/
+int tsdb_partitions::open(tsdb_engine_share* owner, const char* filename,
+                          const tsdb_storage_options& options)
+{
+  int rc = 0;
+  bool stale = false;
+  std::vector<longlong> catalog;
+  share = owner;
+  width = options.partition;
+  if ( !active() )
+    return 0;
+  dir = std::string(filename) + TSDB_PARTITION_DIR;
+  fapl = tsdb_file_access(options);
+  chunk_records = options.chunk_records;
+  deflate = options.deflate;
+  compress = options.compress;
+
+  if ( H5Lexists(share->file_id, TSDB_PARTITION_CATALOG, H5P_DEFAULT) > 0 )
+  {
+    hsize_t dims[2] = { 0, 0 };
+    if ( H5LTget_dataset_info(share->file_id, TSDB_PARTITION_CATALOG, dims, NULL, NULL) >= 0 &&
+         dims[1] == TSDB_CATALOG_COLUMNS && dims[0] > 0 )
+    {
+      catalog.resize(dims[0] * TSDB_CATALOG_COLUMNS);
+      if ( H5LTread_dataset(share->file_id, TSDB_PARTITION_CATALOG,
+                            H5T_NATIVE_LLONG, &catalog[0]) < 0 )
+        catalog.clear();
+    }
+  }
+  if ( H5Aexists_by_name(share->file_id, "/", TSDB_PARTITION_HEAD, H5P_DEFAULT) > 0 )
+  {
+    long long saved[2];
+    if ( H5LTget_attribute_long_long(share->file_id, "/", TSDB_PARTITION_HEAD, saved) >= 0 )
+    {
+      dropped = saved[0];
+      head = saved[1];
+    }
+  }
+
+  MY_DIR* entries = my_dir(dir.c_str(), MYF(0));
+  if ( entries == NULL )
+  {
+    //a table created before the option was set: start with no partition
+    if ( my_mkdir(dir.c_str(), 0777, MYF(0)) )
+    {
+      sql_print_error("tsdb_engine: cannot create the partition directory '%s'", dir.c_str());
+      return HA_ERR_INTERNAL_ERROR;
+    }
+    return 0;
+  }
+  for ( uint i = 0; i < entries->number_off_files; i++ )
+  {
+    longlong start;
+    if ( !partition_start(entries->dir_entry[i].name, &start) )
+      continue;
+    if ( start < head )
+      my_delete(path(start).c_str(), MYF(0));
+    else
+      parts.push_back(tsdb_partition(start));
+  }
+  my_dirend(entries);
+  std::sort(parts.begin(), parts.end(), by_start);
+
+  for ( uint i = 0; i < parts.size() && rc == 0; i++ )
+  {
+    tsdb_partition& part = parts[i];
+    bool last = i + 1 == parts.size();
+    part.base = i == 0 ? dropped : parts[i - 1].base + parts[i - 1].records;
+    bool known = false;
+    for ( size_t row = 0; !last && row < catalog.size(); row += TSDB_CATALOG_COLUMNS )
+    {
+      if ( catalog[row] == part.start )
+      {
+        part.records = catalog[row + 1];
+        part.first_ts = catalog[row + 2];
+        part.last_ts = catalog[row + 3];
+        known = true;
+        break;
+      }
+    }
+    if ( !known )
+    {
+      rc = load(&part, last);
+      stale = stale || !last;
+    }
+  }
+  if ( rc == 0 && stale )
+    save_catalog();
+  return rc;
+}
+
+/*
+    @function tsdb_partitions::close
+    @brief close the partition files, the catalog is kept up to date as
+           partitions are sealed
+*/
+void tsdb_partitions::close()
+{
+  for ( uint i = 0; i < parts.size(); i++ )
+    close_file(&parts[i]);
+  parts.clear();
+  if ( fapl >= 0 )
+    H5Pclose(fapl);
+  fapl = -1;
+  width = TSDB_PARTITION_NONE;
+  dropped = 0;
+  head = LLONG_MIN;
+}
+
+uint64 tsdb_partitions::records() const
+{
+  return parts.empty() ? dropped : parts.back().base + parts.back().records;
+}
+
+std::string tsdb_partitions::path(longlong start) const
+{
+  return dir + "/" + partition_name(start);
+}
+
+/*
+    @function tsdb_partitions::open_file
+    @brief open a partition: read-only when sealed, with its Timeseries when
+           it is the one appended to
+    @return mysql error code
+*/
+int tsdb_partitions::open_file(tsdb_partition* part, bool writable)
+{
+  if ( part->file_id >= 0 )
+    return 0;
+  std::string filename = path(part->start);
+  tsdb_file_wait wait(PSI_FILE_OPEN, filename.c_str(), __FILE__, __LINE__);
+  part->file_id = H5Fopen(filename.c_str(), writable ? H5F_ACC_RDWR : H5F_ACC_RDONLY, fapl);
+  part->psi_file = wait.opened(part->file_id >= 0);
+  if ( part->file_id < 0 )
+  {
+    sql_print_error("tsdb_engine: cannot open the partition '%s'", filename.c_str());
+    return HA_ERR_CRASHED_ON_USAGE;
+  }
+  if ( writable )
+  {
+    try{
+      part->series = new tsdb::Timeseries(part->file_id,"tsdb");
+    }catch(...)
+    {
+      part->series = NULL;
+    }
+  }
+  if ( (writable && part->series == NULL) ||
+       !tsdb_locate_records(part->file_id, share->record_size,
+                            &part->records_id, &part->records_type) )
+  {
+    sql_print_error("tsdb_engine: no records dataset in partition '%s'", filename.c_str());
+    close_file(part);
+    return HA_ERR_CRASHED_ON_USAGE;
+  }
+  return 0;
+}
+
+void tsdb_partitions::close_file(tsdb_partition* part)
+{
+  if ( part->records_type >= 0 )
+    H5Tclose(part->records_type);
+  if ( part->records_id >= 0 )
+    H5Dclose(part->records_id);
+  part->records_type = part->records_id = -1;
+  delete part->series;
+  part->series = NULL;
+  if ( part->file_id >= 0 )
+  {
+    tsdb_file_wait wait(PSI_FILE_CLOSE, part->psi_file, 0, __FILE__, __LINE__);
+    H5Fclose(part->file_id);
+    wait.closed();
+  }
+  part->file_id = -1;
+  part->psi_file = NULL;
+}
+
+/*
+    @function tsdb_partitions::read
+    @brief read the records [from, to) of one partition, indexes relative to it
+    @return mysql error code
+*/
+int tsdb_partitions::read(tsdb_partition* part, uint64 from, uint64 to, uchar* buf)
+{
+  int rc = 0;
+  hsize_t start = from, count = to - from;
+  tsdb_file_wait wait(PSI_FILE_READ, part->psi_file, count * share->record_size, __FILE__, __LINE__);
+  hid_t space = H5Dget_space(part->records_id);
+  hid_t mspace = H5Screate_simple(1, &count, NULL);
+  if ( H5Sselect_hyperslab(space, H5S_SELECT_SET, &start, NULL, &count, NULL) < 0 ||
+       H5Dread(part->records_id, part->records_type, mspace, space, H5P_DEFAULT, buf) < 0 )
+    rc = HA_ERR_INTERNAL_ERROR;
+  H5Sclose(mspace);
+  H5Sclose(space);
+  wait.end(rc ? 0 : count * share->record_size);
+  return rc;
+}
+
+/*
+    @function tsdb_partitions::load
+    @brief open a partition that is not in the catalog and read its metadata
+    @return mysql error code
+*/
+int tsdb_partitions::load(tsdb_partition* part, bool writable)
+{
+  int rc = open_file(part, writable);
+  if ( rc )
+    return rc;
+  if ( part->series != NULL )
+    part->records = part->series->getNRecords();
+  else
+  {
+    hid_t space = H5Dget_space(part->records_id);
+    hsize_t extent;
+    H5Sget_simple_extent_dims(space, &extent, NULL);
+    H5Sclose(space);
+    part->records = extent;
+  }
+  part->first_ts = part->last_ts = 0;
+  if ( part->records == 0 )
+    return 0;
+  std::vector<uchar> record(share->record_size);
+  if ( (rc = read(part, 0, 1, &record[0])) == 0 )
+    memcpy(&part->first_ts, &record[0], 8);
+  if ( rc == 0 && (rc = read(part, part->records - 1, part->records, &record[0])) == 0 )
+    memcpy(&part->last_ts, &record[0], 8);
+  return rc;
+}
+
+/*
+    @function tsdb_partitions::fetch
+    @brief read the records [from, to) of the series, across partitions
+    @params buf room for to - from records, count set to the records read
+    @return mysql error code
+*/
+int tsdb_partitions::fetch(uint64 from, uint64 to, uchar* buf, uint64* count)
+{
+  int rc = 0;
+  *count = 0;
+  //records before the first partition were dropped
+  if ( parts.empty() || from < parts.front().base )
+    return 0;
+  //last partition starting at or before from
+  uint low = 0, high = parts.size();
+  while ( high - low > 1 )
+  {
+    uint mid = (low + high) / 2;
+    if ( parts[mid].base <= from )
+      low = mid;
+    else
+      high = mid;
+  }
+  for ( uint i = low; i < parts.size() && from < to && rc == 0; i++ )
+  {
+    tsdb_partition& part = parts[i];
+    uint64 end = part.base + part.records;
+    if ( from >= end )
+      continue;
+    uint64 stop = to < end ? to : end;
+    if ( (rc = open_file(&part, i + 1 == parts.size())) == 0 &&
+         (rc = read(&part, from - part.base, stop - part.base,
+                    buf + *count * share->record_size)) == 0 )
+    {
+      *count += stop - from;
+      from = stop;
+    }
+  }
+  return rc;
+}
+
+/*
+    @function tsdb_partitions::append
+    @brief append records to the partitions of their time window
+    @details a record older than the last window, the clock went back,
+             is kept in the last partition so that the series stays ordered
+    @params done set to the records appended, even on error
+    @return mysql error code
+*/
+int tsdb_partitions::append(const uchar* records, uint64 n, uint64* done)
+{
+  int rc = 0;
+  size_t record_size = share->record_size;
+  *done = 0;
+  while ( *done < n && rc == 0 )
+  {
+    const uchar* first = records + *done * record_size;
+    longlong ts;
+    memcpy(&ts, first, 8);
+    longlong start = tsdb_partition_start(width, ts);
+    if ( start < head )
+      start = head;           //every partition was dropped, keep the order
+    if ( (parts.empty() || start > parts.back().start) && (rc = add(start)) )
+      break;
+    tsdb_partition& part = parts.back();
+    if ( (rc = open_file(&part, true)) )
+      break;
+
+    //records up to the end of the window go in one call
+    longlong end = part.start + window_length(width);
+    uint64 run = 1;
+    while ( *done + run < n )
+    {
+      memcpy(&ts, first + run * record_size, 8);
+      if ( ts >= end )
+        break;
+      run++;
+    }
+
+    tsdb_file_wait wait(PSI_FILE_WRITE, part.psi_file, run * record_size, __FILE__, __LINE__);
+    try{
+      part.series->appendRecords(run, (void*)first, true);
+    }
+    catch (tsdb::TimeseriesException& e)
+    {
+      sql_print_error("tsdb_engine: could not save %llu rows: %s", (ulonglong)run, e.what());
+      rc = HA_ERR_GENERIC;
+    }
+    wait.end(rc ? 0 : run * record_size);
+    if ( rc )
+      break;
+    if ( part.records == 0 )
+      memcpy(&part.first_ts, first, 8);
+    memcpy(&part.last_ts, first + (run - 1) * record_size, 8);
+    part.records += run;
+    *done += run;
+  }
+  return rc;
+}
+
+/*
+    @function tsdb_partitions::add
+    @brief seal the last partition and create the one of the window at start
+    @details the file gets the Timeseries of the main file and the records
+             layout of the table; the catalog is written once the previous
+             partition can not change anymore
+    @return mysql error code
+*/
+int tsdb_partitions::add(longlong start)
+{
+  std::string filename = path(start);
+  tsdb_records_layout layout = { chunk_records, deflate,
+                                 compress && share->codec.valid ? &share->codec : NULL };
+  bool valid = true;
+
+  tsdb_file_wait wait(PSI_FILE_CREATE, filename.c_str(), __FILE__, __LINE__);
+  hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_EXCL, H5P_DEFAULT, fapl);
+  PSI_file* psi_file = wait.opened(file >= 0);
+  if ( file < 0 )
+  {
+    sql_print_error("tsdb_engine: cannot create the partition '%s'", filename.c_str());
+    return HA_ERR_INTERNAL_ERROR;
+  }
+  try{
+    tsdb::Timeseries ts = tsdb::Timeseries(file,"tsdb","",
+                            boost::make_shared<tsdb::Structure>(*share->series->structure()));
+  }catch(...)
+  {
+    valid = false;
+  }
+  if ( valid && (layout.codec != NULL || layout.chunk_records > 0 || layout.deflate > 0) )
+    valid = tsdb_rebuild_records(file, share->record_size, layout) == 0;
+  if ( valid )
+    H5LTset_attribute_int(file, "/", TSDB_FORMAT_ATTR, &share->format, 1);
+
+  tsdb_file_wait close_wait(PSI_FILE_CLOSE, psi_file, 0, __FILE__, __LINE__);
+  H5Fclose(file);
+  close_wait.closed();
+  if ( !valid )
+  {
+    sql_print_error("tsdb_engine: cannot create the series of partition '%s'", filename.c_str());
+    my_delete(filename.c_str(), MYF(0));
+    return HA_ERR_INTERNAL_ERROR;
+  }
+
+  //the previous partition is sealed: reopened read-only when read again
+  if ( !parts.empty() )
+    close_file(&parts.back());
+  parts.push_back(tsdb_partition(start));
+  parts.back().base = parts.size() == 1 ? dropped : parts[parts.size() - 2].base +
+                                                    parts[parts.size() - 2].records;
+  save_catalog();
+  return open_file(&parts.back(), true);
+}
+
+/*
+    @function tsdb_partitions::bracket
+    @brief narrow [low, high) to the partition holding the first record
+           whose _TSDB_timestamp >= ts, from the metadata only
+*/
+void tsdb_partitions::bracket(longlong ts, uint64* low, uint64* high) const
+{
+  for ( uint i = 0; i < parts.size(); i++ )
+  {
+    const tsdb_partition& part = parts[i];
+    if ( part.records == 0 || part.last_ts < ts )
+      continue;
+    if ( part.base >= *high )
+      break;
+    if ( part.base > *low )
+      *low = part.base;
+    if ( part.base + part.records < *high )
+      *high = part.base + part.records;
+    return;
+  }
+  //every record before high is older than ts
+  *low = *high;
+}
+
+/*
+    @function tsdb_partitions::rebuild
+    @brief rewrite the records of every partition with a new layout
+    @return mysql error code, the first error met
+*/
+int tsdb_partitions::rebuild(const tsdb_records_layout& layout)
+{
+  int rc = 0;
+  for ( uint i = 0; i < parts.size(); i++ )
+  {
+    tsdb_partition& part = parts[i];
+    close_file(&part);
+    if ( part.records == 0 )
+      continue;
+    std::string filename = path(part.start);
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDWR, fapl);
+    int err = file < 0 ? HA_ERR_CRASHED_ON_USAGE :
+                         tsdb_rebuild_records(file, share->record_size, layout);
+    if ( file >= 0 )
+      H5Fclose(file);
+    if ( rc == 0 )
+      rc = err;
+  }
+  chunk_records = layout.chunk_records;
+  deflate = layout.deflate;
+  compress = layout.codec != NULL;
+  if ( !parts.empty() )
+  {
+    int err = open_file(&parts.back(), true);
+    if ( rc == 0 )
+      rc = err;
+  }
+  return rc;
+}
+
+/*
+    @function tsdb_partitions::flush
+    @brief write the last partition to disk, for a log checkpoint
+    @details sealed partitions were closed, so flushed, when the next one
+             was added
+    @return mysql error code
+*/
+int tsdb_partitions::flush()
+{
+  if ( parts.empty() || parts.back().file_id < 0 )
+    return 0;
+  return H5Fflush(parts.back().file_id, H5F_SCOPE_LOCAL) < 0 ? HA_ERR_INTERNAL_ERROR : 0;
+}
+
+/*
+    @function tsdb_partitions::drop
+    @brief remove the files of the partitions whose records are all before origin
+    @details the head is written first: a crash before the files are gone
+             leaves files that open() recognizes and removes
+    @note caller makes sure no scan is reading them, see tsdb_engine_share::end_scan()
+*/
+void tsdb_partitions::drop(uint64 origin)
+{
+  uint n = 0;
+  while ( n < parts.size() && parts[n].base + parts[n].records <= origin )
+    n++;
+  if ( n == 0 )
+    return;
+  dropped = parts[n - 1].base + parts[n - 1].records;
+  head = n < parts.size() ? parts[n].start : parts[n - 1].start + window_length(width);
+  save_head();
+  for ( uint i = 0; i < n; i++ )
+  {
+    close_file(&parts[i]);
+    if ( my_delete(path(parts[i].start).c_str(), MYF(0)) )
+      sql_print_warning("tsdb_engine: cannot remove partition '%s'", path(parts[i].start).c_str());
+  }
+  parts.erase(parts.begin(), parts.begin() + n);
+  save_catalog();
+}
+
+void tsdb_partitions::save_head()
+{
+  long long saved[2] = { (long long)dropped, head };
+  if ( H5LTset_attribute_long_long(share->file_id, "/", TSDB_PARTITION_HEAD, saved, 2) < 0 )
+    sql_print_warning("tsdb_engine: cannot write the partition head");
+}
+
+/*
+    @function tsdb_partitions::save_catalog
+    @brief write start, records, first and last ts of the sealed partitions
+           in the main file
+*/
+void tsdb_partitions::save_catalog()
+{
+  std::vector<longlong> rows;
+  for ( uint i = 0; i + 1 < parts.size(); i++ )
+  {
+    rows.push_back(parts[i].start);
+    rows.push_back(parts[i].records);
+    rows.push_back(parts[i].first_ts);
+    rows.push_back(parts[i].last_ts);
+  }
+  if ( H5Lexists(share->file_id, TSDB_PARTITION_CATALOG, H5P_DEFAULT) > 0 )
+    H5Ldelete(share->file_id, TSDB_PARTITION_CATALOG, H5P_DEFAULT);
+  if ( rows.empty() )
+    return;
+  hsize_t dims[2] = { rows.size() / TSDB_CATALOG_COLUMNS, TSDB_CATALOG_COLUMNS };
+  if ( H5LTmake_dataset(share->file_id, TSDB_PARTITION_CATALOG, 2, dims,
+                        H5T_NATIVE_LLONG, &rows[0]) < 0 )
+    sql_print_warning("tsdb_engine: cannot write the partition catalog");
+}
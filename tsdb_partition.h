@@ -0,0 +1,112 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_partition.h
+    @brief time partitioned storage: one HDF5 file per time window
+*/
+#pragma once
+#include "my_global.h"
+#include "mysql/psi/psi.h"
+#include <string>
+#include <vector>
+
+class tsdb_engine_share;
+struct tsdb_storage_options;
+struct tsdb_records_layout;
+namespace tsdb{
+  class Timeseries;
+}
+
+//directory of the partition files, appended to the name of the .tsdb file
+#define TSDB_PARTITION_DIR ".d"
+//dataset of the main file: start, records, first and last ts of sealed partitions
+#define TSDB_PARTITION_CATALOG "/tsdb_partitions"
+//root attribute of the main file: records and window start of the removed partitions
+#define TSDB_PARTITION_HEAD "tsdb_engine_partition_head"
+
+//width of the time window of a partition, tsdb_partition= table option
+enum tsdb_partition_width
+{
+  TSDB_PARTITION_NONE,        ///< records live in the main .tsdb file
+  TSDB_PARTITION_HOUR,
+  TSDB_PARTITION_DAY,
+  TSDB_PARTITION_WEEK         ///< weeks start on monday, UTC
+};
+
+bool tsdb_partition_parse(const char* text, uint* width);
+longlong tsdb_partition_start(uint width, longlong ts);
+int  tsdb_partition_files(const char* filename);
+int  tsdb_partition_remove(const char* filename);
+
+/*
+@brief one time window of a partitioned series
+
+The file holds the same "tsdb" Timeseries as the main file. Only the last
+partition is written; the ones before it are sealed, opened read-only and
+only when a read reaches them.
+*/
+struct tsdb_partition
+{
+  longlong start;             ///< window start, ms since epoch
+  uint64 base;                ///< index of its first record in the series
+  uint64 records;
+  longlong first_ts;
+  longlong last_ts;
+  hid_t file_id;              ///< -1 while closed
+  PSI_file* psi_file;
+  tsdb::Timeseries* series;   ///< set for the last partition only
+  hid_t records_id;
+  hid_t records_type;
+
+  tsdb_partition(longlong window);
+};
+
+/*
+@brief the partitions of a series, owned by the share
+
+Record indexes stay global: partition i holds [base, base + records).
+Reads are served from the partitions overlapping the requested range and
+time searches are narrowed with the first/last timestamps kept in the
+catalog, so a query on a time range only opens the files of that range.
+All calls are made under the share mutex.
+*/
+class tsdb_partitions
+{
+  public:
+  tsdb_partitions();
+  ~tsdb_partitions();
+
+  int  open(tsdb_engine_share* share, const char* filename,
+            const tsdb_storage_options& options);
+  void close();
+  bool active() const { return width != TSDB_PARTITION_NONE; }
+  uint64 records() const;
+  uint count() const { return parts.size(); }
+
+  int  fetch(uint64 from, uint64 to, uchar* buf, uint64* count);
+  int  append(const uchar* records, uint64 n, uint64* done);
+  void bracket(longlong ts, uint64* low, uint64* high) const;
+  int  rebuild(const tsdb_records_layout& layout);
+  void drop(uint64 origin);
+  int  flush();
+
+  private:
+  std::string path(longlong start) const;
+  int  open_file(tsdb_partition* part, bool writable);
+  void close_file(tsdb_partition* part);
+  int  read(tsdb_partition* part, uint64 from, uint64 to, uchar* buf);
+  int  load(tsdb_partition* part, bool writable);
+  int  add(longlong start);
+  void save_catalog();
+  void save_head();
+
+  tsdb_engine_share* share;
+  uint width;
+  std::string dir;
+  hid_t fapl;                 ///< caches of the table, see tsdb_file_access()
+  ulonglong chunk_records;    ///< layout of new partitions, see tsdb_rebuild_records()
+  uint deflate;
+  bool compress;
+  std::vector<tsdb_partition> parts;
+  uint64 dropped;             ///< records of the removed partitions, base of the first one
+  longlong head;              ///< files of windows before it are leftovers of a drop
+};
@@ -0,0 +1,151 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_prefetch.cc
+    @brief tsdb_prefetcher implementation
+*/
+
+#include "PCHfile.h"
+#include "ha_tsdb_engine.h"
+#include "tsdb_prefetch.h"
+
+
+//ctor
+tsdb_prefetcher::tsdb_prefetcher()
+{
+  mysql_mutex_init(tsdb_key_mutex_prefetch, &mutex, MY_MUTEX_INIT_FAST);
+  mysql_cond_init(tsdb_key_cond_prefetch, &cond);
+  share = NULL;
+  next_in = next_out = end = 0;
+  depth = 0;
+  error = 0;
+  started = false;
+  stopping = false;
+}
+
+//dtor
+tsdb_prefetcher::~tsdb_prefetcher()
+{
+  stop();
+  mysql_cond_destroy(&cond);
+  mysql_mutex_destroy(&mutex);
+}
+
+/*
+    @function tsdb_prefetcher::start
+    @brief start fetching the blocks of [from, to) in the background
+    @params share table share owning the series, depth max blocks kept ready
+    @return mysql error code
+*/
+int tsdb_prefetcher::start(tsdb_engine_share* inShare, uint64 from, uint64 to, uint inDepth)
+{
+  stop();
+  share = inShare;
+  next_in = next_out = from;
+  end = to;
+  depth = inDepth;
+  error = 0;
+  stopping = false;
+  if ( mysql_thread_create(tsdb_key_thread_prefetch, &thread, NULL, run, this) )
+    return HA_ERR_OUT_OF_MEM;
+  started = true;
+  return 0;
+}
+
+/*
+    @function tsdb_prefetcher::stop
+    @brief stop the background thread and drop the blocks not taken
+*/
+void tsdb_prefetcher::stop()
+{
+  if ( !started )
+    return;
+  mysql_mutex_lock(&mutex);
+  stopping = true;
+  mysql_cond_broadcast(&cond);
+  mysql_mutex_unlock(&mutex);
+  my_thread_join(&thread, NULL);
+  ready.clear();
+  spare.clear();
+  started = false;
+}
+
+/*
+    @function tsdb_prefetcher::take
+    @brief hand the next block of the range to the scan, waiting if needed
+    @return 0, HA_ERR_END_OF_FILE past the range, or the fetch error
+*/
+int tsdb_prefetcher::take(tsdb_block* block)
+{
+  int rc = 0;
+  mysql_mutex_lock(&mutex);
+  tsdb_stats_add(ready.empty() ? &tsdb_stats.readahead_waits : &tsdb_stats.readahead_hits, 1);
+  while ( ready.empty() && error == 0 && next_in < end )
+    mysql_cond_wait(&cond, &mutex);
+  if ( !ready.empty() )
+  {
+    //the block given back keeps its buffer for a later fetch
+    block->swap(ready.front());
+    spare.push_back(tsdb_block());
+    spare.back().swap(ready.front());
+    ready.pop_front();
+    next_out += block->count;
+    mysql_cond_signal(&cond);
+  }
+  else
+    rc = error ? error : HA_ERR_END_OF_FILE;
+  mysql_mutex_unlock(&mutex);
+  return rc;
+}
+
+void* tsdb_prefetcher::run(void* arg)
+{
+  my_thread_init();
+  static_cast<tsdb_prefetcher*>(arg)->fetch_loop();
+  my_thread_end();
+  return NULL;
+}
+
+/*
+    @function tsdb_prefetcher::fetch_loop
+    @brief background thread body: keep up to depth blocks ready
+*/
+void tsdb_prefetcher::fetch_loop()
+{
+  mysql_mutex_lock(&mutex);
+  while ( !stopping && next_in < end )
+  {
+    if ( ready.size() >= depth )
+    {
+      mysql_cond_wait(&cond, &mutex);
+      continue;
+    }
+    uint64 from = next_in;
+    uint64 to = from + TSDB_BLOCK_RECORDS;
+    if ( to > end )
+      to = end;
+    tsdb_block block;
+    if ( !spare.empty() )
+    {
+      block.swap(spare.front());
+      spare.pop_front();
+    }
+    mysql_mutex_unlock(&mutex);
+
+    int rc = share->read_block(from, to, &block);
+
+    mysql_mutex_lock(&mutex);
+    if ( rc != 0 || block.count == 0 )
+    {
+      error = rc ? rc : HA_ERR_END_OF_FILE;
+      next_in = end;
+    }
+    else
+    {
+      ready.push_back(tsdb_block());
+      ready.back().swap(block);
+      next_in += ready.back().count;
+    }
+    mysql_cond_broadcast(&cond);
+  }
+  mysql_mutex_unlock(&mutex);
+}
@@ -0,0 +1,52 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_prefetch.h
+    @brief background read-ahead of record blocks for table scans
+*/
+#pragma once
+#include "my_global.h"
+#include "my_thread.h"
+#include "mysql/psi/mysql_thread.h"
+#include "tsdb_block.h"
+#include <deque>
+
+class tsdb_engine_share;
+
+/*
+@brief tsdb_prefetcher loads the blocks following the one being decoded
+
+A scan hands it the record range it is going to read; a background thread
+fetches TSDB_BLOCK_RECORDS blocks in order and keeps at most depth of them
+ready, so the client thread only waits when decoding outruns HDF5.
+*/
+class tsdb_prefetcher
+{
+  public:
+  tsdb_prefetcher();
+  ~tsdb_prefetcher();
+
+  int  start(tsdb_engine_share* share, uint64 from, uint64 to, uint depth);
+  void stop();
+  bool running() const { return started; }
+  uint64 next_index() const { return next_out; }
+
+  int  take(tsdb_block* block);
+
+  private:
+  static void* run(void* arg);
+  void fetch_loop();
+
+  tsdb_engine_share* share;
+  mysql_mutex_t mutex;
+  mysql_cond_t cond;
+  my_thread_handle thread;
+  std::deque<tsdb_block> ready;        ///< fetched blocks, in record order
+  std::deque<tsdb_block> spare;        ///< taken blocks whose buffers are reused
+  uint64 next_in;                      ///< first record of the next block to fetch
+  uint64 next_out;                     ///< first record of the next block to take
+  uint64 end;
+  uint depth;
+  int error;
+  bool started;
+  bool stopping;
+};
@@ -0,0 +1,174 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_psi.cc
+    @brief performance schema registration
+*/
+
+#include "my_global.h"
+#include "mysql/psi/mysql_thread.h"
+#include "mysql/psi/mysql_memory.h"
+#include "mysql/psi/mysql_file.h"
+#include "mysql/psi/mysql_stage.h"
+#include "tsdb_psi.h"
+
+
+PSI_mutex_key tsdb_key_mutex_share;
+PSI_mutex_key tsdb_key_mutex_create;
+PSI_mutex_key tsdb_key_mutex_prefetch;
+PSI_mutex_key tsdb_key_mutex_retention;
+PSI_mutex_key tsdb_key_mutex_wal;
+PSI_mutex_key tsdb_key_mutex_dictionary;
+PSI_cond_key tsdb_key_cond_prefetch;
+PSI_cond_key tsdb_key_cond_retention;
+PSI_cond_key tsdb_key_cond_wal;
+PSI_thread_key tsdb_key_thread_prefetch;
+PSI_thread_key tsdb_key_thread_retention;
+PSI_memory_key tsdb_key_memory_scan_block;
+PSI_memory_key tsdb_key_memory_append;
+PSI_memory_key tsdb_key_memory_reorder;
+PSI_memory_key tsdb_key_memory_heap;
+PSI_file_key tsdb_key_file_data;
+PSI_file_key tsdb_key_file_wal;
+
+PSI_stage_info stage_tsdb_opening_series= { 0, "tsdb: opening series", 0};
+PSI_stage_info stage_tsdb_fetching_block= { 0, "tsdb: fetching block", 0};
+PSI_stage_info stage_tsdb_waiting_readahead= { 0, "tsdb: waiting for read-ahead", 0};
+PSI_stage_info stage_tsdb_appending_batch= { 0, "tsdb: appending batch", 0};
+PSI_stage_info stage_tsdb_syncing_log= { 0, "tsdb: syncing log", 0};
+
+#ifdef HAVE_PSI_INTERFACE
+static PSI_mutex_info all_tsdb_mutexes[]=
+{
+  { &tsdb_key_mutex_share, "tsdb_engine_share::mutex", 0},
+  { &tsdb_key_mutex_create, "create_mutex", PSI_FLAG_GLOBAL},
+  { &tsdb_key_mutex_prefetch, "tsdb_prefetcher::mutex", 0},
+  { &tsdb_key_mutex_retention, "tsdb_retention::mutex", PSI_FLAG_GLOBAL},
+  { &tsdb_key_mutex_wal, "tsdb_wal::mutex", 0},
+  { &tsdb_key_mutex_dictionary, "tsdb_dictionary::mutex", 0}
+};
+
+static PSI_cond_info all_tsdb_conds[]=
+{
+  { &tsdb_key_cond_prefetch, "tsdb_prefetcher::cond", 0},
+  { &tsdb_key_cond_retention, "tsdb_retention::cond", PSI_FLAG_GLOBAL},
+  { &tsdb_key_cond_wal, "tsdb_wal::cond", 0}
+};
+
+static PSI_thread_info all_tsdb_threads[]=
+{
+  { &tsdb_key_thread_prefetch, "prefetch", 0},
+  { &tsdb_key_thread_retention, "retention", PSI_FLAG_SINGLETON}
+};
+
+static PSI_memory_info all_tsdb_memory[]=
+{
+  { &tsdb_key_memory_scan_block, "scan_block", 0},
+  { &tsdb_key_memory_append, "append_buffer", 0},
+  { &tsdb_key_memory_reorder, "reorder_buffer", 0},
+  { &tsdb_key_memory_heap, "heap", 0}
+};
+
+static PSI_file_info all_tsdb_files[]=
+{
+  { &tsdb_key_file_data, "data", 0},
+  { &tsdb_key_file_wal, "wal", 0}
+};
+
+static PSI_stage_info *all_tsdb_stages[]=
+{
+  &stage_tsdb_opening_series,
+  &stage_tsdb_fetching_block,
+  &stage_tsdb_waiting_readahead,
+  &stage_tsdb_appending_batch,
+  &stage_tsdb_syncing_log
+};
+#endif
+
+/*
+    @function tsdb_init_psi_keys
+    @brief register the instruments of the engine, at plugin init
+*/
+void tsdb_init_psi_keys()
+{
+#ifdef HAVE_PSI_INTERFACE
+  const char* category= "tsdb";
+
+  mysql_mutex_register(category, all_tsdb_mutexes, array_elements(all_tsdb_mutexes));
+  mysql_cond_register(category, all_tsdb_conds, array_elements(all_tsdb_conds));
+  mysql_thread_register(category, all_tsdb_threads, array_elements(all_tsdb_threads));
+  mysql_memory_register(category, all_tsdb_memory, array_elements(all_tsdb_memory));
+  mysql_file_register(category, all_tsdb_files, array_elements(all_tsdb_files));
+  mysql_stage_register(category, all_tsdb_stages, array_elements(all_tsdb_stages));
+#endif
+}
+
+//ctor: start an open or create wait on the file name
+tsdb_file_wait::tsdb_file_wait(PSI_file_operation op, const char* name,
+                               const char* src_file, uint src_line)
+{
+#ifdef HAVE_PSI_FILE_INTERFACE
+  locker = PSI_FILE_CALL(get_thread_file_name_locker)(&state, tsdb_key_file_data,
+                                                      op, name, this);
+  if ( locker != NULL )
+    PSI_FILE_CALL(start_file_open_wait)(locker, src_file, src_line);
+#endif
+}
+
+//ctor: start a read, write or close wait on an opened file
+tsdb_file_wait::tsdb_file_wait(PSI_file_operation op, PSI_file* file, size_t count,
+                               const char* src_file, uint src_line)
+{
+#ifdef HAVE_PSI_FILE_INTERFACE
+  locker = NULL;
+  if ( file != NULL )
+    locker = PSI_FILE_CALL(get_thread_file_stream_locker)(&state, file, op);
+  if ( locker == NULL )
+    return;
+  if ( op == PSI_FILE_CLOSE )
+    PSI_FILE_CALL(start_file_close_wait)(locker, src_file, src_line);
+  else
+    PSI_FILE_CALL(start_file_wait)(locker, count, src_file, src_line);
+#endif
+}
+
+/*
+    @function tsdb_file_wait::opened
+    @brief end an open or create wait
+    @return the instrumented file, NULL if the call failed or is not instrumented
+*/
+PSI_file* tsdb_file_wait::opened(bool success)
+{
+  PSI_file* file = NULL;
+#ifdef HAVE_PSI_FILE_INTERFACE
+  if ( locker != NULL )
+    file = PSI_FILE_CALL(end_file_open_wait)(locker, success ? this : NULL);
+  locker = NULL;
+#endif
+  return file;
+}
+
+/*
+    @function tsdb_file_wait::end
+    @brief end a read or write wait, bytes is what the call transferred
+*/
+void tsdb_file_wait::end(size_t bytes)
+{
+#ifdef HAVE_PSI_FILE_INTERFACE
+  if ( locker != NULL )
+    PSI_FILE_CALL(end_file_wait)(locker, bytes);
+  locker = NULL;
+#endif
+}
+
+/*
+    @function tsdb_file_wait::closed
+    @brief end a close wait, the PSI_file is released
+*/
+void tsdb_file_wait::closed()
+{
+#ifdef HAVE_PSI_FILE_INTERFACE
+  if ( locker != NULL )
+    PSI_FILE_CALL(end_file_close_wait)(locker, 0);
+  locker = NULL;
+#endif
+}
@@ -0,0 +1,64 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_psi.h
+    @brief performance schema keys of the engine
+*/
+#pragma once
+#include "my_global.h"
+#include "mysql/psi/psi.h"
+
+extern PSI_mutex_key tsdb_key_mutex_share;
+extern PSI_mutex_key tsdb_key_mutex_create;
+extern PSI_mutex_key tsdb_key_mutex_prefetch;
+extern PSI_mutex_key tsdb_key_mutex_retention;
+extern PSI_mutex_key tsdb_key_mutex_wal;
+extern PSI_mutex_key tsdb_key_mutex_dictionary;
+extern PSI_cond_key tsdb_key_cond_prefetch;
+extern PSI_cond_key tsdb_key_cond_retention;
+extern PSI_cond_key tsdb_key_cond_wal;
+extern PSI_thread_key tsdb_key_thread_prefetch;
+extern PSI_thread_key tsdb_key_thread_retention;
+
+extern PSI_memory_key tsdb_key_memory_scan_block;   ///< tsdb_block buffers of scans and rnd_pos()
+extern PSI_memory_key tsdb_key_memory_append;       ///< bulk insert and single row buffers
+extern PSI_memory_key tsdb_key_memory_reorder;      ///< records waiting in tsdb_reorder_buffer
+extern PSI_memory_key tsdb_key_memory_heap;         ///< heap values being inserted or read, see tsdb_heap.h
+
+extern PSI_file_key tsdb_key_file_data;             ///< the .tsdb HDF5 file
+extern PSI_file_key tsdb_key_file_wal;              ///< the .tsdb.wal log, see tsdb_wal.h
+
+extern PSI_stage_info stage_tsdb_opening_series;
+extern PSI_stage_info stage_tsdb_fetching_block;
+extern PSI_stage_info stage_tsdb_waiting_readahead;
+extern PSI_stage_info stage_tsdb_appending_batch;
+extern PSI_stage_info stage_tsdb_syncing_log;
+
+void tsdb_init_psi_keys();
+
+/*
+@brief tsdb_file_wait reports one HDF5 call as a file wait on the .tsdb file
+
+HDF5 does its own I/O, so the waits are timed around the library calls the
+way mysql_file_* does around the system calls: open/create by name, which
+gives the PSI_file of the table, then block reads, appends and the close
+on that PSI_file. The locker lives in the object: declare it on the stack,
+never copy it.
+*/
+class tsdb_file_wait
+{
+  public:
+  tsdb_file_wait(PSI_file_operation op, const char* name,
+                 const char* src_file, uint src_line);
+  tsdb_file_wait(PSI_file_operation op, PSI_file* file, size_t count,
+                 const char* src_file, uint src_line);
+
+  PSI_file* opened(bool success);
+  void end(size_t bytes);
+  void closed();
+
+  private:
+#ifdef HAVE_PSI_FILE_INTERFACE
+  PSI_file_locker_state state;
+  PSI_file_locker* locker;
+#endif
+};
@@ -0,0 +1,134 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_reorder.cc
+    @brief tsdb_reorder_buffer implementation
+*/
+
+#include "PCHfile.h"
+#include "tsdb_reorder.h"
+#include "tsdb_psi.h"
+
+
+//ctor
+tsdb_reorder_buffer::tsdb_reorder_buffer()
+  : pool(Malloc_allocator<uchar>(tsdb_key_memory_reorder))
+{
+  head = 0;
+  record_size = 1;
+  window = 0;
+  newest = LLONG_MIN;
+}
+
+/*
+    @function tsdb_reorder_buffer::init
+    @brief set the record layout and the window, when the series is opened
+*/
+void tsdb_reorder_buffer::init(size_t size, ulonglong ms)
+{
+  clear();
+  record_size = size;
+  window = ms;
+}
+
+//_TSDB_timestamp of the record at offset of the pool
+longlong tsdb_reorder_buffer::timestamp(size_t offset) const
+{
+  longlong ts;
+  memcpy(&ts, &pool[offset], 8);
+  return ts;
+}
+
+//offset of the first buffered record whose _TSDB_timestamp > ts
+size_t tsdb_reorder_buffer::upper_bound(longlong ts) const
+{
+  uint64 low = 0, high = count();
+  while ( low < high )
+  {
+    uint64 mid = low + (high - low) / 2;
+    if ( timestamp(head + mid * record_size) <= ts )
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return head + low * record_size;
+}
+
+/*
+    @function tsdb_reorder_buffer::add
+    @brief buffer n records, in time order
+    @details records mostly arrive in order and go at the end; a late one
+             is inserted after the records of the same timestamp, so that
+             equal timestamps keep their insert order
+*/
+void tsdb_reorder_buffer::add(const uchar* records, uint64 n)
+{
+  for ( uint64 i = 0; i < n; i++ )
+  {
+    const uchar* rec = records + i * record_size;
+    longlong ts;
+    memcpy(&ts, rec, 8);
+    if ( ts >= newest )
+    {
+      newest = ts;
+      pool.insert(pool.end(), rec, rec + record_size);
+    }
+    else
+      pool.insert(pool.begin() + upper_bound(ts), rec, rec + record_size);
+  }
+}
+
+/*
+    @function tsdb_reorder_buffer::sealed
+    @brief the records the window has passed, ready to be appended
+    @return the first of them; valid until the next add() or consume()
+*/
+const uchar* tsdb_reorder_buffer::sealed(uint64* n) const
+{
+  *n = 0;
+  if ( count() == 0 )
+    return NULL;
+  longlong limit = newest - (longlong)window;
+  *n = (upper_bound(limit) - head) / record_size;
+  return &pool[head];
+}
+
+/*
+    @function tsdb_reorder_buffer::all
+    @brief every buffered record, to flush the buffer
+*/
+const uchar* tsdb_reorder_buffer::all(uint64* n) const
+{
+  *n = count();
+  return *n ? &pool[head] : NULL;
+}
+
+/*
+    @function tsdb_reorder_buffer::consume
+    @brief forget the first n records once they are appended
+    @details the pool is compacted when the consumed part outgrows the rest
+*/
+void tsdb_reorder_buffer::consume(uint64 n)
+{
+  head += n * record_size;
+  if ( head == pool.size() )
+  {
+    pool.clear();
+    head = 0;
+  }
+  else if ( head > pool.size() / 2 )
+  {
+    pool.erase(pool.begin(), pool.begin() + head);
+    head = 0;
+  }
+}
+
+/*
+    @function tsdb_reorder_buffer::clear
+    @brief drop the buffered records, on TRUNCATE
+*/
+void tsdb_reorder_buffer::clear()
+{
+  pool.clear();
+  head = 0;
+  newest = LLONG_MIN;
+}
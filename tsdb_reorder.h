@@ -0,0 +1,47 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_reorder.h
+    @brief in-memory buffer putting out-of-order records back in time order
+*/
+#pragma once
+#include "my_global.h"
+#include "malloc_allocator.h"
+#include <vector>
+
+/*
+@brief tsdb_reorder_buffer holds the recent records of a table with a
+client supplied time key, see the tsdb_time_key= option
+
+The series must stay sorted on _TSDB_timestamp. Records newer than the
+newest one seen minus the window wait here, sorted; the ones the window
+has passed are sealed and appended in one batch. A record older than the
+last appended one cannot be placed any more and is refused by the share.
+Scans read the buffered records after the appended ones, see
+tsdb_engine_share::fetch_buffered(). All calls are made under the share
+mutex.
+*/
+class tsdb_reorder_buffer
+{
+  public:
+  tsdb_reorder_buffer();
+
+  void init(size_t record_size, ulonglong window);
+  bool active() const { return window > 0; }
+  uint64 count() const { return (pool.size() - head) / record_size; }
+
+  void add(const uchar* records, uint64 n);
+  const uchar* sealed(uint64* n) const;
+  const uchar* all(uint64* n) const;
+  void consume(uint64 n);
+  void clear();
+
+  private:
+  longlong timestamp(size_t offset) const;
+  size_t upper_bound(longlong ts) const;
+
+  std::vector<uchar, Malloc_allocator<uchar> > pool;  ///< records sorted from head
+  size_t head;                ///< byte offset of the first buffered record
+  size_t record_size;
+  ulonglong window;           ///< milliseconds, 0 when records are appended as they come
+  longlong newest;            ///< greatest _TSDB_timestamp seen
+};
@@ -0,0 +1,132 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_retention.cc
+    @brief tsdb_retention implementation
+*/
+
+#include "PCHfile.h"
+#include "ha_tsdb_engine.h"
+#include "tsdb_retention.h"
+#include "log.h"
+#include <algorithm>
+
+
+tsdb_retention tsdb_retention_task;
+
+//ctor: the mutex is created by start(), once the PSI keys are registered
+tsdb_retention::tsdb_retention()
+{
+  interval = NULL;
+  started = false;
+  stopping = false;
+}
+
+/*
+    @function tsdb_retention::start
+    @brief start the expiry thread, at plugin init
+    @return mysql error code
+*/
+int tsdb_retention::start(ulong* seconds)
+{
+  mysql_mutex_init(tsdb_key_mutex_retention, &mutex, MY_MUTEX_INIT_FAST);
+  mysql_cond_init(tsdb_key_cond_retention, &cond);
+  interval = seconds;
+  stopping = false;
+  if ( mysql_thread_create(tsdb_key_thread_retention, &thread, NULL, run, this) )
+  {
+    mysql_cond_destroy(&cond);
+    mysql_mutex_destroy(&mutex);
+    return HA_ERR_OUT_OF_MEM;
+  }
+  started = true;
+  return 0;
+}
+
+/*
+    @function tsdb_retention::stop
+    @brief stop the expiry thread, at plugin deinit
+*/
+void tsdb_retention::stop()
+{
+  if ( !started )
+    return;
+  mysql_mutex_lock(&mutex);
+  stopping = true;
+  mysql_cond_broadcast(&cond);
+  mysql_mutex_unlock(&mutex);
+  my_thread_join(&thread, NULL);
+  shares.clear();
+  mysql_cond_destroy(&cond);
+  mysql_mutex_destroy(&mutex);
+  started = false;
+}
+
+/*
+    @function tsdb_retention::add
+    @brief expire the records of share from now on
+    @note caller must not hold the share mutex
+*/
+void tsdb_retention::add(tsdb_engine_share* share)
+{
+  if ( !started )
+    return;
+  mysql_mutex_lock(&mutex);
+  if ( std::find(shares.begin(), shares.end(), share) == shares.end() )
+    shares.push_back(share);
+  mysql_mutex_unlock(&mutex);
+}
+
+/*
+    @function tsdb_retention::remove
+    @brief forget share before it is destroyed, waits for a pass using it
+    @note caller must not hold the share mutex
+*/
+void tsdb_retention::remove(tsdb_engine_share* share)
+{
+  if ( !started )
+    return;
+  mysql_mutex_lock(&mutex);
+  shares.erase(std::remove(shares.begin(), shares.end(), share), shares.end());
+  mysql_mutex_unlock(&mutex);
+}
+
+void* tsdb_retention::run(void* arg)
+{
+  my_thread_init();
+  static_cast<tsdb_retention*>(arg)->expire_loop();
+  my_thread_end();
+  return NULL;
+}
+
+/*
+    @function tsdb_retention::expire_loop
+    @brief background thread body: one pass over the shares every interval
+*/
+void tsdb_retention::expire_loop()
+{
+  mysql_mutex_lock(&mutex);
+  while ( !stopping )
+  {
+    struct timespec abstime;
+    set_timespec(&abstime, *interval);
+    mysql_cond_timedwait(&cond, &mutex, &abstime);
+    if ( stopping )
+      break;
+
+    longlong now = (longlong)(my_micro_time() / 1000);
+    for ( size_t i = 0; i < shares.size(); i++ )
+    {
+      tsdb_engine_share* share = shares[i];
+      mysql_mutex_lock(&share->mutex);
+      if ( share->retention > 0 && share->records > share->origin &&
+           share->first_ts < now - (longlong)share->retention )
+      {
+        int rc = share->expire(share->lower_bound(now - (longlong)share->retention));
+        if ( rc )
+          sql_print_warning("tsdb_engine: retention could not expire records, error %d", rc);
+      }
+      mysql_mutex_unlock(&share->mutex);
+    }
+  }
+  mysql_mutex_unlock(&mutex);
+}
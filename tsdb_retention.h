@@ -0,0 +1,48 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_retention.h
+    @brief background expiry of the records older than the retention of a table
+*/
+#pragma once
+#include "my_global.h"
+#include "my_thread.h"
+#include "mysql/psi/mysql_thread.h"
+#include <vector>
+
+class tsdb_engine_share;
+
+/*
+@brief tsdb_retention expires the old records of the tables with a
+tsdb_retention= option
+
+Shares of such tables register when they are opened. Every interval
+seconds the thread takes each share mutex in turn and moves the origin of
+the series past the records older than now - retention, see
+tsdb_engine_share::expire(). Nothing is rewritten: the cost is a binary
+search and a few metadata writes, and the files of partitions that fall
+entirely before the origin are removed.
+*/
+class tsdb_retention
+{
+  public:
+  tsdb_retention();
+
+  int  start(ulong* interval);
+  void stop();
+  void add(tsdb_engine_share* share);
+  void remove(tsdb_engine_share* share);
+
+  private:
+  static void* run(void* arg);
+  void expire_loop();
+
+  mysql_mutex_t mutex;                 ///< taken before any share mutex
+  mysql_cond_t cond;
+  my_thread_handle thread;
+  std::vector<tsdb_engine_share*> shares;
+  ulong* interval;                     ///< seconds, the engine_retention_interval sysvar
+  bool started;
+  bool stopping;
+};
+
+extern tsdb_retention tsdb_retention_task;
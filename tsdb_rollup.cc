@@ -0,0 +1,358 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_rollup.cc
+    @brief tsdb_rollup and tsdb_rollup_reader implementation
+*/
+
+#include "PCHfile.h"
+#include "ha_tsdb_engine.h"
+#include "tsdb_rollup.h"
+#include "log.h"
+
+
+const tsdb_rollup_level tsdb_rollup_levels[TSDB_ROLLUP_LEVELS]=
+{
+  { "1m", 60 * 1000LL },
+  { "1h", 3600 * 1000LL },
+  { "1d", 86400 * 1000LL }
+};
+
+//rows per chunk of a rollup dataset
+#define TSDB_ROLLUP_CHUNK 1024
+
+
+//ctor
+tsdb_rollup::tsdb_rollup()
+{
+  share = NULL;
+  width = 0;
+  for ( uint i = 0; i < TSDB_ROLLUP_LEVELS; i++ )
+  {
+    levels[i].dset = -1;
+    levels[i].rows = 0;
+  }
+}
+
+//dtor
+tsdb_rollup::~tsdb_rollup()
+{
+  for ( uint i = 0; i < TSDB_ROLLUP_LEVELS; i++ )
+  {
+    if ( levels[i].dset >= 0 )
+      H5Dclose(levels[i].dset);
+  }
+}
+
+/*
+    @function tsdb_rollup::open
+    @brief open or create the rollup datasets of the series of share
+    @return mysql error code; tables without numeric column or still in the
+            packed layout have no rollup and return 0
+    @note caller must hold share->mutex, records stats must be loaded
+*/
+int tsdb_rollup::open(tsdb_engine_share* inShare)
+{
+  const tsdb_row_codec& codec = inShare->codec;
+  hid_t file = inShare->file_id;
+
+  if ( !codec.valid )
+    return 0;
+  columns.clear();
+  for ( uint col = 0; col < codec.columns(); col++ )
+  {
+    if ( codec.numeric(col) )
+      columns.push_back(col);
+  }
+  if ( columns.empty() )
+    return 0;
+  width = 1 + TSDB_ROLLUP_STATS * columns.size();
+
+  if ( H5Lexists(file, TSDB_ROLLUP_GROUP, H5P_DEFAULT) <= 0 )
+  {
+    hid_t group = H5Gcreate2(file, TSDB_ROLLUP_GROUP, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if ( group < 0 )
+      return HA_ERR_INTERNAL_ERROR;
+    H5Gclose(group);
+  }
+
+  for ( uint i = 0; i < TSDB_ROLLUP_LEVELS; i++ )
+  {
+    level* lvl = &levels[i];
+    std::string path = std::string(TSDB_ROLLUP_GROUP) + "/" + tsdb_rollup_levels[i].name;
+    hsize_t dims[2] = { 0, width };
+
+    if ( H5Lexists(file, path.c_str(), H5P_DEFAULT) > 0 )
+    {
+      lvl->dset = H5Dopen2(file, path.c_str(), H5P_DEFAULT);
+      hid_t space = H5Dget_space(lvl->dset);
+      H5Sget_simple_extent_dims(space, dims, NULL);
+      H5Sclose(space);
+      if ( dims[1] != width )
+      {
+        sql_print_error("tsdb_engine: rollup %s does not match the table", path.c_str());
+        return HA_ERR_CRASHED_ON_USAGE;
+      }
+    }
+    else
+    {
+      hsize_t maxdims[2] = { H5S_UNLIMITED, width };
+      hsize_t chunk[2] = { TSDB_ROLLUP_CHUNK, width };
+      hid_t space = H5Screate_simple(2, dims, maxdims);
+      hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+      H5Pset_chunk(dcpl, 2, chunk);
+      lvl->dset = H5Dcreate2(file, path.c_str(), H5T_NATIVE_DOUBLE, space,
+                             H5P_DEFAULT, dcpl, H5P_DEFAULT);
+      H5Pclose(dcpl);
+      H5Sclose(space);
+    }
+    if ( lvl->dset < 0 )
+      return HA_ERR_INTERNAL_ERROR;
+
+    //the last row is the open bucket
+    lvl->rows = dims[0];
+    lvl->open.clear();
+    if ( lvl->rows > 0 )
+    {
+      hsize_t start[2] = { lvl->rows - 1, 0 };
+      hsize_t count[2] = { 1, width };
+      hid_t space = H5Dget_space(lvl->dset);
+      hid_t mspace = H5Screate_simple(2, count, NULL);
+      lvl->open.resize(width);
+      H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+      H5Dread(lvl->dset, H5T_NATIVE_DOUBLE, mspace, space, H5P_DEFAULT, &lvl->open[0]);
+      H5Sclose(mspace);
+      H5Sclose(space);
+      lvl->rows--;
+    }
+  }
+  share = inShare;
+
+  //not closed cleanly: aggregate again the records of the open buckets
+  long long covered = -1;
+  if ( H5Aexists_by_name(file, "/", TSDB_ROLLUP_RECORDS, H5P_DEFAULT) <= 0 ||
+       H5LTget_attribute_long_long(file, "/", TSDB_ROLLUP_RECORDS, &covered) < 0 ||
+       covered != (long long)share->records )
+    return rebuild();
+  return 0;
+}
+
+/*
+    @function tsdb_rollup::rebuild
+    @brief drop the open buckets and aggregate the records from their start
+*/
+int tsdb_rollup::rebuild()
+{
+  longlong starts[TSDB_ROLLUP_LEVELS];
+  longlong from = LLONG_MAX;
+  tsdb_block block;
+  int rc = 0;
+
+  for ( uint i = 0; i < TSDB_ROLLUP_LEVELS; i++ )
+  {
+    starts[i] = levels[i].open.empty() ? LLONG_MIN : (longlong)levels[i].open[0];
+    levels[i].open.clear();
+    if ( starts[i] < from )
+      from = starts[i];
+  }
+
+  uint64 index = from == LLONG_MIN ? share->origin : share->lower_bound(from);
+  if ( index < share->records )
+    sql_print_information("tsdb_engine: rebuilding rollups from record %llu", (ulonglong)index);
+  for ( ; index < share->records && rc == 0; index += block.count )
+  {
+    if ( (rc = share->fetch_records(index, index + TSDB_BLOCK_RECORDS, &block)) || block.count == 0 )
+      break;
+    for ( uint64 r = 0; r < block.count; r++ )
+    {
+      const uchar* record = block.record(r);
+      longlong ts;
+      memcpy(&ts, record, 8);
+      for ( uint i = 0; i < TSDB_ROLLUP_LEVELS; i++ )
+      {
+        if ( ts >= starts[i] )
+          aggregate(&levels[i], tsdb_rollup_levels[i].width, record);
+      }
+    }
+  }
+  for ( uint i = 0; i < TSDB_ROLLUP_LEVELS; i++ )
+    write_open(&levels[i]);
+  return rc;
+}
+
+/*
+    @function tsdb_rollup::aggregate
+    @brief add one record to the open bucket of a level
+*/
+void tsdb_rollup::aggregate(level* lvl, longlong bucket_width, const uchar* record)
+{
+  longlong ts;
+  memcpy(&ts, record, 8);
+  longlong bucket = ts - ts % bucket_width;
+
+  if ( !lvl->open.empty() && bucket > (longlong)lvl->open[0] )
+  {
+    //the open bucket is complete
+    write_open(lvl);
+    lvl->rows++;
+    lvl->open.clear();
+  }
+  if ( lvl->open.empty() )
+  {
+    lvl->open.assign(width, 0);
+    lvl->open[0] = (double)bucket;
+  }
+
+  const tsdb_row_codec& codec = share->codec;
+  for ( uint c = 0; c < columns.size(); c++ )
+  {
+    double v;
+    if ( !codec.value(record, columns[c], &v) )
+      continue;
+    double* st = &lvl->open[1 + c * TSDB_ROLLUP_STATS];
+    if ( st[0] == 0 || v < st[1] )
+      st[1] = v;
+    if ( st[0] == 0 || v > st[2] )
+      st[2] = v;
+    st[0]++;
+    st[3] += v;
+  }
+}
+
+/*
+    @function tsdb_rollup::write_open
+    @brief write the open bucket of a level as the last row of its dataset
+*/
+void tsdb_rollup::write_open(level* lvl)
+{
+  if ( lvl->open.empty() )
+    return;
+  hsize_t dims[2] = { lvl->rows + 1, width };
+  hsize_t start[2] = { lvl->rows, 0 };
+  hsize_t count[2] = { 1, width };
+  H5Dset_extent(lvl->dset, dims);
+  hid_t space = H5Dget_space(lvl->dset);
+  hid_t mspace = H5Screate_simple(2, count, NULL);
+  H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+  H5Dwrite(lvl->dset, H5T_NATIVE_DOUBLE, mspace, space, H5P_DEFAULT, &lvl->open[0]);
+  H5Sclose(mspace);
+  H5Sclose(space);
+}
+
+/*
+    @function tsdb_rollup::add
+    @brief aggregate n appended records; buckets they complete are written
+           and the open buckets are rewritten once for the batch
+*/
+void tsdb_rollup::add(const uchar* records, uint64 n)
+{
+  if ( share == NULL )
+    return;
+  for ( uint64 r = 0; r < n; r++ )
+  {
+    for ( uint i = 0; i < TSDB_ROLLUP_LEVELS; i++ )
+      aggregate(&levels[i], tsdb_rollup_levels[i].width, records + r * share->record_size);
+  }
+  for ( uint i = 0; i < TSDB_ROLLUP_LEVELS; i++ )
+    write_open(&levels[i]);
+}
+
+/*
+    @function tsdb_rollup::close
+    @brief record that the rollups cover the first records of the series
+*/
+void tsdb_rollup::close(uint64 records)
+{
+  long long covered = records;
+  if ( share == NULL )
+    return;
+  H5LTset_attribute_long_long(share->file_id, "/", TSDB_ROLLUP_RECORDS, &covered, 1);
+  for ( uint i = 0; i < TSDB_ROLLUP_LEVELS; i++ )
+  {
+    H5Dclose(levels[i].dset);
+    levels[i].dset = -1;
+  }
+  share = NULL;
+}
+
+
+//tsdb_rollup_reader impl
+
+//ctor
+tsdb_rollup_reader::tsdb_rollup_reader()
+{
+  file_id = -1;
+  dset = -1;
+  row_width = 0;
+}
+
+//dtor
+tsdb_rollup_reader::~tsdb_rollup_reader()
+{
+  if ( dset >= 0 )
+    H5Dclose(dset);
+  if ( file_id >= 0 )
+    H5Fclose(file_id);
+}
+
+/*
+    @function tsdb_rollup_reader::open
+    @brief open a level of the rollups of a .tsdb file
+    @return mysql error code
+    @note the file is opened read-write like the source table does: HDF5
+          refuses a read-write open of a file already opened read-only
+*/
+int tsdb_rollup_reader::open(const char* filename, const char* level)
+{
+  std::string path = std::string(TSDB_ROLLUP_GROUP) + "/" + level;
+  hsize_t dims[2];
+
+  file_id = H5Fopen(filename, H5F_ACC_RDWR, H5P_DEFAULT);
+  if ( file_id < 0 )
+    return HA_ERR_NO_SUCH_TABLE;
+  if ( H5Lexists(file_id, path.c_str(), H5P_DEFAULT) <= 0 ||
+       (dset = H5Dopen2(file_id, path.c_str(), H5P_DEFAULT)) < 0 )
+  {
+    sql_print_error("tsdb_engine: no rollup %s in %s", path.c_str(), filename);
+    return HA_ERR_NO_SUCH_TABLE;
+  }
+  hid_t space = H5Dget_space(dset);
+  H5Sget_simple_extent_dims(space, dims, NULL);
+  H5Sclose(space);
+  row_width = dims[1];
+  return 0;
+}
+
+/*
+    @function tsdb_rollup_reader::rows
+    @brief current number of buckets, the open one included
+*/
+uint64 tsdb_rollup_reader::rows()
+{
+  hsize_t dims[2] = { 0, 0 };
+  hid_t space = H5Dget_space(dset);
+  H5Sget_simple_extent_dims(space, dims, NULL);
+  H5Sclose(space);
+  return dims[0];
+}
+
+/*
+    @function tsdb_rollup_reader::read
+    @brief read the buckets [from, to) as rows of width() doubles
+    @return mysql error code
+*/
+int tsdb_rollup_reader::read(uint64 from, uint64 to, std::vector<double>* out)
+{
+  hsize_t start[2] = { from, 0 };
+  hsize_t count[2] = { to - from, row_width };
+  out->resize(count[0] * row_width);
+  if ( count[0] == 0 )
+    return 0;
+  hid_t space = H5Dget_space(dset);
+  hid_t mspace = H5Screate_simple(2, count, NULL);
+  herr_t err = H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+  if ( err >= 0 )
+    err = H5Dread(dset, H5T_NATIVE_DOUBLE, mspace, space, H5P_DEFAULT, &(*out)[0]);
+  H5Sclose(mspace);
+  H5Sclose(space);
+  return err < 0 ? HA_ERR_INTERNAL_ERROR : 0;
+}
@@ -0,0 +1,86 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_rollup.h
+    @brief downsampled companion datasets of a series
+*/
+#pragma once
+#include "my_global.h"
+#include <vector>
+
+class tsdb_row_codec;
+class tsdb_engine_share;
+
+//group of the .tsdb file holding the rollup datasets
+#define TSDB_ROLLUP_GROUP "/tsdb_rollup"
+//root attribute: records aggregated when the rollups were last closed cleanly
+#define TSDB_ROLLUP_RECORDS "tsdb_engine_rollup_records"
+#define TSDB_ROLLUP_LEVELS 3
+//values per numeric column in a rollup row: count, min, max, sum
+#define TSDB_ROLLUP_STATS 4
+
+struct tsdb_rollup_level
+{
+  const char* name;           ///< dataset name, also used in tsdb_rollup= table options
+  longlong width;             ///< bucket width in milliseconds
+};
+
+extern const tsdb_rollup_level tsdb_rollup_levels[TSDB_ROLLUP_LEVELS];
+
+/*
+@brief tsdb_rollup maintains the 1m/1h/1d buckets of a series at ingest
+
+Each level is a 2-D dataset of doubles, one row per bucket:
+bucket start (ms since epoch), then count/min/max/sum of every numeric
+column. The last row is the open bucket, rewritten as appends land; rows
+before it are final. All calls are made under the share mutex.
+*/
+class tsdb_rollup
+{
+  public:
+  tsdb_rollup();
+  ~tsdb_rollup();
+
+  int  open(tsdb_engine_share* share);
+  void add(const uchar* records, uint64 n);
+  void close(uint64 records);
+  bool active() const { return share != NULL; }
+
+  private:
+  struct level
+  {
+    hid_t dset;
+    uint64 rows;              ///< rows in the dataset, the open bucket included
+    std::vector<double> open; ///< open bucket, empty before the first record
+  };
+
+  void aggregate(level* lvl, longlong width, const uchar* record);
+  void write_open(level* lvl);
+  int  rebuild();
+
+  tsdb_engine_share* share;
+  std::vector<uint> columns;  ///< codec columns that are rolled up
+  uint width;                 ///< doubles per row
+  level levels[TSDB_ROLLUP_LEVELS];
+};
+
+/*
+@brief read-only access to one rollup level of another table
+
+Used by companion tables declared with COMMENT 'tsdb_rollup=<table>:<level>'.
+*/
+class tsdb_rollup_reader
+{
+  public:
+  tsdb_rollup_reader();
+  ~tsdb_rollup_reader();
+
+  int    open(const char* filename, const char* level);
+  uint64 rows();
+  uint   width() const { return row_width; }
+  int    read(uint64 from, uint64 to, std::vector<double>* out);
+
+  private:
+  hid_t file_id;
+  hid_t dset;
+  uint row_width;
+};
@@ -0,0 +1,624 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_row_codec.cc
+    @brief tsdb_row_codec implementation
+*/
+
+#include "PCHfile.h"
+#include "sql_class.h"
+#include "tsdb_row_codec.h"
+#include "tsdb_tags.h"
+
+
+/*
+    @function tsdb_column_kind
+    @brief tsdb storage class of a mysql column
+    @params format TSDB_FORMAT_* of the file, older ones widen the narrow
+            types, have no heap, store DECIMAL as a double and VARCHAR
+            values without their length
+*/
+tsdb_kind tsdb_column_kind(Field* field, int format)
+{
+  bool narrow = format >= TSDB_FORMAT_NARROW;
+  bool heap = format >= TSDB_FORMAT_HEAP;
+  bool image = format >= TSDB_FORMAT_IMAGE;
+  switch(field->type())
+  {
+    case MYSQL_TYPE_FLOAT :
+      return narrow ? TSDB_KIND_FLOAT : TSDB_KIND_DOUBLE;
+    case MYSQL_TYPE_TINY :
+    case MYSQL_TYPE_YEAR :
+      return narrow ? TSDB_KIND_INT8 : TSDB_KIND_INT32;
+    case MYSQL_TYPE_SHORT:
+      return narrow ? TSDB_KIND_INT16 : TSDB_KIND_INT32;
+    case MYSQL_TYPE_NEWDECIMAL:
+      return format >= TSDB_FORMAT_DECIMAL ? TSDB_KIND_DECIMAL : TSDB_KIND_DOUBLE;
+    case MYSQL_TYPE_DECIMAL:
+    case MYSQL_TYPE_DOUBLE:
+      return TSDB_KIND_DOUBLE;
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_LONG :
+      return TSDB_KIND_INT32;
+    case MYSQL_TYPE_LONGLONG :
+      return TSDB_KIND_INT64;
+    case MYSQL_TYPE_BIT :
+      return TSDB_KIND_CHAR;
+    case MYSQL_TYPE_DATE :
+    case MYSQL_TYPE_TIME :
+    case MYSQL_TYPE_NEWDATE :
+      return TSDB_KIND_DATE;
+    case MYSQL_TYPE_TIMESTAMP:
+    case MYSQL_TYPE_DATETIME:
+      return TSDB_KIND_TIMESTAMP;
+    case MYSQL_TYPE_VARCHAR :
+    case MYSQL_TYPE_ENUM :
+    case MYSQL_TYPE_SET:
+    case MYSQL_TYPE_VAR_STRING:
+    case MYSQL_TYPE_STRING:
+      if ( tsdb_tag_column(field) )
+        return TSDB_KIND_TAG;
+      if ( heap && field->real_type() == MYSQL_TYPE_VARCHAR &&
+           (image ? field->pack_length() : field->field_length) > TSDB_STRING_WIDTH )
+        return TSDB_KIND_HEAP;
+      return TSDB_KIND_STRING;
+    case MYSQL_TYPE_TINY_BLOB:
+    case MYSQL_TYPE_MEDIUM_BLOB:
+    case MYSQL_TYPE_LONG_BLOB:
+    case MYSQL_TYPE_BLOB:
+    case MYSQL_TYPE_JSON:
+    case MYSQL_TYPE_GEOMETRY:
+      return heap ? TSDB_KIND_HEAP : TSDB_KIND_NONE;
+    default:
+      return TSDB_KIND_NONE;
+  }
+}
+
+/*
+    @function tsdb_kind_width
+    @brief bytes taken by a value of the kind in a tsdb record
+*/
+uint tsdb_kind_width(tsdb_kind kind)
+{
+  switch(kind)
+  {
+    case TSDB_KIND_INT8:
+    case TSDB_KIND_CHAR:      return 1;
+    case TSDB_KIND_INT16:     return 2;
+    case TSDB_KIND_INT32:
+    case TSDB_KIND_TAG:
+    case TSDB_KIND_FLOAT:     return 4;
+    case TSDB_KIND_INT64:
+    case TSDB_KIND_DOUBLE:
+    case TSDB_KIND_TIMESTAMP:
+    case TSDB_KIND_DATE:      return 8;
+    case TSDB_KIND_STRING:    return TSDB_STRING_WIDTH;
+    case TSDB_KIND_HEAP:      return TSDB_HEAP_REF_WIDTH;
+    default:                  return 0;
+  }
+}
+
+/*
+    @function tsdb_column_width
+    @brief bytes taken by a value of the column in a tsdb record
+    @details a DECIMAL slot is sized by the precision of the column
+*/
+uint tsdb_column_width(Field* field, tsdb_kind kind)
+{
+  return kind == TSDB_KIND_DECIMAL ? field->pack_length() : tsdb_kind_width(kind);
+}
+
+//length of a zero padded value
+static inline uint padded_length(const uchar* from, uint width)
+{
+  while ( width > 0 && from[width - 1] == 0 )
+    width--;
+  return width;
+}
+
+//little endian length of 1 to 4 bytes, VARCHAR prefix or BLOB length
+static inline uint32 read_length(const uchar* from, uint bytes)
+{
+  switch (bytes)
+  {
+    case 1:  return *from;
+    case 2:  return uint2korr(from);
+    case 3:  return uint3korr(from);
+    default: return uint4korr(from);
+  }
+}
+
+static inline void store_length(uchar* to, uint bytes, uint32 length)
+{
+  switch (bytes)
+  {
+    case 1:  *to = (uchar)length; break;
+    case 2:  int2store(to, length); break;
+    case 3:  int3store(to, length); break;
+    default: int4store(to, length); break;
+  }
+}
+
+
+/*
+    @function tsdb_row_codec::build
+    @brief compute the ops converting the rows of table
+    @params tsdb_record_size size of a record of the tsdb structure
+            format TSDB_FORMAT_* of the file
+    @return true if the table can go through the codec; tables whose
+            layout does not match the structure keep Field::pack()/unpack()
+*/
+bool tsdb_row_codec::build(TABLE* table, size_t tsdb_record_size, int format)
+{
+  uint dst = 8;       //_TSDB_timestamp
+  ops.clear();
+  valid = false;
+  heap_ops = 0;
+
+  for ( Field** mfield = table->field; *mfield; mfield++)
+  {
+    Field* field = *mfield;
+    tsdb_kind kind = tsdb_column_kind(field, format);
+    if ( kind == TSDB_KIND_NONE )
+      return false;
+
+    tsdb_codec_op op;
+    op.field_index = field->field_index;
+    op.src = field->offset(table->record[0]);
+    op.dst = dst;
+    op.width = tsdb_column_width(field, kind);
+    op.src_width = field->pack_length();
+    op.null_pos = field->real_maybe_null() ? field->null_offset() : 0;
+    op.null_bit = field->real_maybe_null() ? field->null_bit : 0;
+    op.kind = kind;
+    op.kernel = TSDB_KERNEL_COPY;
+    op.length_bytes = 0;
+    op.is_unsigned = (field->flags & UNSIGNED_FLAG) != 0;
+    op.precision = 0;
+    op.scale = 0;
+    op.dict = NULL;
+
+    switch (kind)
+    {
+      case TSDB_KIND_INT32:
+        if ( op.src_width < 4 )
+          op.kernel = TSDB_KERNEL_INT_WIDEN;
+        break;
+      case TSDB_KIND_DOUBLE:
+        if ( field->real_type() == MYSQL_TYPE_FLOAT )
+          op.kernel = TSDB_KERNEL_FLOAT;
+        else if ( field->real_type() != MYSQL_TYPE_DOUBLE )
+          op.kernel = TSDB_KERNEL_GENERIC;
+        break;
+      case TSDB_KIND_DECIMAL:
+        op.precision = static_cast<Field_new_decimal*>(field)->precision;
+        op.scale = field->decimals();
+        break;
+      case TSDB_KIND_STRING:
+      case TSDB_KIND_TAG:
+        //the image keeps the trailing zeros and spaces of a value
+        if ( field->real_type() == MYSQL_TYPE_VARCHAR )
+        {
+          op.kernel = kind == TSDB_KIND_STRING && format >= TSDB_FORMAT_IMAGE
+                      ? TSDB_KERNEL_VARCOPY : TSDB_KERNEL_VARSTRING;
+          op.length_bytes = static_cast<Field_varstring*>(field)->length_bytes;
+        }
+        else if ( field->real_type() == MYSQL_TYPE_STRING && kind == TSDB_KIND_STRING &&
+                  format >= TSDB_FORMAT_IMAGE && op.src_width <= TSDB_STRING_WIDTH )
+          op.kernel = TSDB_KERNEL_COPY;
+        else if ( field->real_type() == MYSQL_TYPE_STRING )
+        {
+          //a multi-byte value longer than the slot is cut on a character
+          const CHARSET_INFO* cs = field->charset();
+          op.kernel = cs->mbminlen == 1 && (cs->mbmaxlen == 1 || op.src_width <= TSDB_STRING_WIDTH)
+                      ? TSDB_KERNEL_CHAR : TSDB_KERNEL_GENERIC;
+        }
+        break;
+      case TSDB_KIND_HEAP:
+        if ( field->real_type() == MYSQL_TYPE_VARCHAR )
+        {
+          op.kernel = TSDB_KERNEL_VARSTRING;
+          op.length_bytes = static_cast<Field_varstring*>(field)->length_bytes;
+        }
+        else if ( field->flags & BLOB_FLAG )
+        {
+          op.kernel = TSDB_KERNEL_BLOB;
+          op.length_bytes = static_cast<Field_blob*>(field)->pack_length_no_ptr();
+        }
+        else
+          return false;
+        heap_ops++;
+        break;
+      default:
+        break;
+    }
+    //the kernels of a tag convert the value, not the code
+    uint value_width = kind == TSDB_KIND_TAG ? TSDB_STRING_WIDTH : op.width;
+    if ( op.kernel == TSDB_KERNEL_COPY && op.src_width > value_width )
+      return false;
+
+    ops.push_back(op);
+    dst += op.width;
+  }
+
+  null_offset = dst;
+  null_bytes = table->s->null_bytes;
+  record_size = dst + null_bytes;
+  valid = record_size == tsdb_record_size;
+  return valid;
+}
+
+
+/*
+    @function tsdb_row_codec::encode
+    @brief convert a mysql row into a tsdb record, _TSDB_timestamp excepted
+    @params heap receives the heap values of the row; the references are
+            from the start of the buffer until rebase()
+*/
+void tsdb_row_codec::encode(TABLE* table, const uchar* row, uchar* record,
+                            tsdb_heap_buffer* heap) const
+{
+  memset(record + 8, 0, record_size - 8);
+  memcpy(record + null_offset, row, null_bytes);
+
+  for ( std::vector<tsdb_codec_op>::const_iterator op = ops.begin();
+        op != ops.end(); ++op)
+  {
+    if ( op->null_bit && (row[op->null_pos] & op->null_bit) )
+      continue;
+    const uchar* from = row + op->src;
+    uchar* to = record + op->dst;
+    if ( op->kind == TSDB_KIND_HEAP )
+    {
+      uint32 length = read_length(from, op->length_bytes);
+      const uchar* data = from + op->length_bytes;
+      if ( op->kernel == TSDB_KERNEL_BLOB )
+        memcpy(&data, from + op->length_bytes, sizeof(data));
+      if ( heap == NULL || data == NULL )
+        length = 0;
+      int8store(to, (ulonglong)(heap ? heap->size() : 0));
+      int4store(to + 8, length);
+      if ( length > 0 )
+        heap->insert(heap->end(), data, data + length);
+      continue;
+    }
+    uint width = op->width;
+    uchar value[TSDB_STRING_WIDTH];
+    if ( op->dict != NULL )
+    {
+      memset(value, 0, sizeof(value));
+      to = value;
+      width = TSDB_STRING_WIDTH;
+    }
+
+    switch (op->kernel)
+    {
+      case TSDB_KERNEL_COPY:
+        memcpy(to, from, op->src_width);
+        break;
+      case TSDB_KERNEL_INT_WIDEN:
+      {
+        int32 v;
+        switch (op->src_width)
+        {
+          case 1:  v = op->is_unsigned ? (int32)*from : (int32)(int8)*from; break;
+          case 2:  v = op->is_unsigned ? (int32)uint2korr(from) : (int32)sint2korr(from); break;
+          default: v = op->is_unsigned ? (int32)uint3korr(from) : (int32)sint3korr(from); break;
+        }
+        int4store(to, v);
+        break;
+      }
+      case TSDB_KERNEL_FLOAT:
+      {
+        float f;
+        float4get(f, from);
+        double d = f;
+        float8store(to, d);
+        break;
+      }
+      case TSDB_KERNEL_VARSTRING:
+      {
+        uint len = op->length_bytes == 1 ? (uint)*from : uint2korr(from);
+        if ( len > width )
+          len = width;
+        memcpy(to, from + op->length_bytes, len);
+        break;
+      }
+      case TSDB_KERNEL_VARCOPY:
+        memcpy(to, from, op->length_bytes + read_length(from, op->length_bytes));
+        break;
+      case TSDB_KERNEL_CHAR:
+      {
+        uint len = op->src_width;
+        while ( len > 0 && from[len - 1] == ' ' )
+          len--;
+        if ( len > width )
+          len = width;
+        memcpy(to, from, len);
+        break;
+      }
+      case TSDB_KERNEL_GENERIC:
+      {
+        Field* field = table->field[op->field_index];
+        my_ptrdiff_t offset = row - table->record[0];
+        field->move_field_offset(offset);
+        if ( op->kind == TSDB_KIND_DOUBLE )
+        {
+          double d = field->val_real();
+          float8store(to, d);
+        }
+        else
+        {
+          char buff[TSDB_STRING_WIDTH];
+          const CHARSET_INFO* cs = field->charset();
+          String str(buff, sizeof(buff), cs);
+          field->val_str(&str);
+          size_t len = str.length();
+          if ( len > width )
+          {
+            int error;
+            len = cs->cset->well_formed_len(cs, str.ptr(), str.ptr() + width, width, &error);
+          }
+          memcpy(to, str.ptr(), len);
+        }
+        field->move_field_offset(-offset);
+        break;
+      }
+    }
+    if ( op->dict != NULL )
+      int4store(record + op->dst, op->dict->code(value, padded_length(value, width)));
+  }
+}
+
+
+/*
+    @function tsdb_row_codec::decode
+    @brief convert a tsdb record into a mysql row
+    @details columns not in table->read_set are left untouched; heap
+             values are taken from the window, see heap_range()
+*/
+void tsdb_row_codec::decode(TABLE* table, const uchar* record, uchar* row,
+                            const tsdb_heap_window* heap) const
+{
+  memcpy(row, record + null_offset, null_bytes);
+
+  for ( std::vector<tsdb_codec_op>::const_iterator op = ops.begin();
+        op != ops.end(); ++op)
+  {
+    if ( !bitmap_is_set(table->read_set, op->field_index) ||
+         (op->null_bit && (row[op->null_pos] & op->null_bit)) )
+      continue;
+    const uchar* from = record + op->dst;
+    uchar* to = row + op->src;
+    if ( op->kind == TSDB_KIND_HEAP )
+    {
+      uint32 length = uint4korr(from + 8);
+      const uchar* data = heap ? heap->at(uint8korr(from), length) : NULL;
+      if ( data == NULL )
+        length = 0;
+      if ( op->kernel == TSDB_KERNEL_BLOB )
+      {
+        //the row points into the window, valid until the next row is read
+        store_length(to, op->length_bytes, length);
+        memcpy(to + op->length_bytes, &data, sizeof(data));
+      }
+      else
+      {
+        if ( length > op->src_width - op->length_bytes )
+          length = op->src_width - op->length_bytes;
+        store_length(to, op->length_bytes, length);
+        if ( length > 0 )
+          memcpy(to + op->length_bytes, data, length);
+      }
+      continue;
+    }
+    uint width = op->width;
+    uchar value[TSDB_STRING_WIDTH];
+    if ( op->dict != NULL )
+    {
+      op->dict->value(sint4korr(from), value);
+      from = value;
+      width = TSDB_STRING_WIDTH;
+    }
+
+    switch (op->kernel)
+    {
+      case TSDB_KERNEL_COPY:
+        memcpy(to, from, op->src_width);
+        break;
+      case TSDB_KERNEL_INT_WIDEN:
+      {
+        int32 v = sint4korr(from);
+        switch (op->src_width)
+        {
+          case 1:  *to = (uchar)v; break;
+          case 2:  int2store(to, v); break;
+          default: int3store(to, v); break;
+        }
+        break;
+      }
+      case TSDB_KERNEL_FLOAT:
+      {
+        double d;
+        float8get(d, from);
+        float f = (float)d;
+        float4store(to, f);
+        break;
+      }
+      case TSDB_KERNEL_VARSTRING:
+      {
+        uint len = padded_length(from, width);
+        if ( len > op->src_width - op->length_bytes )
+          len = op->src_width - op->length_bytes;
+        if ( op->length_bytes == 1 )
+          *to = (uchar)len;
+        else
+          int2store(to, len);
+        memcpy(to + op->length_bytes, from, len);
+        break;
+      }
+      case TSDB_KERNEL_VARCOPY:
+        memcpy(to, from, op->length_bytes + read_length(from, op->length_bytes));
+        break;
+      case TSDB_KERNEL_CHAR:
+      {
+        uint len = padded_length(from, MY_MIN(width, op->src_width));
+        memcpy(to, from, len);
+        memset(to + len, ' ', op->src_width - len);
+        break;
+      }
+      case TSDB_KERNEL_GENERIC:
+      {
+        Field* field = table->field[op->field_index];
+        my_ptrdiff_t offset = row - table->record[0];
+        my_bitmap_map *old_map = dbug_tmp_use_all_columns(table, table->write_set);
+        field->move_field_offset(offset);
+        if ( op->kind == TSDB_KIND_DOUBLE )
+        {
+          double d;
+          float8get(d, from);
+          field->store(d);
+        }
+        else
+          field->store((const char*)from, padded_length(from, width), field->charset());
+        field->move_field_offset(-offset);
+        dbug_tmp_restore_column_map(table->write_set, old_map);
+        break;
+      }
+    }
+  }
+}
+
+
+/*
+    @function tsdb_row_codec::numeric
+    @brief true if the stored value of column col is a number
+*/
+bool tsdb_row_codec::numeric(uint col) const
+{
+  switch (ops[col].kind)
+  {
+    case TSDB_KIND_INT8:
+    case TSDB_KIND_INT16:
+    case TSDB_KIND_INT32:
+    case TSDB_KIND_INT64:
+    case TSDB_KIND_FLOAT:
+    case TSDB_KIND_DOUBLE:
+    case TSDB_KIND_DECIMAL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/*
+    @function tsdb_row_codec::is_null
+    @brief true if column col is NULL in a tsdb record
+*/
+bool tsdb_row_codec::is_null(const uchar* record, uint col) const
+{
+  const tsdb_codec_op& op = ops[col];
+  return op.null_bit && (record[null_offset + op.null_pos] & op.null_bit);
+}
+
+/*
+    @function tsdb_row_codec::set_null
+    @brief mark column col NULL in a tsdb record
+*/
+void tsdb_row_codec::set_null(uchar* record, uint col) const
+{
+  const tsdb_codec_op& op = ops[col];
+  if ( op.null_bit )
+    record[null_offset + op.null_pos] |= op.null_bit;
+}
+
+/*
+    @function tsdb_row_codec::heap_range
+    @brief heap bytes holding the values of the read_set columns of a record
+    @return false if decoding the record reads nothing from the heap
+*/
+bool tsdb_row_codec::heap_range(TABLE* table, const uchar* record,
+                                uint64* from, uint64* to) const
+{
+  *from = ULLONG_MAX;
+  *to = 0;
+  for ( std::vector<tsdb_codec_op>::const_iterator op = ops.begin();
+        heap_ops > 0 && op != ops.end(); ++op)
+  {
+    if ( op->kind != TSDB_KIND_HEAP || !bitmap_is_set(table->read_set, op->field_index) ||
+         (op->null_bit && (record[null_offset + op->null_pos] & op->null_bit)) )
+      continue;
+    uint64 offset = uint8korr(record + op->dst);
+    uint32 length = uint4korr(record + op->dst + 8);
+    if ( length == 0 )
+      continue;
+    *from = MY_MIN(*from, offset);
+    *to = MY_MAX(*to, offset + length);
+  }
+  return *from < *to;
+}
+
+/*
+    @function tsdb_row_codec::rebase
+    @brief move the heap references of n records by base, once the values
+           encode() collected are appended to the heap at base
+*/
+void tsdb_row_codec::rebase(uchar* records, uint64 n, uint64 base) const
+{
+  for ( uint64 r = 0; r < n && heap_ops > 0; r++ )
+  {
+    uchar* record = records + r * record_size;
+    for ( std::vector<tsdb_codec_op>::const_iterator op = ops.begin();
+          op != ops.end(); ++op)
+    {
+      if ( op->kind == TSDB_KIND_HEAP && uint4korr(record + op->dst + 8) > 0 )
+        int8store(record + op->dst, uint8korr(record + op->dst) + base);
+    }
+  }
+}
+
+/*
+    @function tsdb_row_codec::value
+    @brief numeric value of column col in a tsdb record
+    @return false if the column is NULL in the record
+*/
+bool tsdb_row_codec::value(const uchar* record, uint col, double* v) const
+{
+  const tsdb_codec_op& op = ops[col];
+  const uchar* from = record + op.dst;
+  if ( is_null(record, col) )
+    return false;
+  switch (op.kind)
+  {
+    case TSDB_KIND_INT8:
+      *v = op.is_unsigned ? (double)*from : (double)(int8)*from;
+      break;
+    case TSDB_KIND_INT16:
+      *v = op.is_unsigned ? (double)uint2korr(from) : (double)sint2korr(from);
+      break;
+    case TSDB_KIND_FLOAT:
+    {
+      float f;
+      float4get(f, from);
+      *v = f;
+      break;
+    }
+    case TSDB_KIND_INT32:
+      *v = op.is_unsigned && op.src_width == 4 ? (double)uint4korr(from)
+                                               : (double)sint4korr(from);
+      break;
+    case TSDB_KIND_INT64:
+      *v = op.is_unsigned ? (double)uint8korr(from) : (double)sint8korr(from);
+      break;
+    case TSDB_KIND_DECIMAL:
+    {
+      my_decimal d;
+      binary2my_decimal(E_DEC_FATAL_ERROR, from, &d, op.precision, op.scale);
+      my_decimal2double(E_DEC_FATAL_ERROR, &d, v);
+      break;
+    }
+    default:
+      float8get(*v, from);
+      break;
+  }
+  return true;
+}
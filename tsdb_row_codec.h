@@ -0,0 +1,139 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_row_codec.h
+    @brief conversion between mysql rows and tsdb records
+*/
+#pragma once
+#include "my_global.h"
+#include "my_bitmap.h"
+#include "tsdb_heap.h"
+#include <vector>
+
+struct TABLE;
+class Field;
+class tsdb_dictionary;
+
+//record layout of a .tsdb file, kept in its TSDB_FORMAT_ATTR root attribute
+#define TSDB_FORMAT_PACKED 0    ///< Field::pack() layout, no attribute
+#define TSDB_FORMAT_CODEC  1    ///< tsdb_row_codec layout, narrow integers and FLOAT widened
+#define TSDB_FORMAT_NARROW 2    ///< tsdb_row_codec layout, every column at its own width
+#define TSDB_FORMAT_HEAP   3    ///< long VARCHAR and BLOB values in the heap, see tsdb_heap.h
+#define TSDB_FORMAT_DECIMAL 4   ///< DECIMAL values in their binary image
+#define TSDB_FORMAT_IMAGE  5    ///< CHAR and VARCHAR values as in the row
+#define TSDB_FORMAT_CURRENT TSDB_FORMAT_IMAGE   ///< layout of new files
+
+/*
+@brief storage class of a column in the tsdb structure
+
+CreateTSDBStructure() and the row codec both derive the tsdb field of a
+column from tsdb_column_kind(), so the record layout is defined once.
+Files written before TSDB_FORMAT_NARROW widen TINYINT/SMALLINT to int32
+and FLOAT to double; the narrow kinds store them at their own width.
+String columns listed in the tsdb_tags= option are tags: the slot holds
+the int32 code of the value in the dictionary of the column. From
+TSDB_FORMAT_HEAP on, BLOB/TEXT/JSON columns and VARCHAR longer than
+TSDB_STRING_WIDTH bytes keep their value in the heap; the slot holds its
+offset and length. From TSDB_FORMAT_DECIMAL on, a DECIMAL slot is the
+binary image of the column, as wide as Field::pack_length(); older files
+store a double. From TSDB_FORMAT_IMAGE on, a CHAR slot is the image of
+the column and a VARCHAR slot its length prefix and value, so BINARY and
+VARBINARY values keep their trailing zeros and spaces; a VARCHAR whose
+image is longer than TSDB_STRING_WIDTH bytes goes to the heap.
+*/
+enum tsdb_kind
+{
+  TSDB_KIND_NONE,         ///< column is not stored
+  TSDB_KIND_INT8,
+  TSDB_KIND_INT16,
+  TSDB_KIND_INT32,
+  TSDB_KIND_INT64,
+  TSDB_KIND_FLOAT,
+  TSDB_KIND_DOUBLE,
+  TSDB_KIND_TIMESTAMP,
+  TSDB_KIND_DATE,
+  TSDB_KIND_CHAR,
+  TSDB_KIND_STRING,
+  TSDB_KIND_TAG,
+  TSDB_KIND_HEAP,
+  TSDB_KIND_DECIMAL
+};
+
+#define TSDB_STRING_WIDTH 255
+//heap reference: 8 bytes offset, 4 bytes length
+#define TSDB_HEAP_REF_WIDTH 12
+
+tsdb_kind tsdb_column_kind(Field* field, int format);
+uint tsdb_kind_width(tsdb_kind kind);
+uint tsdb_column_width(Field* field, tsdb_kind kind);
+
+/*
+@brief copy kernel used for one column, chosen when the codec is built
+*/
+enum tsdb_codec_kernel
+{
+  TSDB_KERNEL_COPY,           ///< same bytes on both sides
+  TSDB_KERNEL_INT_WIDEN,      ///< 1..3 byte integer <-> int32
+  TSDB_KERNEL_FLOAT,          ///< float <-> double
+  TSDB_KERNEL_VARSTRING,      ///< length prefixed <-> zero padded
+  TSDB_KERNEL_CHAR,           ///< space padded <-> zero padded
+  TSDB_KERNEL_BLOB,           ///< length and pointer <-> heap reference
+  TSDB_KERNEL_VARCOPY,        ///< length prefix and value, on both sides
+  TSDB_KERNEL_GENERIC         ///< through Field::val_real()/val_str()/store()
+};
+
+struct tsdb_codec_op
+{
+  uint field_index;           ///< position in table->field
+  uint src;                   ///< offset in record[0]
+  uint dst;                   ///< offset in the tsdb record
+  uint width;                 ///< bytes of the value in the tsdb record
+  uint src_width;             ///< bytes of the value in record[0]
+  uint null_pos;              ///< null byte offset in record[0]
+  uchar null_bit;             ///< 0 if the column is NOT NULL
+  uchar kind;                 ///< tsdb_kind of the slot
+  uchar kernel;
+  uchar length_bytes;         ///< VARCHAR length prefix, BLOB length bytes
+  bool is_unsigned;
+  uchar precision;            ///< DECIMAL precision and scale, see value()
+  uchar scale;
+  tsdb_dictionary* dict;      ///< codes of a tag column, see tsdb_tags::open()
+};
+
+/*
+@brief tsdb_row_codec converts rows with a flat list of precomputed ops
+
+Layout of a record: the 8 bytes _TSDB_timestamp, one slot per stored
+column in table order, then the null bytes of the row. It is built once per
+table share; write_row() and the scans run through it instead of walking
+table->field with Field::pack()/unpack().
+*/
+class tsdb_row_codec
+{
+  public:
+  tsdb_row_codec() : valid(false), null_offset(0), null_bytes(0), record_size(0), heap_ops(0) {}
+
+  bool build(TABLE* table, size_t tsdb_record_size, int format);
+  void encode(TABLE* table, const uchar* row, uchar* record, tsdb_heap_buffer* heap) const;
+  void decode(TABLE* table, const uchar* record, uchar* row, const tsdb_heap_window* heap) const;
+
+  uint columns() const { return ops.size(); }
+  const tsdb_codec_op& op(uint col) const { return ops[col]; }
+  void set_dictionary(uint col, tsdb_dictionary* dict) { ops[col].dict = dict; }
+  bool numeric(uint col) const;
+  bool is_null(const uchar* record, uint col) const;
+  void set_null(uchar* record, uint col) const;
+
+  bool heap_columns() const { return heap_ops > 0; }
+  bool heap_range(TABLE* table, const uchar* record, uint64* from, uint64* to) const;
+  void rebase(uchar* records, uint64 n, uint64 base) const;
+  bool value(const uchar* record, uint col, double* v) const;
+
+  bool valid;
+
+  private:
+  std::vector<tsdb_codec_op> ops;
+  uint null_offset;
+  uint null_bytes;
+  size_t record_size;
+  uint heap_ops;
+};
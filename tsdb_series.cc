@@ -0,0 +1,616 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_series.cc
+    @brief tsdb_series_set implementation
+*/
+
+#include "PCHfile.h"
+#include "sql_class.h"
+#include "ha_tsdb_engine.h"
+#include "tsdb_series.h"
+#include "log.h"
+
+
+/*
+    @function tsdb_series_column
+    @brief true if the tsdb_series= option of the table lists the column
+*/
+bool tsdb_series_column(Field* field)
+{
+  std::vector<std::string> names;
+  if ( field->table == NULL )
+    return false;
+  tsdb_table_option_list(field->table->s, TSDB_OPT_SERIES, &names);
+  for ( size_t i = 0; i < names.size(); i++ )
+  {
+    if ( my_strcasecmp(system_charset_info, names[i].c_str(), field->field_name) == 0 )
+      return true;
+  }
+  return false;
+}
+
+/*
+    @function tsdb_series_valid
+    @brief every column of the tsdb_series= option is an integer or a
+           string column stored in the record, and the table uses nothing
+           addressing the records by their position in a single series
+*/
+bool tsdb_series_valid(TABLE* table)
+{
+  std::vector<std::string> names;
+  if ( !tsdb_table_option_list(table->s, TSDB_OPT_SERIES, &names) )
+    return true;
+  if ( names.empty() )
+  {
+    push_warning_printf(current_thd, Sql_condition::SL_WARNING, ER_ILLEGAL_HA_CREATE_OPTION,
+                        "tsdb_engine: " TSDB_OPT_SERIES " lists no column");
+    return false;
+  }
+  std::string option;
+  if ( table->s->keys > 0 || tsdb_table_option(table->s, TSDB_OPT_PARTITION, &option) ||
+       tsdb_table_option(table->s, TSDB_OPT_RETENTION, &option) ||
+       tsdb_table_option(table->s, TSDB_OPT_TAGS, &option) )
+  {
+    push_warning_printf(current_thd, Sql_condition::SL_WARNING, ER_ILLEGAL_HA_CREATE_OPTION,
+                        "tsdb_engine: " TSDB_OPT_SERIES " does not go with an index, "
+                        TSDB_OPT_PARTITION ", " TSDB_OPT_RETENTION " or " TSDB_OPT_TAGS);
+    return false;
+  }
+  for ( size_t i = 0; i < names.size(); i++ )
+  {
+    Field** mfield = table->field;
+    for ( ; *mfield; mfield++ )
+    {
+      if ( my_strcasecmp(system_charset_info, names[i].c_str(), (*mfield)->field_name) == 0 )
+        break;
+    }
+    switch ( *mfield ? tsdb_column_kind(*mfield, TSDB_FORMAT_CURRENT) : TSDB_KIND_NONE )
+    {
+      case TSDB_KIND_INT8:
+      case TSDB_KIND_INT16:
+      case TSDB_KIND_INT32:
+      case TSDB_KIND_INT64:
+      case TSDB_KIND_CHAR:
+      case TSDB_KIND_STRING:
+        break;
+      default:
+        push_warning_printf(current_thd, Sql_condition::SL_WARNING, ER_ILLEGAL_HA_CREATE_OPTION,
+                            "tsdb_engine: series key '%s' is not an integer or a string column",
+                            names[i].c_str());
+        return false;
+    }
+  }
+  return true;
+}
+
+
+//tsdb_series_set impl
+
+//ctor
+tsdb_series_set::tsdb_series_set()
+{
+  share = NULL;
+}
+
+//dtor
+tsdb_series_set::~tsdb_series_set()
+{
+  close();
+}
+
+/*
+    @function tsdb_series_set::open
+    @brief open the series datasets of a table with the tsdb_series= option
+    @details the record count and the time range of the share become the
+             ones of all the series
+    @return mysql error code; tables without the option return 0
+    @note caller must hold share->mutex, the codec must be built
+*/
+int tsdb_series_set::open(tsdb_engine_share* inShare, TABLE* table)
+{
+  std::vector<std::string> names;
+  if ( share != NULL || !tsdb_table_option_list(table->s, TSDB_OPT_SERIES, &names) )
+    return 0;
+
+  const tsdb_row_codec& codec = inShare->codec;
+  hid_t file = inShare->file_id;
+  if ( !codec.valid || inShare->records_type < 0 )
+  {
+    sql_print_error("tsdb_engine: the records of a series table must have a column layout");
+    return HA_ERR_CRASHED_ON_USAGE;
+  }
+  columns.clear();
+  for ( uint col = 0; col < codec.columns(); col++ )
+  {
+    if ( tsdb_series_column(table->field[codec.op(col).field_index]) )
+      columns.push_back(col);
+  }
+  if ( columns.size() != names.size() )
+  {
+    sql_print_error("tsdb_engine: series key columns not found in the records");
+    return HA_ERR_CRASHED_ON_USAGE;
+  }
+
+  if ( H5Lexists(file, TSDB_SERIES_GROUP, H5P_DEFAULT) <= 0 )
+  {
+    hid_t group = H5Gcreate2(file, TSDB_SERIES_GROUP, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if ( group < 0 )
+      return HA_ERR_INTERNAL_ERROR;
+    H5Gclose(group);
+  }
+  share = inShare;
+
+  //catalog saved by close(): rows of records, first ts, last ts
+  std::vector<long long> catalog;
+  hsize_t dims[2] = { 0, 3 };
+  if ( H5Lexists(file, TSDB_SERIES_CATALOG, H5P_DEFAULT) > 0 &&
+       H5LTget_dataset_info(file, TSDB_SERIES_CATALOG, dims, NULL, NULL) >= 0 && dims[0] > 0 )
+  {
+    catalog.resize(dims[0] * 3);
+    if ( H5LTread_dataset_long_long(file, TSDB_SERIES_CATALOG, &catalog[0]) < 0 )
+      catalog.clear();
+  }
+  for ( uint id = 0; ; id++ )
+  {
+    char path[64];
+    snprintf(path, sizeof(path), TSDB_SERIES_GROUP "/%u", id);
+    if ( H5Lexists(file, path, H5P_DEFAULT) <= 0 )
+      break;
+    int rc = load(id, catalog);
+    if ( rc < 0 )
+      break;
+    if ( rc )
+    {
+      //the catalog is kept for the next open
+      share = NULL;
+      close();
+      return rc;
+    }
+  }
+  stats();
+  return 0;
+}
+
+/*
+    @function tsdb_series_set::load
+    @brief open the dataset of series id and take its key and time range
+    @details the range comes from the catalog when its count matches,
+             otherwise from the first and last records
+    @return mysql error code, -1 for a series created by a crashed insert
+            before it got a key and records: it is removed
+*/
+int tsdb_series_set::load(uint id, const std::vector<long long>& catalog)
+{
+  hid_t file = share->file_id;
+  char path[64];
+  snprintf(path, sizeof(path), TSDB_SERIES_GROUP "/%u", id);
+
+  entry* s = new entry;
+  s->dset = H5Dopen2(file, path, H5P_DEFAULT);
+  s->records = 0;
+  s->first_ts = s->last_ts = 0;
+  if ( s->dset < 0 )
+  {
+    delete s;
+    return HA_ERR_CRASHED_ON_USAGE;
+  }
+  hsize_t extent = 0;
+  hid_t space = H5Dget_space(s->dset);
+  H5Sget_simple_extent_dims(space, &extent, NULL);
+  H5Sclose(space);
+  series.push_back(s);
+
+  tsdb_block block;
+  hsize_t dims[1] = { 0 };
+  size_t size = 0;
+  H5T_class_t type_class;
+  std::vector<uchar> key;
+  if ( H5Aexists(s->dset, TSDB_SERIES_KEY) > 0 &&
+       H5LTget_attribute_info(file, path, TSDB_SERIES_KEY, dims, &type_class, &size) >= 0 &&
+       dims[0] > 0 )
+  {
+    key.resize(dims[0]);
+    if ( H5LTget_attribute_uchar(file, path, TSDB_SERIES_KEY, &key[0]) >= 0 )
+      s->key.assign((const char*)&key[0], key.size());
+  }
+  if ( s->key.empty() )
+  {
+    if ( extent == 0 )
+    {
+      series.pop_back();
+      H5Dclose(s->dset);
+      delete s;
+      H5Ldelete(file, path, H5P_DEFAULT);
+      return -1;
+    }
+    s->records = extent;
+    if ( fetch(id, 0, 1, &block) || block.count == 0 )
+      return HA_ERR_CRASHED_ON_USAGE;
+    s->key = key_of(block.record(0));
+  }
+  s->records = extent;
+  ids[s->key] = id;
+
+  if ( catalog.size() > id * 3 + 2 && catalog[id * 3] == (long long)extent )
+  {
+    s->first_ts = catalog[id * 3 + 1];
+    s->last_ts = catalog[id * 3 + 2];
+    return 0;
+  }
+  if ( extent > 0 )
+  {
+    if ( fetch(id, 0, 1, &block) || block.count == 0 )
+      return HA_ERR_CRASHED_ON_USAGE;
+    memcpy(&s->first_ts, block.record(0), 8);
+    if ( fetch(id, extent - 1, extent, &block) || block.count == 0 )
+      return HA_ERR_CRASHED_ON_USAGE;
+    memcpy(&s->last_ts, block.record(0), 8);
+  }
+  return 0;
+}
+
+/*
+    @function tsdb_series_set::close
+    @brief save the catalog and release the datasets
+    @note caller must hold share->mutex or be the share destructor
+*/
+void tsdb_series_set::close()
+{
+  if ( share != NULL )
+  {
+    hid_t file = share->file_id;
+    std::vector<long long> rows;
+    for ( size_t id = 0; id < series.size(); id++ )
+    {
+      rows.push_back(series[id]->records);
+      rows.push_back(series[id]->first_ts);
+      rows.push_back(series[id]->last_ts);
+    }
+    if ( H5Lexists(file, TSDB_SERIES_CATALOG, H5P_DEFAULT) > 0 )
+      H5Ldelete(file, TSDB_SERIES_CATALOG, H5P_DEFAULT);
+    hsize_t dims[2] = { series.size(), 3 };
+    if ( !rows.empty() &&
+         H5LTmake_dataset(file, TSDB_SERIES_CATALOG, 2, dims, H5T_NATIVE_LLONG, &rows[0]) < 0 )
+      sql_print_warning("tsdb_engine: cannot save the series catalog, it is rebuilt on open");
+  }
+  for ( size_t id = 0; id < series.size(); id++ )
+  {
+    if ( series[id]->dset >= 0 )
+      H5Dclose(series[id]->dset);
+    delete series[id];
+  }
+  series.clear();
+  ids.clear();
+  share = NULL;
+}
+
+/*
+    @function tsdb_series_set::key_column
+    @brief true if the table field is a column of the series key
+*/
+bool tsdb_series_set::key_column(uint field_index) const
+{
+  for ( size_t i = 0; i < columns.size(); i++ )
+  {
+    if ( share->codec.op(columns[i]).field_index == field_index )
+      return true;
+  }
+  return false;
+}
+
+//key of a tsdb record: per key column a NULL flag byte and the slot
+std::string tsdb_series_set::key_of(const uchar* record) const
+{
+  const tsdb_row_codec& codec = share->codec;
+  std::string key;
+  for ( size_t i = 0; i < columns.size(); i++ )
+  {
+    const tsdb_codec_op& op = codec.op(columns[i]);
+    bool null = codec.is_null(record, columns[i]);
+    key += null ? '\1' : '\0';
+    key.append((const char*)record + op.dst, op.width);
+  }
+  return key;
+}
+
+//the count and the time range of the share are the ones of all its series
+void tsdb_series_set::stats()
+{
+  bool any = false;
+  share->origin = 0;
+  share->records = 0;
+  share->first_ts = share->last_ts = 0;
+  for ( size_t id = 0; id < series.size(); id++ )
+  {
+    const entry* s = series[id];
+    if ( s->records == 0 )
+      continue;
+    share->records += s->records;
+    if ( !any || s->first_ts < share->first_ts )
+      share->first_ts = s->first_ts;
+    if ( !any || s->last_ts > share->last_ts )
+      share->last_ts = s->last_ts;
+    any = true;
+  }
+}
+
+/*
+    @function tsdb_series_set::records
+    @brief records of all the series
+*/
+uint64 tsdb_series_set::records() const
+{
+  uint64 total = 0;
+  for ( size_t id = 0; id < series.size(); id++ )
+    total += series[id]->records;
+  return total;
+}
+
+/*
+    @function tsdb_series_set::late
+    @brief first record of recs older than the last one of its series
+    @params in_batch the records of recs must also be in time order within
+            each series, no reorder buffer sorts them
+    @return its index in recs, n if there is none
+*/
+uint64 tsdb_series_set::late(const uchar* recs, uint64 n, bool in_batch) const
+{
+  std::map<std::string, longlong> last;
+  for ( uint64 r = 0; r < n; r++ )
+  {
+    const uchar* record = recs + r * share->record_size;
+    std::string key = key_of(record);
+    longlong ts;
+    memcpy(&ts, record, 8);
+    std::map<std::string, longlong>::iterator it = last.find(key);
+    if ( it == last.end() )
+    {
+      std::map<std::string, uint>::const_iterator id = ids.find(key);
+      longlong low = LLONG_MIN;
+      if ( id != ids.end() && series[id->second]->records > 0 )
+        low = series[id->second]->last_ts;
+      it = last.insert(std::make_pair(key, low)).first;
+    }
+    if ( ts < it->second )
+      return r;
+    if ( in_batch )
+      it->second = ts;
+  }
+  return n;
+}
+
+/*
+    @function tsdb_series_set::append
+    @brief append n records, each one to the series of its key
+    @details the records of a series keep their order in recs; a new key
+             creates its series
+    @return mysql error code; on error some series may have their records
+            and others not, records() tells how many went in
+*/
+int tsdb_series_set::append(const uchar* recs, uint64 n)
+{
+  std::map<uint, std::vector<uint64> > rows;
+  for ( uint64 r = 0; r < n; r++ )
+  {
+    std::string key = key_of(recs + r * share->record_size);
+    std::map<std::string, uint>::const_iterator it = ids.find(key);
+    uint id;
+    if ( it != ids.end() )
+      id = it->second;
+    else
+    {
+      int rc = create(key, &id);
+      if ( rc )
+        return rc;
+    }
+    rows[id].push_back(r);
+  }
+
+  std::vector<uchar> gathered;
+  for ( std::map<uint, std::vector<uint64> >::const_iterator it = rows.begin();
+        it != rows.end(); ++it)
+  {
+    const std::vector<uint64>& list = it->second;
+    const uchar* from = recs + list[0] * share->record_size;
+    //records of one series only: append them in place
+    if ( list.size() < n )
+    {
+      gathered.resize(list.size() * share->record_size);
+      for ( size_t i = 0; i < list.size(); i++ )
+        memcpy(&gathered[i * share->record_size], recs + list[i] * share->record_size,
+               share->record_size);
+      from = &gathered[0];
+    }
+    int rc = write(series[it->first], from, list.size());
+    if ( rc )
+      return rc;
+  }
+  return 0;
+}
+
+/*
+    @function tsdb_series_set::create
+    @brief create the dataset of a new series, its key saved with it
+    @params id set to the id of the series
+    @return mysql error code
+*/
+int tsdb_series_set::create(const std::string& key, uint* id)
+{
+  hid_t file = share->file_id;
+  char path[64];
+  *id = series.size();
+  snprintf(path, sizeof(path), TSDB_SERIES_GROUP "/%u", *id);
+
+  hsize_t dims[1] = { 0 };
+  hsize_t maxdims[1] = { H5S_UNLIMITED };
+  hsize_t chunk[1] = { TSDB_SERIES_CHUNK };
+  hid_t space = H5Screate_simple(1, dims, maxdims);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 1, chunk);
+  hid_t dset = H5Dcreate2(file, path, share->records_type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  if ( dset < 0 ||
+       H5LTset_attribute_uchar(file, path, TSDB_SERIES_KEY,
+                               (const unsigned char*)key.data(), key.size()) < 0 )
+  {
+    sql_print_error("tsdb_engine: cannot create the series %s", path);
+    if ( dset >= 0 )
+      H5Dclose(dset);
+    return HA_ERR_INTERNAL_ERROR;
+  }
+
+  entry* s = new entry;
+  s->key = key;
+  s->dset = dset;
+  s->records = 0;
+  s->first_ts = s->last_ts = 0;
+  series.push_back(s);
+  ids[key] = *id;
+  return 0;
+}
+
+//append n records of one series to its dataset
+int tsdb_series_set::write(entry* s, const uchar* recs, uint64 n)
+{
+  size_t bytes = n * share->record_size;
+  tsdb_file_wait wait(PSI_FILE_WRITE, share->psi_file, bytes, __FILE__, __LINE__);
+  hsize_t dims[1] = { s->records + n };
+  hsize_t start[1] = { s->records };
+  hsize_t count[1] = { n };
+  herr_t err = H5Dset_extent(s->dset, dims);
+  hid_t space = H5Dget_space(s->dset);
+  hid_t mspace = H5Screate_simple(1, count, NULL);
+  if ( err >= 0 )
+    err = H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+  if ( err >= 0 )
+    err = H5Dwrite(s->dset, share->records_type, mspace, space, H5P_DEFAULT, recs);
+  H5Sclose(mspace);
+  H5Sclose(space);
+  wait.end(err < 0 ? 0 : bytes);
+  if ( err < 0 )
+  {
+    sql_print_error("tsdb_engine: cannot append %llu records to a series", (ulonglong)n);
+    return HA_ERR_INTERNAL_ERROR;
+  }
+  if ( s->records == 0 )
+    memcpy(&s->first_ts, recs, 8);
+  memcpy(&s->last_ts, recs + (n - 1) * share->record_size, 8);
+  s->records += n;
+  return 0;
+}
+
+/*
+    @function tsdb_series_set::fetch
+    @brief read the records [from, to) of series id into block
+    @return mysql error code; a series removed since has no records
+*/
+int tsdb_series_set::fetch(uint id, uint64 from, uint64 to, tsdb_block* block)
+{
+  int rc = 0;
+  uint64 total = records(id);
+  hsize_t start = from;
+  hsize_t count = (to < total ? to : total) - (from < total ? from : total);
+  block->record_size = share->record_size;
+  block->direct = true;
+  block->count = count;
+  block->raw.resize(count * share->record_size);
+  if ( count == 0 )
+    return 0;
+
+  tsdb_file_wait wait(PSI_FILE_READ, share->psi_file, count * share->record_size,
+                      __FILE__, __LINE__);
+  hid_t dset = series[id]->dset;
+  hid_t space = H5Dget_space(dset);
+  hid_t mspace = H5Screate_simple(1, &count, NULL);
+  if ( H5Sselect_hyperslab(space, H5S_SELECT_SET, &start, NULL, &count, NULL) < 0 ||
+       H5Dread(dset, share->records_type, mspace, space, H5P_DEFAULT, &block->raw[0]) < 0 )
+  {
+    block->count = 0;
+    rc = HA_ERR_INTERNAL_ERROR;
+  }
+  H5Sclose(mspace);
+  H5Sclose(space);
+  wait.end(block->count * share->record_size);
+  return rc;
+}
+
+/*
+    @function tsdb_series_set::lower_bound
+    @brief index of the first record of series id before high whose
+           _TSDB_timestamp >= ts
+*/
+uint64 tsdb_series_set::lower_bound(uint id, longlong ts, uint64 high)
+{
+  uint64 low = 0;
+  tsdb_block block;
+  if ( high > records(id) )
+    high = records(id);
+  if ( high == 0 || ts <= series[id]->first_ts )
+    return 0;
+  if ( high == series[id]->records && ts > series[id]->last_ts )
+    return high;
+  while ( low < high )
+  {
+    uint64 mid = low + (high - low) / 2;
+    longlong value;
+    if ( fetch(id, mid, mid + 1, &block) || block.count == 0 )
+      break;
+    memcpy(&value, block.record(0), 8);
+    if ( value < ts )
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/*
+    @function tsdb_series_set::sample
+    @brief a tsdb record holding the key of series id, the other columns
+           zero; decoded, it tells whether the series matches a predicate
+           on its key columns
+*/
+void tsdb_series_set::sample(uint id, uchar* record) const
+{
+  const tsdb_row_codec& codec = share->codec;
+  memset(record, 0, share->record_size);
+  if ( id >= series.size() )
+    return;
+  const std::string& key = series[id]->key;
+  size_t pos = 0;
+  for ( size_t i = 0; i < columns.size() && pos < key.size(); i++ )
+  {
+    const tsdb_codec_op& op = codec.op(columns[i]);
+    if ( key[pos] )
+      codec.set_null(record, columns[i]);
+    memcpy(record + op.dst, key.data() + pos + 1, MY_MIN(op.width, key.size() - pos - 1));
+    pos += 1 + op.width;
+  }
+}
+
+/*
+    @function tsdb_series_set::clear
+    @brief remove every series, for TRUNCATE
+    @return mysql error code
+*/
+int tsdb_series_set::clear()
+{
+  hid_t file = share->file_id;
+  int rc = 0;
+  for ( size_t id = 0; id < series.size(); id++ )
+  {
+    char path[64];
+    snprintf(path, sizeof(path), TSDB_SERIES_GROUP "/%u", (uint)id);
+    H5Dclose(series[id]->dset);
+    if ( H5Ldelete(file, path, H5P_DEFAULT) < 0 )
+      rc = HA_ERR_INTERNAL_ERROR;
+    delete series[id];
+  }
+  series.clear();
+  ids.clear();
+  if ( H5Lexists(file, TSDB_SERIES_CATALOG, H5P_DEFAULT) > 0 )
+    H5Ldelete(file, TSDB_SERIES_CATALOG, H5P_DEFAULT);
+  stats();
+  return rc;
+}
@@ -0,0 +1,87 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_series.h
+    @brief one records dataset per series key of a table
+*/
+#pragma once
+#include "my_global.h"
+#include <map>
+#include <string>
+#include <vector>
+
+class Field;
+class tsdb_engine_share;
+struct tsdb_block;
+struct TABLE;
+
+//group of the .tsdb file holding the records of each series, named by series id
+#define TSDB_SERIES_GROUP "/tsdb_series"
+//dataset of the group: rows of records, first and last _TSDB_timestamp by series id
+#define TSDB_SERIES_CATALOG "/tsdb_series/catalog"
+//attribute of a series dataset: the key of its records, see tsdb_series_set::key_of()
+#define TSDB_SERIES_KEY "tsdb_series_key"
+//records per chunk of a series dataset
+#define TSDB_SERIES_CHUNK 1024
+//row reference of a series table: series id above, record index in the series below
+#define TSDB_SERIES_POS_SHIFT 40
+#define TSDB_SERIES_POS_MASK ((1ULL << TSDB_SERIES_POS_SHIFT) - 1)
+//series id of the records in the reorder buffer, read after the others
+#define TSDB_SERIES_BUFFERED ((uint)((1ULL << (64 - TSDB_SERIES_POS_SHIFT)) - 1))
+
+bool tsdb_series_column(Field* field);
+bool tsdb_series_valid(TABLE* table);
+
+/*
+@brief the series of a table with the tsdb_series= option
+
+Records with the same values in the key columns form a series; each one
+is appended to a dataset of its own, so a query on one key reads its
+records only and a time window is searched within the series. Series get
+dense ids in order of appearance. The count and the time range of each
+series are kept in memory and saved in the catalog when the share is
+released; after a crash the ones not matching their dataset are read
+again. All calls are made under the share mutex.
+*/
+class tsdb_series_set
+{
+  public:
+  tsdb_series_set();
+  ~tsdb_series_set();
+
+  int  open(tsdb_engine_share* share, TABLE* table);
+  void close();
+  bool active() const { return share != NULL; }
+  bool key_column(uint field_index) const;
+
+  uint count() const { return series.size(); }
+  uint64 records() const;
+  uint64 records(uint id) const { return id < series.size() ? series[id]->records : 0; }
+  uint64 late(const uchar* recs, uint64 n, bool in_batch) const;
+
+  int  append(const uchar* recs, uint64 n);
+  int  fetch(uint id, uint64 from, uint64 to, tsdb_block* block);
+  uint64 lower_bound(uint id, longlong ts, uint64 high);
+  void sample(uint id, uchar* record) const;
+  int  clear();
+
+  private:
+  struct entry
+  {
+    std::string key;
+    hid_t dset;
+    uint64 records;
+    longlong first_ts;
+    longlong last_ts;
+  };
+
+  std::string key_of(const uchar* record) const;
+  int  load(uint id, const std::vector<long long>& catalog);
+  int  create(const std::string& key, uint* id);
+  int  write(entry* s, const uchar* recs, uint64 n);
+  void stats();
+
+  tsdb_engine_share* share;
+  std::vector<uint> columns;            ///< codec columns of the key
+  std::vector<entry*> series;           ///< by id
+  std::map<std::string, uint> ids;
+};
@@ -0,0 +1,44 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_stats.cc
+    @brief tsdb_stats implementation
+*/
+
+#include "my_global.h"
+#include "tsdb_stats.h"
+
+
+tsdb_stats_t tsdb_stats;
+
+//microseconds: <10us, <100us, <1ms, <10ms, <100ms, <1s, above
+static const ulonglong latency_bounds[TSDB_LATENCY_BUCKETS - 1]=
+{
+  10, 100, 1000, 10000, 100000, 1000000
+};
+
+/*
+    @function tsdb_stats_fetch
+    @brief account one block read from a records dataset
+*/
+void tsdb_stats_fetch(ulonglong elapsed_us, ulonglong bytes)
+{
+  uint bucket = 0;
+  while ( bucket < TSDB_LATENCY_BUCKETS - 1 && elapsed_us >= latency_bounds[bucket] )
+    bucket++;
+  tsdb_stats_add(&tsdb_stats.blocks_fetched, 1);
+  tsdb_stats_add(&tsdb_stats.bytes_read, bytes);
+  tsdb_stats_add(&tsdb_stats.fetch_time_us, elapsed_us);
+  tsdb_stats_add(&tsdb_stats.fetch_latency[bucket], 1);
+}
+
+/*
+    @function tsdb_stats_append
+    @brief account one batch appended to a series
+*/
+void tsdb_stats_append(ulonglong elapsed_us, ulonglong rows, ulonglong bytes)
+{
+  tsdb_stats_add(&tsdb_stats.append_batches, 1);
+  tsdb_stats_add(&tsdb_stats.rows_appended, rows);
+  tsdb_stats_add(&tsdb_stats.bytes_written, bytes);
+  tsdb_stats_add(&tsdb_stats.append_time_us, elapsed_us);
+}
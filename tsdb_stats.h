@@ -0,0 +1,44 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_stats.h
+    @brief engine wide counters shown by SHOW GLOBAL STATUS LIKE 'tsdb%'
+*/
+#pragma once
+#include "my_global.h"
+#include "my_atomic.h"
+
+//upper bounds of the block fetch latency buckets, the last one is open
+#define TSDB_LATENCY_BUCKETS 7
+
+/*
+@brief tsdb_stats holds the counters of all tables
+
+Counters are bumped once per block, batch or statement, never per row, with
+relaxed atomic adds; SHOW STATUS reads them without a lock.
+*/
+struct tsdb_stats_t
+{
+  int64 rows_appended;
+  int64 rows_read;
+  int64 blocks_fetched;
+  int64 bytes_read;
+  int64 bytes_written;
+  int64 append_batches;
+  int64 block_cache_hits;           ///< rnd_pos() served by tsdb_block_cache
+  int64 block_cache_misses;
+  int64 readahead_hits;             ///< scan block ready in the prefetcher
+  int64 readahead_waits;
+  int64 fetch_time_us;
+  int64 append_time_us;
+  int64 fetch_latency[TSDB_LATENCY_BUCKETS];
+};
+
+extern tsdb_stats_t tsdb_stats;
+
+static inline void tsdb_stats_add(int64* counter, int64 n)
+{
+  my_atomic_add64(counter, n);
+}
+
+void tsdb_stats_fetch(ulonglong elapsed_us, ulonglong bytes);
+void tsdb_stats_append(ulonglong elapsed_us, ulonglong rows, ulonglong bytes);
@@ -0,0 +1,489 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_tags.cc
+    @brief tsdb_dictionary and tsdb_tags implementation
+*/
+
+#include "PCHfile.h"
+#include "sql_class.h"
+#include "ha_tsdb_engine.h"
+#include "tsdb_tags.h"
+#include "log.h"
+#include <algorithm>
+
+//values per chunk of a dictionary dataset
+#define TSDB_TAGS_CHUNK 256
+
+
+/*
+    @function tsdb_tag_column
+    @brief true if the tsdb_tags= option of the table lists the column
+*/
+bool tsdb_tag_column(Field* field)
+{
+  std::vector<std::string> names;
+  if ( field->table == NULL )
+    return false;
+  tsdb_table_option_list(field->table->s, TSDB_OPT_TAGS, &names);
+  for ( size_t i = 0; i < names.size(); i++ )
+  {
+    if ( my_strcasecmp(system_charset_info, names[i].c_str(), field->field_name) == 0 )
+      return true;
+  }
+  return false;
+}
+
+/*
+    @function tsdb_tags_valid
+    @brief every column of the tsdb_tags= option is a string column of table
+*/
+bool tsdb_tags_valid(TABLE* table)
+{
+  std::vector<std::string> names;
+  tsdb_table_option_list(table->s, TSDB_OPT_TAGS, &names);
+  for ( size_t i = 0; i < names.size(); i++ )
+  {
+    Field** mfield = table->field;
+    for ( ; *mfield; mfield++ )
+    {
+      if ( my_strcasecmp(system_charset_info, names[i].c_str(), (*mfield)->field_name) == 0 )
+        break;
+    }
+    if ( *mfield == NULL || tsdb_column_kind(*mfield, TSDB_FORMAT_CURRENT) != TSDB_KIND_TAG )
+    {
+      push_warning_printf(current_thd, Sql_condition::SL_WARNING, ER_ILLEGAL_HA_CREATE_OPTION,
+                          "tsdb_engine: tag '%s' is not a VARCHAR, CHAR, ENUM or SET column",
+                          names[i].c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+
+//tsdb_dictionary impl
+
+//ctor
+tsdb_dictionary::tsdb_dictionary()
+{
+  mysql_mutex_init(tsdb_key_mutex_dictionary, &mutex, MY_MUTEX_INIT_FAST);
+}
+
+//dtor
+tsdb_dictionary::~tsdb_dictionary()
+{
+  mysql_mutex_destroy(&mutex);
+}
+
+/*
+    @function tsdb_dictionary::code
+    @brief code of a value, given to the value the first time it is seen
+*/
+int32 tsdb_dictionary::code(const uchar* value, uint length)
+{
+  std::string key((const char*)value, length);
+  mysql_mutex_lock(&mutex);
+  std::map<std::string, int32>::const_iterator it = codes.find(key);
+  int32 c;
+  if ( it != codes.end() )
+    c = it->second;
+  else
+  {
+    c = (int32)values.size();
+    codes.insert(std::make_pair(key, c));
+    values.push_back(key);
+  }
+  mysql_mutex_unlock(&mutex);
+  return c;
+}
+
+/*
+    @function tsdb_dictionary::value
+    @brief the value of a code, zero padded to TSDB_STRING_WIDTH bytes
+    @details an unknown code reads as the empty string
+*/
+void tsdb_dictionary::value(int32 c, uchar* to) const
+{
+  memset(to, 0, TSDB_STRING_WIDTH);
+  mysql_mutex_lock(&mutex);
+  if ( c >= 0 && (size_t)c < values.size() )
+    memcpy(to, values[c].data(), values[c].size());
+  mysql_mutex_unlock(&mutex);
+}
+
+
+//tsdb_tags impl
+
+//ctor
+tsdb_tags::tsdb_tags()
+{
+  share = NULL;
+  string_type = H5Tcopy(H5T_C_S1);
+  H5Tset_size(string_type, TSDB_STRING_WIDTH);
+  H5Tset_strpad(string_type, H5T_STR_NULLPAD);
+}
+
+//dtor
+tsdb_tags::~tsdb_tags()
+{
+  for ( size_t i = 0; i < columns.size(); i++ )
+  {
+    if ( columns[i]->dset >= 0 )
+      H5Dclose(columns[i]->dset);
+    delete columns[i];
+  }
+  H5Tclose(string_type);
+}
+
+/*
+    @function tsdb_tags::open
+    @brief open or create the dictionaries of the tag columns of share and
+           bind them to its codec
+    @details the block index is read back; when the series was not closed
+             cleanly the records past the ones it covers are indexed again
+    @return mysql error code; tables without tag column return 0
+    @note caller must hold share->mutex, records stats must be loaded
+*/
+int tsdb_tags::open(tsdb_engine_share* inShare)
+{
+  tsdb_row_codec& codec = inShare->codec;
+  hid_t file = inShare->file_id;
+
+  if ( !codec.valid )
+    return 0;
+  for ( uint col = 0; col < codec.columns(); col++ )
+  {
+    if ( codec.op(col).kind != TSDB_KIND_TAG )
+      continue;
+    column* tag = new column;
+    tag->col = col;
+    tag->field_index = codec.op(col).field_index;
+    tag->dset = -1;
+    tag->saved = 0;
+    columns.push_back(tag);
+  }
+  if ( columns.empty() )
+    return 0;
+
+  if ( H5Lexists(file, TSDB_TAGS_GROUP, H5P_DEFAULT) <= 0 )
+  {
+    hid_t group = H5Gcreate2(file, TSDB_TAGS_GROUP, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if ( group < 0 )
+      return HA_ERR_INTERNAL_ERROR;
+    H5Gclose(group);
+  }
+  share = inShare;
+
+  long long covered = -1;
+  if ( H5Aexists_by_name(file, "/", TSDB_TAGS_RECORDS, H5P_DEFAULT) <= 0 ||
+       H5LTget_attribute_long_long(file, "/", TSDB_TAGS_RECORDS, &covered) < 0 ||
+       covered > (long long)share->records )
+    covered = -1;
+  for ( size_t i = 0; i < columns.size(); i++ )
+  {
+    column* tag = columns[i];
+    char name[32];
+    snprintf(name, sizeof(name), "/%u", tag->field_index);
+    tag->path = std::string(TSDB_TAGS_GROUP) + name;
+    int rc = load(tag);
+    if ( rc )
+      return rc;
+    codec.set_dictionary(tag->col, &tag->dict);
+    if ( covered < 0 )
+      tag->blocks.clear();
+  }
+
+  //not closed cleanly: index the records appended since the save
+  uint64 from = covered < 0 ? share->origin : MY_MAX((uint64)covered, share->origin);
+  if ( from < share->records )
+    sql_print_information("tsdb_engine: indexing tags from record %llu", (ulonglong)from);
+  tsdb_block block;
+  for ( uint64 pos = from; pos < share->records; pos += block.count )
+  {
+    int rc = share->fetch_records(pos, pos + TSDB_BLOCK_RECORDS, &block);
+    if ( rc )
+      return rc;
+    if ( block.count == 0 )
+      break;
+    for ( uint64 r = 0; r < block.count; r++ )
+      index(block.record(r), pos + r, 1);
+  }
+  return 0;
+}
+
+/*
+    @function tsdb_tags::load
+    @brief read or create the dictionary of a column and read its block index
+    @return mysql error code
+*/
+int tsdb_tags::load(column* tag)
+{
+  hid_t file = share->file_id;
+  hsize_t dims[1] = { 0 };
+  const char* path = tag->path.c_str();
+
+  if ( H5Lexists(file, path, H5P_DEFAULT) > 0 )
+  {
+    tag->dset = H5Dopen2(file, path, H5P_DEFAULT);
+    if ( tag->dset < 0 )
+      return HA_ERR_INTERNAL_ERROR;
+    hid_t space = H5Dget_space(tag->dset);
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    H5Sclose(space);
+    std::vector<char> buffer(dims[0] * TSDB_STRING_WIDTH + 1);
+    if ( dims[0] > 0 &&
+         H5Dread(tag->dset, string_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, &buffer[0]) < 0 )
+    {
+      sql_print_error("tsdb_engine: cannot read the dictionary %s", path);
+      return HA_ERR_CRASHED_ON_USAGE;
+    }
+    for ( hsize_t c = 0; c < dims[0]; c++ )
+    {
+      const char* value = &buffer[c * TSDB_STRING_WIDTH];
+      size_t length = TSDB_STRING_WIDTH;
+      while ( length > 0 && value[length - 1] == 0 )
+        length--;
+      tag->dict.values.push_back(std::string(value, length));
+      tag->dict.codes.insert(std::make_pair(tag->dict.values.back(), (int32)c));
+    }
+  }
+  else
+  {
+    hsize_t maxdims[1] = { H5S_UNLIMITED };
+    hsize_t chunk[1] = { TSDB_TAGS_CHUNK };
+    hid_t space = H5Screate_simple(1, dims, maxdims);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl, 1, chunk);
+    tag->dset = H5Dcreate2(file, path, string_type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    H5Pclose(dcpl);
+    H5Sclose(space);
+    if ( tag->dset < 0 )
+      return HA_ERR_INTERNAL_ERROR;
+  }
+  tag->saved = dims[0];
+
+  //block index: rows of code, block
+  std::string blocks = tag->path + TSDB_TAGS_BLOCKS;
+  hsize_t bdims[2] = { 0, 2 };
+  if ( H5Lexists(file, blocks.c_str(), H5P_DEFAULT) > 0 &&
+       H5LTget_dataset_info(file, blocks.c_str(), bdims, NULL, NULL) >= 0 && bdims[0] > 0 )
+  {
+    std::vector<long long> rows(bdims[0] * 2);
+    if ( H5LTread_dataset_long_long(file, blocks.c_str(), &rows[0]) < 0 )
+      return 0;     //indexed again from the origin, see open()
+    for ( hsize_t r = 0; r < bdims[0]; r++ )
+    {
+      size_t c = (size_t)rows[2 * r];
+      if ( c >= tag->blocks.size() )
+        tag->blocks.resize(c + 1);
+      tag->blocks[c].push_back((uint32)rows[2 * r + 1]);
+    }
+  }
+  return 0;
+}
+
+/*
+    @function tsdb_tags::save
+    @brief write the values given a code since the last save and flush them
+    @details called before the records using them are logged: a replayed
+             record never refers to a value the file does not have
+    @return mysql error code
+*/
+int tsdb_tags::save()
+{
+  bool written = false;
+  for ( size_t i = 0; i < columns.size(); i++ )
+  {
+    column* tag = columns[i];
+    std::vector<char> buffer;
+    mysql_mutex_lock(&tag->dict.mutex);
+    uint n = tag->dict.values.size();
+    if ( n > tag->saved )
+    {
+      buffer.assign((n - tag->saved) * TSDB_STRING_WIDTH, 0);
+      for ( uint c = tag->saved; c < n; c++ )
+      {
+        const std::string& value = tag->dict.values[c];
+        memcpy(&buffer[(c - tag->saved) * TSDB_STRING_WIDTH], value.data(), value.size());
+      }
+    }
+    mysql_mutex_unlock(&tag->dict.mutex);
+    if ( buffer.empty() )
+      continue;
+
+    hsize_t dims[1] = { n };
+    hsize_t start[1] = { tag->saved };
+    hsize_t count[1] = { n - tag->saved };
+    herr_t err = H5Dset_extent(tag->dset, dims);
+    hid_t space = H5Dget_space(tag->dset);
+    hid_t mspace = H5Screate_simple(1, count, NULL);
+    if ( err >= 0 )
+      err = H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+    if ( err >= 0 )
+      err = H5Dwrite(tag->dset, string_type, mspace, space, H5P_DEFAULT, &buffer[0]);
+    H5Sclose(mspace);
+    H5Sclose(space);
+    if ( err < 0 )
+    {
+      sql_print_error("tsdb_engine: cannot write the dictionary %s", tag->path.c_str());
+      return HA_ERR_INTERNAL_ERROR;
+    }
+    tag->saved = n;
+    written = true;
+  }
+  if ( written && H5Fflush(share->file_id, H5F_SCOPE_LOCAL) < 0 )
+    return HA_ERR_INTERNAL_ERROR;
+  return 0;
+}
+
+//add the blocks of n records, the first one at index first, to the lists of their codes
+void tsdb_tags::index(const uchar* records, uint64 first, uint64 n)
+{
+  const tsdb_row_codec& codec = share->codec;
+  for ( uint64 r = 0; r < n; r++ )
+  {
+    const uchar* record = records + r * share->record_size;
+    uint32 block = (uint32)((first + r) / TSDB_BLOCK_RECORDS);
+    for ( size_t i = 0; i < columns.size(); i++ )
+    {
+      column* tag = columns[i];
+      if ( codec.is_null(record, tag->col) )
+        continue;
+      int32 c = sint4korr(record + codec.op(tag->col).dst);
+      if ( c < 0 )
+        continue;
+      if ( (size_t)c >= tag->blocks.size() )
+        tag->blocks.resize(c + 1);
+      std::vector<uint32>& list = tag->blocks[c];
+      if ( list.empty() || list.back() != block )
+        list.push_back(block);
+    }
+  }
+}
+
+/*
+    @function tsdb_tags::add
+    @brief index n appended records, the first one at index first
+*/
+void tsdb_tags::add(const uchar* records, uint64 first, uint64 n)
+{
+  if ( share == NULL )
+    return;
+  index(records, first, n);
+}
+
+/*
+    @function tsdb_tags::close
+    @brief save the dictionaries and the block index covering the first
+           records of the series
+    @note caller must hold share->mutex
+*/
+void tsdb_tags::close(uint64 records)
+{
+  if ( share == NULL )
+    return;
+  hid_t file = share->file_id;
+  bool saved = save() == 0;
+  //a crash while the lists are rewritten leaves no count: indexed again on open
+  if ( H5Aexists_by_name(file, "/", TSDB_TAGS_RECORDS, H5P_DEFAULT) > 0 )
+    H5Adelete_by_name(file, "/", TSDB_TAGS_RECORDS, H5P_DEFAULT);
+  for ( size_t i = 0; i < columns.size(); i++ )
+  {
+    column* tag = columns[i];
+    std::string path = tag->path + TSDB_TAGS_BLOCKS;
+    std::vector<long long> rows;
+    for ( size_t c = 0; c < tag->blocks.size(); c++ )
+    {
+      for ( size_t b = 0; b < tag->blocks[c].size(); b++ )
+      {
+        rows.push_back(c);
+        rows.push_back(tag->blocks[c][b]);
+      }
+    }
+    if ( H5Lexists(file, path.c_str(), H5P_DEFAULT) > 0 )
+      H5Ldelete(file, path.c_str(), H5P_DEFAULT);
+    hsize_t dims[2] = { rows.size() / 2, 2 };
+    if ( !rows.empty() &&
+         H5LTmake_dataset(file, path.c_str(), 2, dims, H5T_NATIVE_LLONG, &rows[0]) < 0 )
+      saved = false;
+    share->codec.set_dictionary(tag->col, NULL);
+  }
+  if ( saved )
+  {
+    long long covered = records;
+    H5LTset_attribute_long_long(file, "/", TSDB_TAGS_RECORDS, &covered, 1);
+  }
+  else
+    sql_print_warning("tsdb_engine: cannot save the tag index, it is rebuilt on open");
+  share = NULL;
+}
+
+//tag column of a table field, NULL if the field is not a tag
+const tsdb_tags::column* tsdb_tags::find(uint field_index) const
+{
+  for ( size_t i = 0; i < columns.size(); i++ )
+  {
+    if ( columns[i]->field_index == field_index )
+      return columns[i];
+  }
+  return NULL;
+}
+
+/*
+    @function tsdb_tags::lookup
+    @brief codes of the values equal to value in its collation, for a scan
+           filtering on a tag column
+    @return false if the column cannot be filtered: not a tag, or stored
+            as raw bytes (ENUM, SET)
+*/
+bool tsdb_tags::lookup(uint field_index, const String& value, std::vector<int32>* codes) const
+{
+  const column* tag = find(field_index);
+  codes->clear();
+  if ( share == NULL || tag == NULL ||
+       share->codec.op(tag->col).kernel == TSDB_KERNEL_COPY )
+    return false;
+  const CHARSET_INFO* cs = value.charset();
+  mysql_mutex_lock(&tag->dict.mutex);
+  for ( size_t c = 0; c < tag->dict.values.size(); c++ )
+  {
+    const std::string& stored = tag->dict.values[c];
+    String candidate(stored.data(), stored.size(), cs);
+    if ( sortcmp(&candidate, &value, cs) == 0 )
+      codes->push_back((int32)c);
+  }
+  mysql_mutex_unlock(&tag->dict.mutex);
+  return true;
+}
+
+/*
+    @function tsdb_tags::next
+    @brief first record from index in a block holding one of codes
+    @params block_end set to the end of that block
+    @return the record index, ULLONG_MAX if no block is left
+*/
+uint64 tsdb_tags::next(uint field_index, const std::vector<int32>& codes,
+                       uint64 index, uint64* block_end) const
+{
+  const column* tag = find(field_index);
+  uint64 block = index / TSDB_BLOCK_RECORDS;
+  uint64 best = ULLONG_MAX;
+
+  *block_end = ULLONG_MAX;
+  if ( tag == NULL )
+    return index;
+  for ( size_t i = 0; i < codes.size(); i++ )
+  {
+    if ( (size_t)codes[i] >= tag->blocks.size() )
+      continue;
+    const std::vector<uint32>& list = tag->blocks[codes[i]];
+    std::vector<uint32>::const_iterator it =
+      std::lower_bound(list.begin(), list.end(), (uint32)block);
+    if ( it != list.end() && *it < best )
+      best = *it;
+  }
+  if ( best == ULLONG_MAX )
+    return ULLONG_MAX;
+  *block_end = (best + 1) * TSDB_BLOCK_RECORDS;
+  return MY_MAX(index, best * TSDB_BLOCK_RECORDS);
+}
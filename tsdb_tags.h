@@ -0,0 +1,99 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_tags.h
+    @brief dictionary encoded tag columns and their block index
+*/
+#pragma once
+#include "my_global.h"
+#include "mysql/psi/mysql_thread.h"
+#include <map>
+#include <string>
+#include <vector>
+
+class Field;
+class String;
+class tsdb_engine_share;
+struct TABLE;
+
+//group of the .tsdb file holding the dictionaries and the block index
+#define TSDB_TAGS_GROUP "/tsdb_tags"
+//suffix of the block index dataset of a column: rows of code, block
+#define TSDB_TAGS_BLOCKS ".blocks"
+//root attribute: records covered by the saved block index
+#define TSDB_TAGS_RECORDS "tsdb_engine_tags_records"
+
+bool tsdb_tag_column(Field* field);
+bool tsdb_tags_valid(TABLE* table);
+
+/*
+@brief values of one tag column and their int32 codes
+
+The record slot of the column holds the code of the value, the values are
+kept in a dataset of the .tsdb file in code order. Codes are given by
+write_row() threads while they pack rows, hence the mutex of its own;
+new values reach the file from tsdb_tags::save(), before the records
+using them are logged.
+*/
+class tsdb_dictionary
+{
+  public:
+  tsdb_dictionary();
+  ~tsdb_dictionary();
+
+  int32 code(const uchar* value, uint length);
+  void  value(int32 code, uchar* to) const;
+
+  private:
+  friend class tsdb_tags;
+
+  mutable mysql_mutex_t mutex;
+  std::map<std::string, int32> codes;
+  std::vector<std::string> values;  ///< by code
+};
+
+/*
+@brief the tag columns of a series, opened with the row codec
+
+For each column the blocks of TSDB_BLOCK_RECORDS records holding a code
+are listed per code, in block order. A scan with an equality on a tag
+column only reads the blocks listed for the codes equal to the value.
+The lists are kept up to date on append and saved when the share is
+released; after a crash the records past the saved count are indexed
+again. All calls but the codec ones are made under the share mutex.
+*/
+class tsdb_tags
+{
+  public:
+  tsdb_tags();
+  ~tsdb_tags();
+
+  int  open(tsdb_engine_share* share);
+  void close(uint64 records);
+  bool active() const { return !columns.empty(); }
+
+  int  save();
+  void add(const uchar* records, uint64 first, uint64 n);
+  bool lookup(uint field_index, const String& value, std::vector<int32>* codes) const;
+  uint64 next(uint field_index, const std::vector<int32>& codes,
+              uint64 index, uint64* block_end) const;
+
+  private:
+  struct column
+  {
+    uint col;                         ///< codec column
+    uint field_index;
+    std::string path;                 ///< dictionary dataset
+    hid_t dset;
+    uint saved;                       ///< values already in the dataset
+    tsdb_dictionary dict;
+    std::vector<std::vector<uint32> > blocks;   ///< by code, blocks holding it
+  };
+
+  const column* find(uint field_index) const;
+  int  load(column* tag);
+  void index(const uchar* records, uint64 first, uint64 n);
+
+  tsdb_engine_share* share;
+  hid_t string_type;                  ///< values are zero padded to TSDB_STRING_WIDTH
+  std::vector<column*> columns;
+};
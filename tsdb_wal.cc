@@ -0,0 +1,273 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_wal.cc
+    @brief tsdb_wal implementation
+*/
+
+#include "PCHfile.h"
+#include "my_base.h"
+#include "mysql/psi/mysql_file.h"
+#include "log.h"
+#include "tsdb_wal.h"
+#include "tsdb_psi.h"
+
+//file header: magic, record size, spare, records of the series at the checkpoint
+#define TSDB_WAL_MAGIC "TSDBWAL\001"
+#define TSDB_WAL_HEADER 24
+//group header: record count, checksum of the records
+#define TSDB_WAL_GROUP_HEADER 8
+//records of one group, larger inserts are split
+#define TSDB_WAL_GROUP_RECORDS (1 << 20)
+
+
+//ctor
+tsdb_wal::tsdb_wal()
+{
+  file = -1;
+  record_size = 0;
+  length = 0;
+  written = synced = 0;
+  last_sync = 0;
+  syncing = false;
+  mysql_mutex_init(tsdb_key_mutex_wal, &mutex, MY_MUTEX_INIT_FAST);
+  mysql_cond_init(tsdb_key_cond_wal, &cond);
+}
+
+//dtor
+tsdb_wal::~tsdb_wal()
+{
+  close(false);
+  mysql_cond_destroy(&cond);
+  mysql_mutex_destroy(&mutex);
+}
+
+/*
+    @function tsdb_wal::open
+    @brief open or create the log of a series and read back its groups
+    @details a group cut by a crash or failing its checksum ends the log,
+             the file is truncated there. A log that is not ours, or of
+             another record layout, is started again.
+    @params records record count of the series, the checkpoint of a new log
+            checkpoint set to the record count of the series at the last
+            checkpoint
+            logged set to the records logged since, in insert order
+    @return mysql error code
+*/
+int tsdb_wal::open(const char* path, size_t size, uint64 records,
+                   uint64* checkpoint, std::vector<uchar>* logged)
+{
+  uchar header[TSDB_WAL_HEADER];
+  name = path;
+  record_size = size;
+  *checkpoint = records;
+  logged->clear();
+  file = mysql_file_open(tsdb_key_file_wal, path, O_RDWR | O_CREAT, MYF(MY_WME));
+  if ( file < 0 )
+    return HA_ERR_INTERNAL_ERROR;
+
+  my_off_t end = mysql_file_seek(file, 0, MY_SEEK_END, MYF(0));
+  bool valid = end >= TSDB_WAL_HEADER &&
+               mysql_file_pread(file, header, TSDB_WAL_HEADER, 0, MYF(MY_NABP)) == 0 &&
+               memcmp(header, TSDB_WAL_MAGIC, 8) == 0 && uint4korr(header + 8) == record_size;
+  length = TSDB_WAL_HEADER;
+  if ( valid )
+  {
+    *checkpoint = uint8korr(header + 16);
+    while ( length + TSDB_WAL_GROUP_HEADER <= end )
+    {
+      uchar head[TSDB_WAL_GROUP_HEADER];
+      if ( mysql_file_pread(file, head, TSDB_WAL_GROUP_HEADER, length, MYF(MY_NABP)) )
+        break;
+      uint64 count = uint4korr(head);
+      size_t bytes = count * record_size;
+      if ( count == 0 || length + TSDB_WAL_GROUP_HEADER + bytes > end )
+        break;
+      size_t used = logged->size();
+      logged->resize(used + bytes);
+      if ( mysql_file_pread(file, &(*logged)[used], bytes, length + TSDB_WAL_GROUP_HEADER, MYF(MY_NABP)) ||
+           my_checksum(0, &(*logged)[used], bytes) != uint4korr(head + 4) )
+      {
+        logged->resize(used);
+        break;
+      }
+      length += TSDB_WAL_GROUP_HEADER + bytes;
+    }
+    if ( length < end )
+    {
+      sql_print_warning("tsdb_engine: log '%s' ends with an incomplete group, %llu bytes dropped",
+                        name.c_str(), (ulonglong)(end - length));
+      valid = mysql_file_chsize(file, length, 0, MYF(MY_WME)) == 0;
+    }
+  }
+  else
+  {
+    if ( end > 0 )
+      sql_print_warning("tsdb_engine: log '%s' is not readable, starting a new one", name.c_str());
+    valid = write_header(file, records) == 0 &&
+            mysql_file_chsize(file, TSDB_WAL_HEADER, 0, MYF(MY_WME)) == 0 &&
+            mysql_file_sync(file, MYF(MY_WME)) == 0;
+  }
+  if ( !valid )
+  {
+    close(false);
+    return HA_ERR_INTERNAL_ERROR;
+  }
+  written = synced = 0;
+  last_sync = my_micro_time();
+  return 0;
+}
+
+/*
+    @function tsdb_wal::close
+    @brief close the log, remove it once the series is safely closed
+*/
+void tsdb_wal::close(bool remove)
+{
+  if ( file < 0 )
+    return;
+  mysql_file_close(file, MYF(0));
+  file = -1;
+  if ( remove )
+    mysql_file_delete(tsdb_key_file_wal, name.c_str(), MYF(0));
+}
+
+//write the file header of fd
+int tsdb_wal::write_header(File fd, uint64 records)
+{
+  uchar header[TSDB_WAL_HEADER];
+  memcpy(header, TSDB_WAL_MAGIC, 8);
+  int4store(header + 8, (uint32)record_size);
+  int4store(header + 12, 0);
+  int8store(header + 16, records);
+  return mysql_file_pwrite(fd, header, TSDB_WAL_HEADER, 0, MYF(MY_NABP | MY_WME)) ? -1 : 0;
+}
+
+//append the groups of n records to fd at length; length is only moved on success
+int tsdb_wal::write_group(File fd, const uchar* records, uint64 n)
+{
+  my_off_t end = length;
+  while ( n > 0 )
+  {
+    uint64 count = n < TSDB_WAL_GROUP_RECORDS ? n : TSDB_WAL_GROUP_RECORDS;
+    size_t bytes = count * record_size;
+    group.resize(TSDB_WAL_GROUP_HEADER + bytes);
+    int4store(&group[0], (uint32)count);
+    int4store(&group[4], my_checksum(0, records, bytes));
+    memcpy(&group[TSDB_WAL_GROUP_HEADER], records, bytes);
+    if ( mysql_file_pwrite(fd, &group[0], group.size(), end, MYF(MY_NABP | MY_WME)) )
+      return -1;
+    end += group.size();
+    records += bytes;
+    n -= count;
+  }
+  length = end;
+  return 0;
+}
+
+/*
+    @function tsdb_wal::write
+    @brief log n records accepted by an insert
+    @params lsn set to what sync() must reach for them to be durable
+    @return mysql error code
+*/
+int tsdb_wal::write(const uchar* records, uint64 n, uint64* lsn)
+{
+  my_off_t before = length;
+  if ( write_group(file, records, n) )
+    return HA_ERR_INTERNAL_ERROR;
+  mysql_mutex_lock(&mutex);
+  written += length - before;
+  *lsn = written;
+  mysql_mutex_unlock(&mutex);
+  return 0;
+}
+
+/*
+    @function tsdb_wal::sync
+    @brief make the log durable up to lsn, as the engine_flush_log_at_insert
+           policy asks
+    @details one thread runs fsync while the others wait; when it returns
+             every group written before it started is durable, so the
+             waiters it covers return without their own fsync
+    @return mysql error code
+*/
+int tsdb_wal::sync(uint64 lsn, ulong policy)
+{
+  int rc = 0;
+  if ( policy == TSDB_WAL_FLUSH_NONE )
+    return 0;
+  mysql_mutex_lock(&mutex);
+  while ( synced < lsn && rc == 0 && file >= 0 )
+  {
+    if ( syncing )
+    {
+      mysql_cond_wait(&cond, &mutex);
+      continue;
+    }
+    if ( policy == TSDB_WAL_FLUSH_SECOND && my_micro_time() - last_sync < 1000000 )
+      break;
+    uint64 target = written;
+    File fd = file;
+    syncing = true;
+    mysql_mutex_unlock(&mutex);
+    if ( mysql_file_sync(fd, MYF(MY_WME)) )
+      rc = HA_ERR_INTERNAL_ERROR;
+    mysql_mutex_lock(&mutex);
+    syncing = false;
+    if ( rc == 0 )
+    {
+      synced = target > synced ? target : synced;
+      last_sync = my_micro_time();
+    }
+    mysql_cond_broadcast(&cond);
+  }
+  mysql_mutex_unlock(&mutex);
+  return rc;
+}
+
+/*
+    @function tsdb_wal::checkpoint
+    @brief replace the log once the series is flushed
+    @details the new log is written and synced aside, then renamed over
+             the old one: a crash leaves one of them whole
+    @params records record count of the flushed series
+            buffered records not in the series yet, see tsdb_reorder_buffer
+    @return mysql error code
+*/
+int tsdb_wal::checkpoint(uint64 records, const uchar* buffered, uint64 n)
+{
+  std::string tmp = name + ".tmp";
+  my_off_t saved = length;
+  File fd = mysql_file_create(tsdb_key_file_wal, tmp.c_str(), 0,
+                              O_RDWR | O_TRUNC, MYF(MY_WME));
+  if ( fd < 0 )
+    return HA_ERR_INTERNAL_ERROR;
+  length = TSDB_WAL_HEADER;
+  if ( write_header(fd, records) || write_group(fd, buffered, n) ||
+       mysql_file_sync(fd, MYF(MY_WME)) )
+  {
+    mysql_file_close(fd, MYF(0));
+    mysql_file_delete(tsdb_key_file_wal, tmp.c_str(), MYF(0));
+    length = saved;
+    return HA_ERR_INTERNAL_ERROR;
+  }
+
+  mysql_mutex_lock(&mutex);
+  while ( syncing )
+    mysql_cond_wait(&cond, &mutex);
+  if ( mysql_file_rename(tsdb_key_file_wal, tmp.c_str(), name.c_str(), MYF(MY_WME)) )
+  {
+    mysql_mutex_unlock(&mutex);
+    mysql_file_close(fd, MYF(0));
+    mysql_file_delete(tsdb_key_file_wal, tmp.c_str(), MYF(0));
+    length = saved;
+    return HA_ERR_INTERNAL_ERROR;
+  }
+  mysql_file_close(file, MYF(0));
+  file = fd;
+  //what was logged is now in the flushed series or in the synced new log
+  synced = written;
+  last_sync = my_micro_time();
+  mysql_mutex_unlock(&mutex);
+  return 0;
+}
@@ -0,0 +1,70 @@
+/*
+    @Author: Ayoub Serti
+    @file tsdb_wal.h
+    @brief write-ahead log of the records appended to a series
+*/
+#pragma once
+#include "my_global.h"
+#include "my_sys.h"
+#include "mysql/psi/mysql_thread.h"
+#include <string>
+#include <vector>
+
+//log file, appended to the name of the .tsdb file
+#define TSDB_WAL_EXT ".wal"
+//log size that triggers a checkpoint, see tsdb_engine_share::checkpoint()
+#define TSDB_WAL_CHECKPOINT_SIZE (64*1024*1024)
+
+//engine_flush_log_at_insert values
+#define TSDB_WAL_FLUSH_NONE 0       ///< written at each insert, synced by the OS
+#define TSDB_WAL_FLUSH_INSERT 1     ///< synced before the insert returns
+#define TSDB_WAL_FLUSH_SECOND 2     ///< synced at most once per second
+
+/*
+@brief tsdb_wal logs the records of a series until HDF5 has them on disk
+
+The file starts with a header holding the record count of the series at
+the last checkpoint, followed by one group per insert: record count,
+checksum, then the packed records. Records are logged as they are
+accepted, before they reach the reorder buffer or the series. A
+checkpoint flushes the HDF5 files and replaces the log with the records
+still buffered; on open the groups are replayed past the records the
+series already has.
+
+write() and checkpoint() are called under the share mutex. sync() is
+not: inserts that wait on the same fsync share it.
+*/
+class tsdb_wal
+{
+  public:
+  tsdb_wal();
+  ~tsdb_wal();
+
+  int  open(const char* name, size_t record_size, uint64 records,
+            uint64* checkpoint, std::vector<uchar>* logged);
+  void close(bool remove);
+  bool is_open() const { return file >= 0; }
+  my_off_t size() const { return length; }
+
+  int  write(const uchar* records, uint64 n, uint64* lsn);
+  int  sync(uint64 lsn, ulong policy);
+  int  checkpoint(uint64 records, const uchar* buffered, uint64 n);
+
+  private:
+  int  write_group(File fd, const uchar* records, uint64 n);
+  int  write_header(File fd, uint64 records);
+
+  std::string name;
+  File file;                  ///< -1 when the series has no log
+  size_t record_size;
+  my_off_t length;            ///< bytes in the file
+  std::vector<uchar> group;   ///< header and records of the group being written
+
+  //byte counts since the log was opened, checkpoints do not reset them
+  mysql_mutex_t mutex;
+  mysql_cond_t cond;
+  uint64 written;
+  uint64 synced;
+  ulonglong last_sync;        ///< my_micro_time() of the last fsync
+  bool syncing;               ///< a thread is in fsync, the others wait for it
+};